@@ -0,0 +1,340 @@
+#include "alertRules.hpp"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char *const OP_NAMES[] = {"<", "<=", ">", ">=", "==", "!="};
+
+static const char *skipSpaces(const char *c)
+{
+    while(*c == ' ' || *c == '\t') c++;
+    return c;
+}
+
+//matches a word and makes sure it is not just the start of a longer one
+static bool matchWord(const char *&c, const char *word)
+{
+    size_t len = strlen(word);
+    if(strncmp(c, word, len) != 0) return false;
+
+    char next = c[len];
+    if((next >= 'a' && next <= 'z') || (next >= 'A' && next <= 'Z') || (next >= '0' && next <= '9')) return false;
+
+    c += len;
+    return true;
+}
+
+AlertRules::AlertRules()
+    : mNumRules(0)
+{
+}
+
+void AlertRules::clear()
+{
+    mNumRules = 0;
+}
+
+//the rule is put into JSON strings as it is, so it may not contain quotes, backslashes or control characters
+static bool jsonSafe(const char *s)
+{
+    for(; *s; s++)
+    {
+        if(*s == '\"' || *s == '\\' || (uint8_t)*s < 0x20) return false;
+    }
+    return true;
+}
+
+//the name is also a level of the mqtt topic, where + # and / have a meaning
+static bool validName(const char *s)
+{
+    if(!*s) return false;
+    for(; *s; s++)
+    {
+        if(!((*s >= 'a' && *s <= 'z') || (*s >= 'A' && *s <= 'Z') || (*s >= '0' && *s <= '9') || *s == '_' || *s == '-')) return false;
+    }
+    return true;
+}
+
+bool AlertRules::add(const char *name, const char *expr, uint8_t actions, char *error, size_t errorLen)
+{
+    if(!validName(name))
+    {
+        if(error && errorLen > 0) snprintf(error, errorLen, "name of rule %u: only letters, digits, _ and - are allowed", mNumRules + 1);
+        return false;
+    }
+
+    const char *reason = nullptr;
+
+    if(mNumRules >= MAX_RULES) reason = "too many rules";
+    else if(strlen(expr) > MAX_EXPR_LEN) reason = "rule too long";
+    else if(!jsonSafe(expr)) reason = "invalid character";
+    else reason = compile(expr, mRules[mNumRules]);
+
+    if(reason)
+    {
+        if(error && errorLen > 0) snprintf(error, errorLen, "%s: %s", name, reason);
+        return false;
+    }
+
+    Rule &rule = mRules[mNumRules];
+    snprintf(rule.name, sizeof(rule.name), "%s", name);
+    snprintf(rule.expr, sizeof(rule.expr), "%s", expr);
+    rule.actions = actions;
+    rule.active = false;
+    rule.pending = false;
+    rule.since = 0;
+
+    mNumRules++;
+    return true;
+}
+
+const char *AlertRules::compile(const char *expr, Rule &rule)
+{
+    const char *c = skipSpaces(expr);
+
+    bool negate = false;
+    if(*c == '!')
+    {
+        negate = true;
+        c = skipSpaces(c + 1);
+    }
+
+    rule.index = 0;
+    rule.negate = negate;
+    int32_t scale = 1;
+
+    if(strncmp(c, "flags.", 6) == 0)
+    {
+        c += 6;
+        rule.field = FIELD_FLAG;
+        rule.index = -1;
+        for(uint8_t i=0; i<SbmsData::NUM_FLAGS; i++)
+        {
+            if(matchWord(c, SbmsData::flagName(i)))
+            {
+                rule.index = i;
+                break;
+            }
+        }
+        if(rule.index < 0) return "unknown flag";
+    }
+    else if(negate)
+    {
+        return "! only applies to flags";
+    }
+    else if(matchWord(c, "cell"))
+    {
+        rule.field = FIELD_CELL;
+        c = skipSpaces(c);
+        if(*c++ != '[') return "expected cell[n] or cell[*]";
+        if(*c == '*') rule.index = ANY_CELL;
+        else if(*c >= '0' && *c <= '7') rule.index = *c - '0';
+        else return "cell index out of range";
+        c++;
+        if(*c++ != ']') return "expected ]";
+    }
+    else if(matchWord(c, "soc")) rule.field = FIELD_SOC;
+    else if(matchWord(c, "delta")) rule.field = FIELD_DELTA;
+    else if(matchWord(c, "tempInt")) { rule.field = FIELD_TEMP_INT; scale = 10; }
+    else if(matchWord(c, "tempExt")) { rule.field = FIELD_TEMP_EXT; scale = 10; }
+    else if(matchWord(c, "battery")) rule.field = FIELD_BATTERY;
+    else if(matchWord(c, "pv1")) rule.field = FIELD_PV1;
+    else if(matchWord(c, "pv2")) rule.field = FIELD_PV2;
+    else if(matchWord(c, "extLoad")) rule.field = FIELD_EXT_LOAD;
+    else return "unknown value";
+
+    c = skipSpaces(c);
+
+    //comparison, optional for flags
+    const char *op = c;
+    if(c[0] == '<' || c[0] == '>') c += c[1] == '=' ? 2 : 1;
+    else if((c[0] == '=' || c[0] == '!') && c[1] == '=') c += 2;
+
+    if(c != op)
+    {
+        for(uint8_t i=0; i<sizeof(OP_NAMES)/sizeof(OP_NAMES[0]); i++)
+        {
+            if(strlen(OP_NAMES[i]) == (size_t)(c - op) && strncmp(op, OP_NAMES[i], c - op) == 0) rule.op = (Op)i;
+        }
+
+        char *end;
+        double threshold = strtod(skipSpaces(c), &end);
+        if(end == skipSpaces(c)) return "expected a number";
+        c = end;
+
+        threshold *= scale;
+        rule.threshold = (int32_t)(threshold < 0 ? threshold - 0.5 : threshold + 0.5);
+    }
+    else if(rule.field == FIELD_FLAG)
+    {
+        rule.op = OP_EQ;
+        rule.threshold = 1;
+    }
+    else
+    {
+        return "expected a comparison";
+    }
+
+    c = skipSpaces(c);
+
+    rule.holdMs = 0;
+    if(matchWord(c, "for"))
+    {
+        char *end;
+        double hold = strtod(skipSpaces(c), &end);
+        if(end == skipSpaces(c) || hold < 0) return "expected a duration";
+        c = end;
+
+        if(matchWord(c, "ms")) rule.holdMs = hold;
+        else if(matchWord(c, "s")) rule.holdMs = hold * 1000;
+        else return "expected s or ms";
+    }
+
+    c = skipSpaces(c);
+    if(*c) return "unexpected text at the end";
+
+    return nullptr;
+}
+
+bool AlertRules::compare(Op op, int32_t value, int32_t threshold)
+{
+    switch(op)
+    {
+        case OP_LT: return value < threshold;
+        case OP_LE: return value <= threshold;
+        case OP_GT: return value > threshold;
+        case OP_GE: return value >= threshold;
+        case OP_EQ: return value == threshold;
+        case OP_NE: return value != threshold;
+    }
+    return false;
+}
+
+bool AlertRules::test(const Rule &rule, const SbmsData &sbms, int32_t &value, int8_t &cell)
+{
+    cell = -1;
+
+    switch(rule.field)
+    {
+        case FIELD_SOC: value = sbms.stateOfChargePercent; break;
+        case FIELD_TEMP_INT: value = sbms.temperatureInternalTenthC; break;
+        case FIELD_TEMP_EXT: value = sbms.temperatureExternalTenthC; break;
+        case FIELD_BATTERY: value = sbms.batteryCurrentMA; break;
+        case FIELD_PV1: value = sbms.pv1CurrentMA; break;
+        case FIELD_PV2: value = sbms.pv2CurrentMA; break;
+        case FIELD_EXT_LOAD: value = sbms.extLoadCurrentMA; break;
+        case FIELD_FLAG:
+            value = sbms.getFlag((SbmsData::FlagBit)rule.index);
+            return compare(rule.op, rule.negate ? !value : value, rule.threshold); //the event reports the flag itself
+
+        case FIELD_DELTA:
+        {
+            uint16_t minMV, maxMV;
+            sbms.cellRange(minMV, maxMV);
+            value = maxMV - minMV;
+            break;
+        }
+
+        case FIELD_CELL:
+        {
+            if(rule.index != ANY_CELL)
+            {
+                value = sbms.cellVoltageMV[rule.index];
+                cell = rule.index;
+                return value > 0 && compare(rule.op, value, rule.threshold); //an unused cell never alerts
+            }
+
+            //any cell: the highest decides > and >=, the lowest < and <=, the first match == and !=
+            value = 0;
+            for(uint8_t i=0; i<8; i++)
+            {
+                int32_t v = sbms.cellVoltageMV[i];
+                if(v == 0) continue;
+
+                bool better;
+                if(rule.op == OP_GT || rule.op == OP_GE) better = v > value;
+                else if(rule.op == OP_LT || rule.op == OP_LE) better = cell < 0 || v < value;
+                else better = cell < 0 || (compare(rule.op, v, rule.threshold) && !compare(rule.op, value, rule.threshold));
+
+                if(better)
+                {
+                    value = v;
+                    cell = i;
+                }
+            }
+            return cell >= 0 && compare(rule.op, value, rule.threshold);
+        }
+    }
+
+    return compare(rule.op, value, rule.threshold);
+}
+
+uint8_t AlertRules::evaluate(const SbmsData &sbms, uint32_t timeMs, Event *events, uint8_t maxEvents)
+{
+    uint8_t numEvents = 0;
+
+    for(uint8_t i=0; i<mNumRules; i++)
+    {
+        Rule &rule = mRules[i];
+
+        int32_t value;
+        int8_t cell;
+        bool holds = test(rule, sbms, value, cell);
+
+        bool edge = false;
+        if(holds && !rule.active)
+        {
+            if(!rule.pending)
+            {
+                rule.pending = true;
+                rule.since = timeMs;
+            }
+            if(timeMs - rule.since >= rule.holdMs)
+            {
+                rule.active = true;
+                edge = true;
+            }
+        }
+        else if(!holds)
+        {
+            rule.pending = false;
+            if(rule.active)
+            {
+                rule.active = false;
+                edge = true;
+            }
+        }
+
+        if(edge && numEvents < maxEvents)
+        {
+            Event &event = events[numEvents++];
+            event.rule = i;
+            event.active = rule.active;
+            event.value = value;
+            event.cell = rule.field == FIELD_CELL && rule.index == ANY_CELL ? cell : -1;
+        }
+    }
+
+    return numEvents;
+}
+
+size_t AlertRules::eventJson(const Event &event, char *buf, size_t bufLen) const
+{
+    if(bufLen == 0) return 0;
+
+    const Rule &rule = mRules[event.rule];
+    size_t len = snprintf(buf, bufLen, "{\"alert\":\"%s\",\"rule\":\"%s\",\"active\":%s,\"value\":",
+        rule.name, rule.expr, event.active ? "true" : "false");
+
+    if(len < bufLen)
+    {
+        if(rule.field == FIELD_TEMP_INT || rule.field == FIELD_TEMP_EXT) len += snprintf(buf + len, bufLen - len, "%.1f", event.value / 10.0f);
+        else len += snprintf(buf + len, bufLen - len, "%d", event.value);
+    }
+
+    if(len < bufLen && event.cell >= 0) len += snprintf(buf + len, bufLen - len, ",\"cell\":%d", event.cell);
+    if(len < bufLen) len += snprintf(buf + len, bufLen - len, "}");
+
+    return len;
+}
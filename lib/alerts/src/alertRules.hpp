@@ -0,0 +1,123 @@
+#ifndef ALERTRULES_H
+#define ALERTRULES_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "sbmsData.hpp"
+
+//Alert rules evaluated against every decoded sbms frame. Rules are compiled once into a fixed table, evaluation is a
+//loop over that table without any parsing or allocation.
+//
+//Rule syntax: <value> <op> <number> [for <n>s|ms], or [!]flags.<NAME> [for <n>s|ms]
+//  values: soc, cell[0..7], cell[*] (any cell in use), delta (highest minus lowest cell), tempInt, tempExt (degC),
+//          battery, pv1, pv2, extLoad (mA)
+//  ops: < <= > >= == !=
+//  examples: "cell[*] > 3550 for 10s", "flags.DOC", "tempExt < 0", "!flags.DFET for 500ms"
+//  a flag is 0 or 1, ! inverts it before any comparison: "!flags.DFET > 0" is "flags.DFET == 0"
+//
+//An alert is raised once the condition held for the given time and cleared as soon as it no longer holds.
+//Only these edges are reported. Not thread safe, the owner serializes compile and evaluate.
+class AlertRules {
+
+public:
+    static const uint8_t MAX_RULES = 16;
+    static const uint8_t MAX_NAME_LEN = 15;
+    static const uint8_t MAX_EXPR_LEN = 47;
+
+    //what to do on an edge, chosen per rule
+    enum Action : uint8_t {
+        ACTION_MQTT = 1,
+        ACTION_SSE = 2,
+        ACTION_POST = 4
+    };
+
+    //a rule changed its state
+    struct Event {
+        uint8_t rule;
+        bool active;
+        int32_t value; //value that decided the edge, in the units of the frame (mV, mA, 0.1 degC, 0/1 for flags)
+        int8_t cell; //cell of the value for cell[*], otherwise -1
+    };
+
+    AlertRules();
+
+    //removes all rules
+    void clear();
+
+    //compiles a rule and appends it to the table. On failure the table is unchanged and error holds the reason.
+    //The name is a level of the mqtt topic and may only contain letters, digits, _ and -. The rule may not contain quotes,
+    //backslashes or control characters, it is put into JSON as it is.
+    bool add(const char *name, const char *expr, uint8_t actions, char *error = nullptr, size_t errorLen = 0);
+
+    //evaluates all rules, writes the edges into events. Returns the number of events.
+    uint8_t evaluate(const SbmsData &sbms, uint32_t timeMs, Event *events, uint8_t maxEvents);
+
+    uint8_t size() const { return mNumRules; }
+    const char *name(uint8_t rule) const { return mRules[rule].name; }
+    const char *expr(uint8_t rule) const { return mRules[rule].expr; }
+    uint8_t actions(uint8_t rule) const { return mRules[rule].actions; }
+    bool active(uint8_t rule) const { return mRules[rule].active; }
+
+    //JSON message of an event: {"alert":..,"rule":..,"active":..,"value":..[,"cell":..]}. Returns the length, like snprintf.
+    size_t eventJson(const Event &event, char *buf, size_t bufLen) const;
+
+private:
+
+    enum Field : uint8_t {
+        FIELD_SOC,
+        FIELD_CELL,
+        FIELD_DELTA,
+        FIELD_TEMP_INT,
+        FIELD_TEMP_EXT,
+        FIELD_BATTERY,
+        FIELD_PV1,
+        FIELD_PV2,
+        FIELD_EXT_LOAD,
+        FIELD_FLAG
+    };
+
+    enum Op : uint8_t {
+        OP_LT,
+        OP_LE,
+        OP_GT,
+        OP_GE,
+        OP_EQ,
+        OP_NE
+    };
+
+    //index of cell[*]
+    static const int8_t ANY_CELL = -1;
+
+    struct Rule {
+        //compiled form
+        Field field;
+        Op op;
+        int8_t index; //cell or flag bit
+        bool negate; //flags only, inverted before the comparison
+        int32_t threshold; //in the units of the frame
+        uint32_t holdMs;
+        uint8_t actions;
+
+        //state
+        bool active;
+        bool pending; //condition holds, waiting for holdMs
+        uint32_t since;
+
+        char name[MAX_NAME_LEN + 1];
+        char expr[MAX_EXPR_LEN + 1];
+    };
+
+    //compiles expr into rule, returns the reason on failure
+    static const char *compile(const char *expr, Rule &rule);
+
+    //checks the condition, returns the deciding value and cell
+    static bool test(const Rule &rule, const SbmsData &sbms, int32_t &value, int8_t &cell);
+
+    static bool compare(Op op, int32_t value, int32_t threshold);
+
+    Rule mRules[MAX_RULES];
+    uint8_t mNumRules;
+};
+
+#endif
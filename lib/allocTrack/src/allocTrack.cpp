@@ -0,0 +1,285 @@
+#include "allocTrack.hpp"
+
+#include <esp_heap_caps.h>
+
+static portMUX_TYPE sMux = portMUX_INITIALIZER_UNLOCKED;
+
+//subsystem per task. A lookup table instead of thread local storage, because allocations already happen in global constructors
+//before the scheduler (and with it any task context) exists.
+struct TaskTag {
+    TaskHandle_t task;
+    uint8_t subsystem;
+    uint8_t scope; //active AllocScope + 1, 0 if none
+};
+static TaskTag sTasks[AllocTrack::MAX_TASKS];
+
+static AllocTrack::Counters sCounters[ALLOC_NUM_SUBSYSTEMS];
+
+//per pipeline iteration
+static TaskHandle_t sPipelineTask = NULL;
+static volatile bool sInIteration = false;
+static uint32_t sIterationAllocs = 0;
+static uint32_t sIterationBytes = 0;
+static uint32_t sLastIterationAllocs = 0;
+static uint32_t sMaxIterationAllocs = 0;
+static uint32_t sMaxIterationBytes = 0;
+static uint32_t sIterations = 0;
+static uint32_t sAllocatingIterations = 0;
+
+//heap samples, ring buffer
+static AllocTrack::HeapSample sSamples[AllocTrack::HEAP_SAMPLES];
+static uint8_t sSampleHead = 0;
+static uint8_t sSampleCount = 0;
+static uint32_t sLastSampleTime = 0;
+
+static const char *sNames[ALLOC_NUM_SUBSYSTEMS] = {"other", "uart", "store", "decode", "json", "mqtt", "sse", "web", "wifi"};
+
+
+bool AllocTrack::enabled()
+{
+#ifdef ALLOC_TRACKING
+    return true;
+#else
+    return false;
+#endif
+}
+
+//returns the tag of the calling task, registers it if needed. Must be called inside the critical section.
+static TaskTag *taskTag(bool create)
+{
+    TaskHandle_t task = xTaskGetCurrentTaskHandle();
+    if(task == NULL) return NULL;
+
+    for(uint8_t i=0; i<AllocTrack::MAX_TASKS; i++)
+    {
+        if(sTasks[i].task == task) return &sTasks[i];
+    }
+
+    if(create)
+    {
+        for(uint8_t i=0; i<AllocTrack::MAX_TASKS; i++)
+        {
+            if(sTasks[i].task == NULL)
+            {
+                sTasks[i].task = task;
+                sTasks[i].subsystem = ALLOC_OTHER;
+                sTasks[i].scope = 0;
+                return &sTasks[i];
+            }
+        }
+    }
+    return NULL;
+}
+
+//subsystem of the calling task. Must be called inside the critical section.
+static uint8_t currentSubsystem()
+{
+    TaskTag *tag = taskTag(false);
+    if(tag == NULL) return ALLOC_OTHER;
+    return tag->scope ? tag->scope - 1 : tag->subsystem;
+}
+
+void AllocTrack::setTaskSubsystem(AllocSubsystem subsystem)
+{
+    portENTER_CRITICAL(&sMux);
+    TaskTag *tag = taskTag(true);
+    if(tag) tag->subsystem = subsystem;
+    portEXIT_CRITICAL(&sMux);
+}
+
+uint8_t AllocTrack::enterScope(AllocSubsystem subsystem)
+{
+    uint8_t prev = 0;
+    portENTER_CRITICAL(&sMux);
+    TaskTag *tag = taskTag(true);
+    if(tag)
+    {
+        prev = tag->scope;
+        tag->scope = subsystem + 1;
+    }
+    portEXIT_CRITICAL(&sMux);
+    return prev;
+}
+
+void AllocTrack::leaveScope(uint8_t prev)
+{
+    portENTER_CRITICAL(&sMux);
+    TaskTag *tag = taskTag(false);
+    if(tag) tag->scope = prev;
+    portEXIT_CRITICAL(&sMux);
+}
+
+void AllocTrack::beginIteration()
+{
+    sPipelineTask = xTaskGetCurrentTaskHandle();
+    sIterationAllocs = 0;
+    sIterationBytes = 0;
+    sInIteration = true;
+}
+
+void AllocTrack::endIteration()
+{
+    sInIteration = false;
+    sIterations++;
+    sLastIterationAllocs = sIterationAllocs;
+    if(sIterationAllocs > 0) sAllocatingIterations++;
+    if(sIterationAllocs > sMaxIterationAllocs) sMaxIterationAllocs = sIterationAllocs;
+    if(sIterationBytes > sMaxIterationBytes) sMaxIterationBytes = sIterationBytes;
+}
+
+void AllocTrack::sampleHeap()
+{
+    uint32_t t = millis();
+    if(sSampleCount > 0 && t - sLastSampleTime < HEAP_SAMPLE_INTERVAL_MS) return;
+    sLastSampleTime = t;
+
+    HeapSample &s = sSamples[sSampleHead];
+    s.timeS = t / 1000;
+    s.freeBytes = heap_caps_get_free_size(MALLOC_CAP_8BIT);
+    s.largestBlock = heap_caps_get_largest_free_block(MALLOC_CAP_8BIT);
+    s.minFreeBytes = heap_caps_get_minimum_free_size(MALLOC_CAP_8BIT);
+
+    sSampleHead = (sSampleHead + 1) % HEAP_SAMPLES;
+    if(sSampleCount < HEAP_SAMPLES) sSampleCount++;
+}
+
+AllocTrack::Counters AllocTrack::get(AllocSubsystem subsystem)
+{
+    portENTER_CRITICAL(&sMux);
+    Counters c = sCounters[subsystem];
+    portEXIT_CRITICAL(&sMux);
+    return c;
+}
+
+const char *AllocTrack::name(AllocSubsystem subsystem)
+{
+    return sNames[subsystem];
+}
+
+uint8_t AllocTrack::fragmentation(const HeapSample &sample)
+{
+    if(sample.freeBytes == 0) return 0;
+    return 100 - (uint64_t)sample.largestBlock * 100 / sample.freeBytes;
+}
+
+String AllocTrack::report()
+{
+    AllocScope scope(ALLOC_WEB);
+
+    String res;
+    res.reserve(300 + 80 * ALLOC_NUM_SUBSYSTEMS + 70 * sSampleCount);
+
+    res += "{\"tracking\":";
+    res += enabled() ? "true" : "false";
+
+    res += ",\"subsystems\":{";
+    for(uint8_t i=0; i<ALLOC_NUM_SUBSYSTEMS; i++)
+    {
+        Counters c = get((AllocSubsystem)i);
+        if(i > 0) res += ",";
+        res += "\"";
+        res += sNames[i];
+        res += "\":{\"allocs\":";
+        res += c.allocs;
+        res += ",\"frees\":";
+        res += c.frees;
+        res += ",\"bytes\":";
+        res += (uint32_t)c.bytes;
+        res += "}";
+    }
+
+    res += "},\"pipeline\":{\"iterations\":";
+    res += sIterations;
+    res += ",\"allocatingIterations\":";
+    res += sAllocatingIterations;
+    res += ",\"lastAllocs\":";
+    res += sLastIterationAllocs;
+    res += ",\"maxAllocs\":";
+    res += sMaxIterationAllocs;
+    res += ",\"maxBytes\":";
+    res += sMaxIterationBytes;
+
+    res += "},\"heap\":[";
+    for(uint8_t i=0; i<sSampleCount; i++) //oldest first
+    {
+        const HeapSample &s = sSamples[(sSampleHead + HEAP_SAMPLES - sSampleCount + i) % HEAP_SAMPLES];
+        if(i > 0) res += ",";
+        res += "{\"t\":";
+        res += s.timeS;
+        res += ",\"free\":";
+        res += s.freeBytes;
+        res += ",\"largest\":";
+        res += s.largestBlock;
+        res += ",\"minFree\":";
+        res += s.minFreeBytes;
+        res += ",\"frag\":";
+        res += fragmentation(s);
+        res += "}";
+    }
+    res += "]}";
+
+    return res;
+}
+
+void AllocTrack::countAlloc(size_t size)
+{
+    portENTER_CRITICAL(&sMux);
+    uint8_t subsystem = currentSubsystem();
+    sCounters[subsystem].allocs++;
+    sCounters[subsystem].bytes += size;
+    if(sInIteration && xTaskGetCurrentTaskHandle() == sPipelineTask)
+    {
+        sIterationAllocs++;
+        sIterationBytes += size;
+    }
+    portEXIT_CRITICAL(&sMux);
+}
+
+void AllocTrack::countFree()
+{
+    portENTER_CRITICAL(&sMux);
+    uint8_t subsystem = currentSubsystem();
+    sCounters[subsystem].frees++;
+    portEXIT_CRITICAL(&sMux);
+}
+
+
+#ifdef ALLOC_TRACKING
+
+//allocator wrappers, activated by the linker with --wrap. Everything going through the C heap ends up here,
+//including operator new (libstdc++ uses malloc) and Arduino String (realloc).
+extern "C" {
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t n, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+void __real_free(void *ptr);
+
+void *__wrap_malloc(size_t size)
+{
+    AllocTrack::countAlloc(size);
+    return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t n, size_t size)
+{
+    AllocTrack::countAlloc(n * size);
+    return __real_calloc(n, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size)
+{
+    if(size > 0) AllocTrack::countAlloc(size); //counted even if the block can grow in place, the allocator is still involved
+    else if(ptr) AllocTrack::countFree();
+    return __real_realloc(ptr, size);
+}
+
+void __wrap_free(void *ptr)
+{
+    if(ptr) AllocTrack::countFree();
+    __real_free(ptr);
+}
+
+}
+
+#endif
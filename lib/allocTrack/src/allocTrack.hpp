@@ -0,0 +1,108 @@
+#ifndef ALLOCTRACK_H
+#define ALLOCTRACK_H
+
+#include <Arduino.h>
+
+//Heap allocation tracking.
+//Build with -DALLOC_TRACKING and -Wl,--wrap=malloc,--wrap=calloc,--wrap=realloc,--wrap=free (see env:alloctrack) to count every
+//allocation made through the C heap (including Arduino String and operator new) per subsystem and per iteration of the publishing pipeline.
+//Heap fragmentation sampling is always available, it does not need the wrapped allocator.
+
+enum AllocSubsystem : uint8_t {
+    ALLOC_OTHER = 0,
+    ALLOC_UART,
+    ALLOC_STORE,
+    ALLOC_DECODE,
+    ALLOC_JSON,
+    ALLOC_MQTT,
+    ALLOC_SSE,
+    ALLOC_WEB,
+    ALLOC_WIFI,
+    ALLOC_NUM_SUBSYSTEMS
+};
+
+class AllocTrack {
+
+public:
+
+    struct Counters {
+        uint32_t allocs;
+        uint32_t frees;
+        uint64_t bytes;
+    };
+
+    struct HeapSample {
+        uint32_t timeS;
+        uint32_t freeBytes;
+        uint32_t largestBlock;
+        uint32_t minFreeBytes;
+    };
+
+    //true if the allocator is wrapped in this build
+    static bool enabled();
+
+    //sets the subsystem all allocations of the calling task are accounted to (outside of any AllocScope)
+    static void setTaskSubsystem(AllocSubsystem subsystem);
+
+    //mark begin and end of one pipeline iteration. Allocations made by the calling task in between are counted for that iteration.
+    static void beginIteration();
+    static void endIteration();
+
+    //take a heap sample if the sampling interval has passed. Call periodically.
+    static void sampleHeap();
+
+    //returns the counters of one subsystem
+    static Counters get(AllocSubsystem subsystem);
+
+    //name of a subsystem for reports
+    static const char *name(AllocSubsystem subsystem);
+
+    //full report as JSON
+    static String report();
+
+    //fragmentation in percent: how much of the free heap is not usable as one block
+    static uint8_t fragmentation(const HeapSample &sample);
+
+    //called from the allocator wrappers
+    static void countAlloc(size_t size);
+    static void countFree();
+
+    static const uint8_t HEAP_SAMPLES = 60;
+    static const uint32_t HEAP_SAMPLE_INTERVAL_MS = 60000;
+
+    //max number of tasks with their own subsystem or scope
+    static const uint8_t MAX_TASKS = 8;
+
+private:
+
+    //enter/leave an AllocScope on the calling task, returns the previous scope
+    static uint8_t enterScope(AllocSubsystem subsystem);
+    static void leaveScope(uint8_t prev);
+
+    friend class AllocScope;
+};
+
+
+//accounts all allocations of the current task to the given subsystem while in scope. Compiles to nothing without ALLOC_TRACKING.
+class AllocScope {
+
+public:
+#ifdef ALLOC_TRACKING
+    AllocScope(AllocSubsystem subsystem)
+        : mPrev(AllocTrack::enterScope(subsystem))
+    {
+    }
+
+    ~AllocScope()
+    {
+        AllocTrack::leaveScope(mPrev);
+    }
+
+private:
+    uint8_t mPrev;
+#else
+    AllocScope(AllocSubsystem subsystem) {}
+#endif
+};
+
+#endif
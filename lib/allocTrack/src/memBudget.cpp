@@ -0,0 +1,205 @@
+#include "memBudget.hpp"
+
+#include <esp_heap_caps.h>
+#include <esp_log.h>
+
+static const char *TAG = "mem";
+
+static portMUX_TYPE sMux = portMUX_INITIALIZER_UNLOCKED;
+
+//word aligned, in .bss so it is never part of the heap
+static uint8_t sArena[MemBudget::ARENA_SIZE] __attribute__((aligned(4)));
+static size_t sArenaUsed = 0;
+
+struct Block {
+    const char *name;
+    uint32_t size;
+    uint32_t peak;
+    uint8_t subsystem;
+    uint8_t placement;
+};
+
+struct Task {
+    TaskHandle_t handle;
+    uint32_t stackSize;
+    uint32_t minFree; //at the last check
+};
+
+static Block sBlocks[MemBudget::MAX_BLOCKS];
+static uint8_t sBlockCount = 0;
+
+static Task sTasks[MemBudget::MAX_TASKS];
+static uint8_t sTaskCount = 0;
+static uint32_t sLastStackCheck = 0;
+static uint32_t sStackWarnings = 0;
+
+static const char *sPlacements[] = {"arena", "heap", "static"};
+
+uint8_t MemBudget::add(AllocSubsystem subsystem, const char *name, size_t size, Placement placement)
+{
+    portENTER_CRITICAL(&sMux);
+    uint8_t index = sBlockCount;
+    if(index < MAX_BLOCKS)
+    {
+        sBlocks[index] = {name, (uint32_t)size, 0, subsystem, placement};
+        sBlockCount++;
+    }
+    portEXIT_CRITICAL(&sMux);
+    return index;
+}
+
+void *MemBudget::carve(AllocSubsystem subsystem, const char *name, size_t size, uint8_t *block)
+{
+    size_t aligned = (size + 3) & ~3;
+    void *data = nullptr;
+
+    portENTER_CRITICAL(&sMux);
+    if(sArenaUsed + aligned <= ARENA_SIZE)
+    {
+        data = sArena + sArenaUsed;
+        sArenaUsed += aligned;
+    }
+    portEXIT_CRITICAL(&sMux);
+
+    Placement placement = IN_ARENA;
+    if(!data)
+    {
+        ESP_LOGW(TAG, "arena exhausted, %s (%u bytes) from the heap", name, (unsigned)size);
+        data = heap_caps_malloc(aligned, MALLOC_CAP_8BIT);
+        placement = IN_HEAP;
+    }
+
+    uint8_t index = add(subsystem, name, size, placement);
+    if(block) *block = index;
+    return data;
+}
+
+void MemBudget::reserve(AllocSubsystem subsystem, const char *name, size_t size, uint8_t *block)
+{
+    uint8_t index = add(subsystem, name, size, OUTSIDE);
+    if(block) *block = index;
+}
+
+void MemBudget::used(uint8_t block, size_t bytes)
+{
+    //a single writer per block, no lock needed for the peak
+    if(block < sBlockCount && bytes > sBlocks[block].peak) sBlocks[block].peak = bytes;
+}
+
+void MemBudget::addTask(TaskHandle_t task, uint32_t stackSize)
+{
+    if(!task) return;
+
+    portENTER_CRITICAL(&sMux);
+    if(sTaskCount < MAX_TASKS) sTasks[sTaskCount++] = {task, stackSize, stackSize};
+    portEXIT_CRITICAL(&sMux);
+}
+
+void MemBudget::checkStacks()
+{
+    uint32_t now = millis();
+    if(sLastStackCheck != 0 && now - sLastStackCheck < STACK_CHECK_INTERVAL_MS) return;
+    sLastStackCheck = now | 1;
+
+    for(uint8_t i=0; i<sTaskCount; i++)
+    {
+        Task &task = sTasks[i];
+        uint32_t minFree = uxTaskGetStackHighWaterMark(task.handle); //bytes on the esp32
+        if(minFree < STACK_LOW_BYTES && task.minFree >= STACK_LOW_BYTES)
+        {
+            sStackWarnings++;
+            ESP_LOGW(TAG, "stack of %s low: %u of %u bytes left", pcTaskGetTaskName(task.handle), (unsigned)minFree, (unsigned)task.stackSize);
+        }
+        task.minFree = minFree;
+    }
+}
+
+String MemBudget::report()
+{
+    AllocScope scope(ALLOC_WEB);
+
+    sLastStackCheck = 0; //fresh values
+    checkStacks();
+
+    uint32_t reserved[ALLOC_NUM_SUBSYSTEMS] = {0};
+    uint32_t peak[ALLOC_NUM_SUBSYSTEMS] = {0};
+    uint32_t total = 0;
+
+    String res;
+    res.reserve(200 + 90 * sBlockCount + 60 * ALLOC_NUM_SUBSYSTEMS + 80 * sTaskCount);
+
+    res += "{\"arena\":{\"size\":";
+    res += (uint32_t)ARENA_SIZE;
+    res += ",\"used\":";
+    res += (uint32_t)sArenaUsed;
+
+    res += "},\"blocks\":[";
+    for(uint8_t i=0; i<sBlockCount; i++)
+    {
+        const Block &b = sBlocks[i];
+        reserved[b.subsystem] += b.size;
+        peak[b.subsystem] += b.peak;
+        total += b.size;
+
+        if(i > 0) res += ",";
+        res += "{\"name\":\"";
+        res += b.name;
+        res += "\",\"subsystem\":\"";
+        res += AllocTrack::name((AllocSubsystem)b.subsystem);
+        res += "\",\"in\":\"";
+        res += sPlacements[b.placement];
+        res += "\",\"size\":";
+        res += b.size;
+        if(b.peak > 0) //only measured for the blocks that report it
+        {
+            res += ",\"peak\":";
+            res += b.peak;
+        }
+        res += "}";
+    }
+
+    res += "],\"subsystems\":{";
+    bool first = true;
+    for(uint8_t i=0; i<ALLOC_NUM_SUBSYSTEMS; i++)
+    {
+        if(reserved[i] == 0) continue;
+        if(!first) res += ",";
+        first = false;
+        res += "\"";
+        res += AllocTrack::name((AllocSubsystem)i);
+        res += "\":{\"reserved\":";
+        res += reserved[i];
+        res += ",\"peak\":";
+        res += peak[i];
+        res += "}";
+    }
+
+    res += "},\"total\":";
+    res += total;
+
+    res += ",\"stackWarnings\":";
+    res += sStackWarnings;
+    res += ",\"tasks\":[";
+    for(uint8_t i=0; i<sTaskCount; i++)
+    {
+        const Task &t = sTasks[i];
+        if(i > 0) res += ",";
+        res += "{\"name\":\"";
+        res += pcTaskGetTaskName(t.handle);
+        res += "\",\"stack\":";
+        res += t.stackSize;
+        res += ",\"minFree\":";
+        res += t.minFree;
+        res += ",\"low\":";
+        res += t.minFree < STACK_LOW_BYTES ? "true" : "false";
+        res += "}";
+    }
+
+    res += "],\"heap\":{\"free\":";
+    res += heap_caps_get_free_size(MALLOC_CAP_8BIT);
+    res += ",\"largest\":";
+    res += heap_caps_get_largest_free_block(MALLOC_CAP_8BIT);
+    res += "}}";
+
+    return res;
+}
@@ -0,0 +1,55 @@
+#ifndef MEMBUDGET_H
+#define MEMBUDGET_H
+
+#include <Arduino.h>
+
+#include "allocTrack.hpp"
+
+//Memory budget of the long-lived buffers.
+//Pipeline buffers are carved once at startup from a fixed arena instead of the heap or the task stacks, so their total is
+//known at build time and they never fragment the heap. Buffers that stay static are registered for the overview as well.
+//The report lists reserved and peak used bytes per buffer and subsystem, and the stack high water mark of every registered task.
+class MemBudget {
+
+public:
+    static const size_t ARENA_SIZE = 3072; //jsonBuffer and the rx buffers of three uarts
+
+    static const uint8_t MAX_BLOCKS = 24;
+    static const uint8_t MAX_TASKS = 12;
+
+    //a task with less stack than this left at its deepest point is reported as low
+    static const uint32_t STACK_LOW_BYTES = 512;
+
+    static const uint32_t STACK_CHECK_INTERVAL_MS = 10000;
+
+    //returns size bytes for a buffer that lives until reboot. Falls back to the heap once the arena is exhausted, which the report shows.
+    //The index of the block for used() is written to block if given.
+    static void *carve(AllocSubsystem subsystem, const char *name, size_t size, uint8_t *block = nullptr);
+
+    //accounts a buffer outside of the arena: static, or part of an object
+    static void reserve(AllocSubsystem subsystem, const char *name, size_t size, uint8_t *block = nullptr);
+
+    //records how much of a block was used, the report shows the peak. Cheap enough for every frame.
+    static void used(uint8_t block, size_t bytes);
+
+    //watches the stack of a task. The size is the one given at creation, in bytes.
+    static void addTask(TaskHandle_t task, uint32_t stackSize);
+
+    //checks the stacks if the interval has passed and logs the ones running low. Call periodically.
+    static void checkStacks();
+
+    //full report as JSON
+    static String report();
+
+private:
+
+    enum Placement : uint8_t {
+        IN_ARENA,
+        IN_HEAP, //arena exhausted
+        OUTSIDE //registered with reserve()
+    };
+
+    static uint8_t add(AllocSubsystem subsystem, const char *name, size_t size, Placement placement);
+};
+
+#endif
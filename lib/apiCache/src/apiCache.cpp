@@ -0,0 +1,182 @@
+#include "apiCache.hpp"
+
+ApiCache::ApiCache(const char *prefix)
+    : mPrefix(prefix)
+    , mEntries()
+    , mCount(0)
+{
+    mBoot = esp_random();
+    mMutex = xSemaphoreCreateMutex();
+}
+
+ApiCache::~ApiCache()
+{
+    for(uint8_t i=0; i<mCount; i++) free(mEntries[i].json);
+    vSemaphoreDelete(mMutex);
+}
+
+int8_t ApiCache::add(const char *name, uint8_t source, size_t size)
+{
+    xSemaphoreTake(mMutex, portMAX_DELAY);
+
+    int8_t index = -1;
+    if(mCount < MAX_ENTRIES)
+    {
+        index = mCount;
+        Entry &entry = mEntries[index];
+        strlcpy(entry.name, name, sizeof(entry.name));
+        entry.source = source;
+        entry.size = size;
+        entry.json = nullptr;
+        entry.length = 0;
+        entry.seq = 0;
+        entry.wanted = false;
+        entry.sent = 0;
+        entry.notModified = 0;
+        entry.tooLarge = 0;
+        mCount++;
+    }
+
+    xSemaphoreGive(mMutex);
+    return index;
+}
+
+bool ApiCache::wanted(int8_t entry) const
+{
+    return entry >= 0 && entry < mCount && mEntries[entry].wanted;
+}
+
+bool ApiCache::waiting(int8_t entry) const
+{
+    return wanted(entry) && mEntries[entry].length == 0;
+}
+
+void ApiCache::update(int8_t entry, uint32_t seq, const char *json, size_t len)
+{
+    if(!wanted(entry)) return;
+
+    xSemaphoreTake(mMutex, portMAX_DELAY);
+
+    Entry &e = mEntries[entry];
+    if(len < e.size)
+    {
+        memcpy(e.json, json, len);
+        e.json[len] = 0;
+        e.length = len;
+        e.seq = seq;
+    }
+    else
+    {
+        e.tooLarge++;
+    }
+
+    xSemaphoreGive(mMutex);
+}
+
+void ApiCache::formatEtag(const Entry &entry, char *buf, size_t bufLen) const
+{
+    snprintf(buf, bufLen, "\"%04x-%u\"", mBoot, entry.seq);
+}
+
+size_t ApiCache::statsJson(char *buf, size_t bufLen)
+{
+    if(bufLen == 0) return 0;
+
+    size_t len = snprintf(buf, bufLen, "[");
+
+    xSemaphoreTake(mMutex, portMAX_DELAY);
+
+    for(uint8_t i=0; i<mCount && len < bufLen; i++)
+    {
+        const Entry &e = mEntries[i];
+        len += snprintf(buf + len, bufLen - len, "%s{\"name\":\"%s\",\"source\":%u,\"seq\":%u,\"bytes\":%u,\"allocated\":%u,"
+                                                 "\"sent\":%u,\"notModified\":%u,\"tooLarge\":%u}",
+            i ? "," : "", e.name, e.source, e.seq, (unsigned)e.length, (unsigned)(e.json ? e.size : 0), e.sent, e.notModified, e.tooLarge);
+    }
+
+    xSemaphoreGive(mMutex);
+
+    if(len < bufLen) len += snprintf(buf + len, bufLen - len, "]");
+    return len;
+}
+
+bool ApiCache::canHandle(AsyncWebServerRequest *request)
+{
+    if(!(request->method() & (HTTP_GET | HTTP_HEAD))) return false;
+    if(!request->url().startsWith(mPrefix)) return false;
+
+    //headers are only kept if asked for before they are parsed
+    request->addInterestingHeader("If-None-Match");
+    return true;
+}
+
+void ApiCache::handleRequest(AsyncWebServerRequest *request)
+{
+    String name = request->url().substring(mPrefix.length());
+    if(name.isEmpty())
+    {
+        char res[MAX_ENTRIES * 150];
+        size_t len = statsJson(res, sizeof(res));
+        if(len >= sizeof(res)) request->send(500, "text/plain", "buffer too small");
+        else request->send(200, "application/json", res);
+        return;
+    }
+
+    uint8_t source = request->hasParam("source") ? request->getParam("source")->value().toInt() : 0;
+    String match = request->hasHeader("If-None-Match") ? request->header("If-None-Match") : String();
+
+    xSemaphoreTake(mMutex, portMAX_DELAY);
+
+    Entry *entry = nullptr;
+    for(uint8_t i=0; i<mCount && !entry; i++)
+    {
+        if(mEntries[i].source == source && name == mEntries[i].name) entry = &mEntries[i];
+    }
+
+    if(!entry)
+    {
+        xSemaphoreGive(mMutex);
+        request->send(404, "text/plain", "Not found");
+        return;
+    }
+
+    if(!entry->json)
+    {
+        entry->json = (char*)malloc(entry->size);
+        entry->wanted = entry->json != nullptr; //from now on the publisher keeps the value up to date
+    }
+
+    if(entry->length == 0)
+    {
+        xSemaphoreGive(mMutex);
+        AsyncWebServerResponse *response = request->beginResponse(503, "text/plain", entry->wanted ? "no value yet" : "out of memory");
+        response->addHeader("Retry-After", "1");
+        request->send(response);
+        return;
+    }
+
+    char etag[24];
+    formatEtag(*entry, etag, sizeof(etag));
+
+    //If-None-Match may list several tags, a weak "W/" prefix still contains the quoted tag
+    if(match.length() && (match == "*" || match.indexOf(etag) >= 0))
+    {
+        entry->notModified++;
+        xSemaphoreGive(mMutex);
+
+        AsyncWebServerResponse *response = request->beginResponse(304);
+        response->addHeader("ETag", etag);
+        request->send(response);
+        return;
+    }
+
+    String body(entry->json); //the entry may change while the response is sent
+    entry->sent++;
+
+    xSemaphoreGive(mMutex);
+
+    AsyncWebServerResponse *response = request->beginResponse(200, "application/json", body);
+    response->addHeader("Cache-Control", "no-cache"); //revalidate with the ETag every time
+    response->addHeader("ETag", etag);
+    request->send(response);
+}
@@ -0,0 +1,71 @@
+#ifndef APICACHE_H
+#define APICACHE_H
+
+#include <Arduino.h>
+
+#include <ESPAsyncWebServer.h>
+
+//Serves the latest JSON of decoded variables at <prefix><name>?source=n (source 0 without the parameter), for pollers.
+//The publisher hands every new value over with the sequence number of the frame it was decoded from, which is the ETag:
+//a poller that already has the value is answered with 304 from the entry alone, nothing is copied or decoded.
+//An entry gets its buffer with its first request. Until then update() does nothing and the publisher can skip building
+//the value, see wanted(). <prefix> alone lists the entries.
+class ApiCache : public AsyncWebHandler {
+
+public:
+    static const uint8_t MAX_ENTRIES = 8;
+    static const uint8_t MAX_NAME_LEN = 15;
+
+    ApiCache(const char *prefix);
+    ~ApiCache();
+
+    //adds a variable of a source, size is the space for its JSON including the terminating zero. Returns the entry, -1 if full.
+    int8_t add(const char *name, uint8_t source, size_t size);
+
+    //the entry was requested, its value has to be kept up to date. Cheap enough for every frame.
+    bool wanted(int8_t entry) const;
+
+    //the entry was requested, but has no value yet
+    bool waiting(int8_t entry) const;
+
+    //replaces the value of a wanted entry, from any task. JSON longer than the size of the entry is dropped.
+    void update(int8_t entry, uint32_t seq, const char *json, size_t len);
+
+    //the entries with their sequence number and requests as JSON array. Returns the length, like snprintf.
+    size_t statsJson(char *buf, size_t bufLen);
+
+    //AsyncWebHandler
+    bool canHandle(AsyncWebServerRequest *request) override;
+    void handleRequest(AsyncWebServerRequest *request) override;
+
+private:
+
+    struct Entry {
+        char name[MAX_NAME_LEN + 1];
+        uint8_t source;
+        size_t size;
+        char *json; //allocated with the first request
+        size_t length; //0 while there is no value
+        uint32_t seq;
+        bool wanted;
+
+        uint32_t sent;
+        uint32_t notModified;
+        uint32_t tooLarge;
+    };
+
+    //quoted ETag of the current value
+    void formatEtag(const Entry &entry, char *buf, size_t bufLen) const;
+
+    String mPrefix;
+
+    //part of every ETag, so a tag from before a reboot doesn't match the same sequence number now
+    uint16_t mBoot;
+
+    SemaphoreHandle_t mMutex;
+
+    Entry mEntries[MAX_ENTRIES];
+    uint8_t mCount;
+};
+
+#endif
@@ -0,0 +1,67 @@
+
+#include "assetBundle.hpp"
+
+AssetBundle::AssetBundle(const Asset *assets, size_t count) : mAssets(assets), mCount(count)
+{
+    memset(&mStats, 0, sizeof(mStats));
+}
+
+const AssetBundle::Asset *AssetBundle::find(const String &url) const
+{
+    for(size_t i=0; i<mCount; i++)
+    {
+        if(url == mAssets[i].path) return &mAssets[i];
+    }
+    return nullptr;
+}
+
+bool AssetBundle::canHandle(AsyncWebServerRequest *request)
+{
+    if(!(request->method() & (HTTP_GET | HTTP_HEAD))) return false;
+    if(!find(request->url())) return false;
+
+    //headers are only kept if asked for before they are parsed
+    request->addInterestingHeader("If-None-Match");
+    return true;
+}
+
+void AssetBundle::handleRequest(AsyncWebServerRequest *request)
+{
+    const Asset *asset = find(request->url());
+    if(!asset)
+    {
+        request->send(404);
+        return;
+    }
+
+    //If-None-Match may list several tags, a weak "W/" prefix still contains the quoted tag
+    if(!asset->immutable && request->hasHeader("If-None-Match"))
+    {
+        String match = request->header("If-None-Match");
+        if(match == "*" || match.indexOf(asset->etag) >= 0)
+        {
+            mStats.notModified++;
+            AsyncWebServerResponse *response = request->beginResponse(304);
+            response->addHeader("ETag", asset->etag);
+            request->send(response);
+            return;
+        }
+    }
+
+    //sent in chunks from the mapped flash into the TCP buffer
+    AsyncWebServerResponse *response = request->beginResponse_P(200, asset->contentType, asset->data, asset->length);
+    if(asset->gzip) response->addHeader("Content-Encoding", "gzip");
+    if(asset->immutable)
+    {
+        response->addHeader("Cache-Control", "public, max-age=31536000, immutable");
+    }
+    else
+    {
+        response->addHeader("Cache-Control", "no-cache"); //revalidate with the ETag every time
+        response->addHeader("ETag", asset->etag);
+    }
+    request->send(response);
+
+    mStats.sent++;
+    mStats.bytes += asset->length;
+}
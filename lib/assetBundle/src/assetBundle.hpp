@@ -0,0 +1,51 @@
+#ifndef ASSETBUNDLE_H
+#define ASSETBUNDLE_H
+
+#include <Arduino.h>
+
+#include <ESPAsyncWebServer.h>
+
+//Serves the web interface from a table of files compiled into the firmware (see tools/bundle_assets.py).
+//The content is const data in the app partition, which is mapped into the address space through the flash cache, so a
+//request is answered straight from flash: no SPIFFS lookup, no file handle and no copy on the heap.
+//Files with a content hash in their name never change and are cached by the browser for good. All others carry an
+//ETag and are answered with 304 if the browser already has them.
+class AssetBundle : public AsyncWebHandler {
+
+public:
+    struct Asset {
+        const char *path; //url, starting with /
+        const char *contentType;
+        const char *etag; //including the quotation marks
+        const uint8_t *data;
+        uint32_t length;
+        bool gzip; //data is gzip encoded
+        bool immutable; //hashed file name
+    };
+
+    struct Stats {
+        uint32_t sent;
+        uint32_t notModified;
+        uint32_t bytes;
+    };
+
+    AssetBundle(const Asset *assets, size_t count);
+
+    //the asset of an url, nullptr if not in the bundle
+    const Asset *find(const String &url) const;
+
+    Stats getStats() const { return mStats; }
+
+    //AsyncWebHandler
+    bool canHandle(AsyncWebServerRequest *request) override;
+    void handleRequest(AsyncWebServerRequest *request) override;
+
+private:
+
+    const Asset *mAssets;
+    size_t mCount;
+
+    Stats mStats;
+};
+
+#endif
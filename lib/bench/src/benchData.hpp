@@ -0,0 +1,21 @@
+#ifndef BENCH_DATA_H
+#define BENCH_DATA_H
+
+//one transmission of the sbms, copied from data/testdata
+static const char BENCH_SAMPLE[] =
+    "var PV1=\"#####################################################&&'''()**++,,--..//00012469=AEJOTY_dinsx}J#################################################################################################################################################\";\n"
+    "var PV2=\"################################################################################################################################################################################################################################################\";\n"
+    "var Btp=\"#####################################################''((()*++,--.../0001122357:>BFKPUZ_dinsx}J#################################################################################################################################################\";\n"
+    "var Btn=\"/0000/0000///0000/0000+%################################################################################################><>>>>@>>>===\?=>>\?\?\?\?\?>\?>>>>>A@BB>>==\?\?\?>=\?<\?=>==>>==\?>>>>=@C===7IO7=C=CC7C==CC=77=CC=7I77===C=17==CC========7=77777C17=\";\n"
+    "var Ld =\"########################################################################################################################%$%%$%&$%%%%%%$$%%&&%&%%%$$%%'&''$%$%%%%%$%$%$%$%%%$$%%%%%$&)####/5##)#))#)##))####))##/#####)#####))###############)###\";\n"
+    "var ELd=\"{||||||||||||||||{||||]3########################################################################################################################################################################################################################\";\n"
+    "var sbms=\"7)%/'0$+GnGmGwGsGtGvH#H1*o##-##7########################%N(\";\n"
+    "var xsbms=\"###L6>N$##n\";\n"
+    "var gsbms=\"#p9#######pZ##B##O#.$##'##5#########\";\n"
+    "var eA=\"###%$H###&#p###############&#p####\?2###$v]\";\n"
+    "var eW=\"####S^####mD################mD####*Y####Q\?\";\n"
+    "var s1=['Ah','A','SBMS0  '];\n"
+    "var s2=[0,0,0,0,0,0,0,0,8,2,1,1];\n"
+    "var dmppt=\"############################################################\";\n";
+
+#endif
@@ -0,0 +1,144 @@
+#include "benchSuite.hpp"
+
+#include <ArduinoJson.h>
+#include <algorithm>
+
+#include "benchData.hpp"
+#include "jsvarStore.hpp"
+#include "sbmsData.hpp"
+#include "sbmsJson.hpp"
+#include "mqttStream.hpp"
+
+//accepts a publish and throws the payload away, to measure the writer alone
+struct NullMqttClient {
+    bool beginPublish(const char *topic, unsigned int plength, bool retained) { return true; }
+    size_t write(const uint8_t *buf, size_t size) { bytes += size; return size; }
+    int endPublish() { return 1; }
+    size_t bytes = 0;
+};
+
+//the result of every operation is accumulated here, so the compiler can not drop the work
+static volatile uint32_t sink;
+
+void BenchSuite::run(Result results[NUM_BENCHES], uint8_t rounds)
+{
+    if(rounds == 0) rounds = 1;
+    if(rounds > MAX_ROUNDS) rounds = MAX_ROUNDS;
+
+    float perOp[MAX_ROUNDS];
+
+    JsvarStore *store = new JsvarStore(); //too large for the stack of a task
+    const size_t sampleLen = sizeof(BENCH_SAMPLE) - 1;
+
+    //parse the sample once, so the store holds all variables for the benchmarks below
+    for(size_t i=0; i<sampleLen; i++) store->handleChar(BENCH_SAMPLE[i]);
+
+    char sbmsString[JsvarStore::MAX_CONTENT_LEN + 1];
+    store->getVar("sbms", sbmsString, sizeof(sbmsString));
+    SbmsData sbms(sbmsString);
+
+    char jsonBuffer[1000];
+
+    Result &handleChar = results[BENCH_HANDLE_CHAR];
+    handleChar = {"handleChar", "byte", (uint32_t)sampleLen, 0, 0};
+    for(uint8_t r=0; r<rounds; r++)
+    {
+        uint32_t start = ESP.getCycleCount();
+        for(size_t i=0; i<sampleLen; i++) sink += store->handleChar(BENCH_SAMPLE[i]);
+        perOp[r] = (float)(ESP.getCycleCount() - start) / handleChar.ops;
+    }
+    summarize(handleChar, perOp, rounds);
+
+    Result &dumpVars = results[BENCH_DUMP_VARS];
+    dumpVars = {"dumpVars", "call", 10, 0, 0};
+    for(uint8_t r=0; r<rounds; r++)
+    {
+        uint32_t start = ESP.getCycleCount();
+        for(uint32_t i=0; i<dumpVars.ops; i++) sink += store->dumpVars().length();
+        perOp[r] = (float)(ESP.getCycleCount() - start) / dumpVars.ops;
+    }
+    summarize(dumpVars, perOp, rounds);
+
+    Result &decode = results[BENCH_DECODE];
+    decode = {"sbmsDecode", "frame", 100, 0, 0};
+    for(uint8_t r=0; r<rounds; r++)
+    {
+        uint32_t start = ESP.getCycleCount();
+        for(uint32_t i=0; i<decode.ops; i++)
+        {
+            SbmsData decoded(sbmsString);
+            sink += decoded.cellVoltageMV[0];
+        }
+        perOp[r] = (float)(ESP.getCycleCount() - start) / decode.ops;
+    }
+    summarize(decode, perOp, rounds);
+
+    Result &toJson = results[BENCH_TO_JSON];
+    toJson = {"toJsonSBMS+serializeJson", "frame", 20, 0, 0};
+    for(uint8_t r=0; r<rounds; r++)
+    {
+        uint32_t start = ESP.getCycleCount();
+        for(uint32_t i=0; i<toJson.ops; i++) sink += serializeJson(*toJsonSBMS(sbms, false), jsonBuffer, sizeof(jsonBuffer));
+        perOp[r] = (float)(ESP.getCycleCount() - start) / toJson.ops;
+    }
+    summarize(toJson, perOp, rounds);
+
+    JsonDocument *doc = toJsonSBMS(sbms, false);
+
+    Result &measure = results[BENCH_MEASURE_JSON];
+    measure = {"measureJson", "frame", 20, 0, 0};
+    for(uint8_t r=0; r<rounds; r++)
+    {
+        uint32_t start = ESP.getCycleCount();
+        for(uint32_t i=0; i<measure.ops; i++) sink += measureJson(*doc);
+        perOp[r] = (float)(ESP.getCycleCount() - start) / measure.ops;
+    }
+    summarize(measure, perOp, rounds);
+
+    Result &writer = results[BENCH_MQTT_WRITER];
+    writer = {"MqttJsonWriter", "frame", 20, 0, 0};
+    NullMqttClient client;
+    for(uint8_t r=0; r<rounds; r++)
+    {
+        uint32_t start = ESP.getCycleCount();
+        for(uint32_t i=0; i<writer.ops; i++)
+        {
+            MqttJsonWriter<NullMqttClient> w(client);
+            serializeJson(*doc, w);
+            w.flush();
+        }
+        perOp[r] = (float)(ESP.getCycleCount() - start) / writer.ops;
+    }
+    sink += client.bytes;
+    summarize(writer, perOp, rounds);
+
+    delete store;
+}
+
+String BenchSuite::report(const Result results[NUM_BENCHES], const char *platform)
+{
+    String res;
+    res.reserve(120 * (NUM_BENCHES + 1));
+
+    char line[160];
+    snprintf(line, sizeof(line), "{\"platform\":\"%s\",\"cpuMHz\":%u,\"results\":[", platform, ESP.getCpuFreqMHz());
+    res += line;
+
+    for(uint8_t i=0; i<NUM_BENCHES; i++)
+    {
+        const Result &r = results[i];
+        snprintf(line, sizeof(line), "%s{\"name\":\"%s\",\"unit\":\"%s\",\"ops\":%u,\"cyclesMin\":%.2f,\"cyclesMedian\":%.2f}",
+            i ? "," : "", r.name, r.unit, r.ops, r.cyclesMin, r.cyclesMedian);
+        res += line;
+    }
+
+    res += "]}";
+    return res;
+}
+
+void BenchSuite::summarize(Result &result, float *perOp, uint8_t rounds)
+{
+    std::sort(perOp, perOp + rounds);
+    result.cyclesMin = perOp[0];
+    result.cyclesMedian = perOp[rounds / 2];
+}
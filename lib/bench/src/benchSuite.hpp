@@ -0,0 +1,43 @@
+#ifndef BENCHSUITE_H
+#define BENCHSUITE_H
+
+#include <Arduino.h>
+
+//Microbenchmarks of the data pipeline, in cycles of the cycle counter. The same code runs on the esp32 (/bench) and in the
+//host build (env:native, -b), where the cycle counter is emulated at 240MHz from the monotonic clock.
+//Each benchmark runs a number of rounds, the result is the minimum and median cost per operation over the rounds.
+class BenchSuite {
+
+public:
+    struct Result {
+        const char *name;
+        const char *unit; //what one operation is
+        uint32_t ops; //operations per round
+        float cyclesMin; //per operation
+        float cyclesMedian;
+    };
+
+    enum Bench : uint8_t {
+        BENCH_HANDLE_CHAR = 0,
+        BENCH_DUMP_VARS,
+        BENCH_DECODE,
+        BENCH_TO_JSON,
+        BENCH_MEASURE_JSON,
+        BENCH_MQTT_WRITER,
+        NUM_BENCHES
+    };
+
+    static const uint8_t MAX_ROUNDS = 31;
+
+    //runs all benchmarks. Takes a few hundred milliseconds on the esp32 with the default rounds.
+    static void run(Result results[NUM_BENCHES], uint8_t rounds = 9);
+
+    //JSON report of the results, platform names where they were measured
+    static String report(const Result results[NUM_BENCHES], const char *platform);
+
+private:
+    //cost per operation of each round, sorted into min and median
+    static void summarize(Result &result, float *perOp, uint8_t rounds);
+};
+
+#endif
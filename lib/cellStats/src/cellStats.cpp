@@ -0,0 +1,134 @@
+#include "cellStats.hpp"
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+//moves an average a fraction of 1/2^shift towards the sample. Arithmetic shift, negative differences round down.
+static inline int32_t ewma(int32_t avg, int32_t sample, uint8_t shift)
+{
+    return avg + ((sample - avg) >> shift);
+}
+
+//same for unsigned averages using the full 32 bit range, the difference is taken in 64 bit
+static inline uint32_t ewma(uint32_t avg, uint32_t sample, uint8_t shift)
+{
+    return avg + (int32_t)(((int64_t)sample - avg) >> shift);
+}
+
+CellStats::CellStats()
+    : mLowMV(2900)
+    , mHighMV(3550)
+{
+    reset();
+}
+
+void CellStats::setThresholds(uint16_t lowMV, uint16_t highMV)
+{
+    mLowMV = lowMV;
+    mHighMV = highMV;
+}
+
+void CellStats::reset()
+{
+    mFrames = 0;
+    mLastTimeMs = 0;
+    mLastCurrentMA = 0;
+    mSteps = 0;
+    mDeltaMV = 0;
+    mDeltaFastQ8 = 0;
+    mDeltaSlowQ8 = 0;
+
+    memset(mLastMV, 0, sizeof(mLastMV));
+    memset(mMeanQ8, 0, sizeof(mMeanQ8));
+    memset(mVarianceQ8, 0, sizeof(mVarianceQ8));
+    memset(mAboveMs, 0, sizeof(mAboveMs));
+    memset(mBelowMs, 0, sizeof(mBelowMs));
+    memset(mResistanceUOhm, 0, sizeof(mResistanceUOhm));
+}
+
+void CellStats::update(const SbmsData &sbms, uint32_t timeMs)
+{
+    bool first = mFrames == 0;
+    uint32_t dt = timeMs - mLastTimeMs;
+    bool consecutive = !first && dt <= MAX_FRAME_GAP_MS;
+
+    int32_t stepMA = sbms.batteryCurrentMA - mLastCurrentMA;
+    bool step = consecutive && (stepMA >= STEP_MA || stepMA <= -STEP_MA);
+    if(step) mSteps++;
+
+    for(uint8_t i=0; i<NUM_CELLS; i++)
+    {
+        uint16_t mv = sbms.cellVoltageMV[i];
+        if(mv == 0) continue; //cell not in use
+
+        int32_t sample = (int32_t)mv << 8;
+
+        if(first || mMeanQ8[i] == 0)
+        {
+            mMeanQ8[i] = sample;
+        }
+        else
+        {
+            int32_t diff = sample - mMeanQ8[i];
+            mMeanQ8[i] = ewma(mMeanQ8[i], sample, MEAN_SHIFT);
+
+            //variance relative to the mean before this sample. A jump of several volts (a corrupt frame) saturates instead of wrapping.
+            int64_t sq = ((int64_t)diff * diff) >> 8;
+            mVarianceQ8[i] = ewma(mVarianceQ8[i], sq > UINT32_MAX ? UINT32_MAX : (uint32_t)sq, MEAN_SHIFT);
+        }
+
+        if(consecutive)
+        {
+            if(mv > mHighMV) mAboveMs[i] += dt;
+            if(mv < mLowMV) mBelowMs[i] += dt;
+        }
+
+        if(step && mLastMV[i] > 0)
+        {
+            //the cell voltage rises with the charge current by the internal resistance
+            int32_t r = (int32_t)(((int64_t)mv - mLastMV[i]) * 1000000 / stepMA);
+            if(r > 0 && r < MAX_RESISTANCE_UOHM)
+            {
+                mResistanceUOhm[i] = mResistanceUOhm[i] ? ewma(mResistanceUOhm[i], r, RESISTANCE_SHIFT) : r;
+            }
+        }
+
+        mLastMV[i] = mv;
+    }
+
+    uint16_t minMV, maxMV;
+    sbms.cellRange(minMV, maxMV);
+    mDeltaMV = maxMV - minMV;
+
+    int32_t delta = (int32_t)mDeltaMV << 8;
+    mDeltaFastQ8 = first ? delta : ewma(mDeltaFastQ8, delta, DELTA_FAST_SHIFT);
+    mDeltaSlowQ8 = first ? delta : ewma(mDeltaSlowQ8, delta, DELTA_SLOW_SHIFT);
+
+    mLastCurrentMA = sbms.batteryCurrentMA;
+    mLastTimeMs = timeMs;
+    mFrames++;
+}
+
+float CellStats::stdDevMV(uint8_t cell) const
+{
+    return sqrtf(mVarianceQ8[cell] / 256.0f);
+}
+
+size_t CellStats::toJson(char *buf, size_t bufLen) const
+{
+    if(bufLen == 0) return 0;
+
+    size_t len = snprintf(buf, bufLen, "{\"frames\":%u,\"deltaMV\":%u,\"deltaAvgMV\":%.1f,\"balanceTrendMV\":%.2f,\"irSteps\":%u,\"cells\":[",
+        mFrames, mDeltaMV, mDeltaSlowQ8 / 256.0f, balanceTrendMV(), mSteps);
+
+    for(uint8_t i=0; i<NUM_CELLS && len < bufLen; i++)
+    {
+        len += snprintf(buf + len, bufLen - len, "%s{\"mV\":%u,\"avgMV\":%.1f,\"sdMV\":%.2f,\"aboveS\":%u,\"belowS\":%u,\"irMOhm\":%.2f}",
+            i ? "," : "", mLastMV[i], meanMV(i), stdDevMV(i), mAboveMs[i] / 1000, mBelowMs[i] / 1000, mResistanceUOhm[i] / 1000.0f);
+    }
+
+    if(len < bufLen) len += snprintf(buf + len, bufLen - len, "]}");
+
+    return len;
+}
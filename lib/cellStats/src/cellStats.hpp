@@ -0,0 +1,87 @@
+#ifndef CELLSTATS_H
+#define CELLSTATS_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "sbmsData.hpp"
+
+//Incremental per cell statistics of one battery, updated with every decoded sbms frame. Fixed point and constant memory.
+//  - exponentially weighted mean and variance of each cell voltage
+//  - time spent above and below voltage thresholds
+//  - internal resistance from the voltage change across steps of the battery current
+//  - balancing trend: short minus long term average of the difference between the highest and the lowest cell
+//Not thread safe, the owner serializes updates and reads.
+class CellStats {
+
+public:
+    static const uint8_t NUM_CELLS = 8;
+
+    CellStats();
+
+    //voltage thresholds for the time above/below. Defaults are 3550 and 2900 mV.
+    void setThresholds(uint16_t lowMV, uint16_t highMV);
+
+    //adds a frame received at the given time
+    void update(const SbmsData &sbms, uint32_t timeMs);
+
+    void reset();
+
+    //writes the statistics as JSON object into buf (always zero terminated). Returns the length, like snprintf.
+    size_t toJson(char *buf, size_t bufLen) const;
+
+    uint32_t frames() const { return mFrames; }
+
+    //averages in mV
+    float meanMV(uint8_t cell) const { return mMeanQ8[cell] / 256.0f; }
+    float stdDevMV(uint8_t cell) const;
+
+    //internal resistance in micro ohms, 0 if no current step was seen yet
+    int32_t resistanceUOhm(uint8_t cell) const { return mResistanceUOhm[cell]; }
+
+    //positive if the cells drift apart, negative while they are being balanced. In mV.
+    float balanceTrendMV() const { return (mDeltaFastQ8 - mDeltaSlowQ8) / 256.0f; }
+
+    //smoothing of the averages as a power of two, the time constant is 2^shift frames
+    static const uint8_t MEAN_SHIFT = 5;
+    static const uint8_t RESISTANCE_SHIFT = 3;
+    static const uint8_t DELTA_FAST_SHIFT = 3;
+    static const uint8_t DELTA_SLOW_SHIFT = 7;
+
+    //minimal change of the battery current between two frames to estimate the resistance
+    static const int32_t STEP_MA = 2000;
+
+    //frames further apart are not used for time accounting or resistance estimates
+    static const uint32_t MAX_FRAME_GAP_MS = 5000;
+
+    //estimates outside of this range are considered noise
+    static const int32_t MAX_RESISTANCE_UOHM = 500000;
+
+private:
+    uint32_t mFrames;
+    uint32_t mLastTimeMs;
+
+    uint16_t mLowMV;
+    uint16_t mHighMV;
+
+    //last frame, for the steps
+    uint16_t mLastMV[NUM_CELLS];
+    int32_t mLastCurrentMA;
+
+    //voltage in mV * 256, variance in mV^2 * 256
+    int32_t mMeanQ8[NUM_CELLS];
+    uint32_t mVarianceQ8[NUM_CELLS];
+
+    uint32_t mAboveMs[NUM_CELLS];
+    uint32_t mBelowMs[NUM_CELLS];
+
+    int32_t mResistanceUOhm[NUM_CELLS];
+    uint32_t mSteps;
+
+    //difference between the highest and lowest cell, mV * 256
+    uint16_t mDeltaMV;
+    int32_t mDeltaFastQ8;
+    int32_t mDeltaSlowQ8;
+};
+
+#endif
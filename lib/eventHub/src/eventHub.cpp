@@ -0,0 +1,489 @@
+#include "eventHub.hpp"
+
+//the headers of the event stream, hands the connection to the hub once they are acknowledged
+class EventHubResponse : public AsyncWebServerResponse {
+
+public:
+    EventHubResponse(EventHub *hub)
+        : mHub(hub)
+    {
+        _code = 200;
+        _contentType = "text/event-stream";
+        _sendContentLength = false;
+        addHeader("Cache-Control", "no-cache");
+        addHeader("Connection", "keep-alive");
+    }
+
+    void _respond(AsyncWebServerRequest *request) override
+    {
+        String out = _assembleHead(request->version());
+        request->client()->write(out.c_str(), _headLength);
+        _state = RESPONSE_WAIT_ACK;
+    }
+
+    size_t _ack(AsyncWebServerRequest *request, size_t len, uint32_t time) override
+    {
+        if(len) mHub->addClient(request); //deletes the request and this response
+        return 0;
+    }
+
+    bool _sourceValid() const override { return true; }
+
+private:
+    EventHub *mHub;
+};
+
+
+EventHub::EventHub(const char *url)
+    : mUrl(url)
+    , mConnectHandler(nullptr)
+    , mClients()
+    , mCount(0)
+    , mSeq(0)
+    , mReplayBuf(nullptr)
+    , mReplaySize(0)
+    , mReplayHead(0)
+    , mReplayCount(0)
+    , mReplayWrite(0)
+    , mReplayLastId(0)
+    , mLingering(false)
+    , mLastClientMs(0)
+{
+    mMutex = xSemaphoreCreateRecursiveMutex();
+}
+
+EventHub::~EventHub()
+{
+    for(uint8_t i=0; i<MAX_CLIENTS; i++)
+    {
+        if(mClients[i]) mClients[i]->tcp->close(true); //removes the client
+    }
+    vSemaphoreDelete(mMutex);
+}
+
+bool EventHub::canHandle(AsyncWebServerRequest *request)
+{
+    if(request->method() != HTTP_GET || request->url() != mUrl) return false;
+    request->addInterestingHeader("Last-Event-ID"); //sent by a reconnecting browser
+    return true;
+}
+
+void EventHub::setReplayBuffer(char *buf, size_t size)
+{
+    xSemaphoreTakeRecursive(mMutex, portMAX_DELAY);
+    mReplayBuf = buf;
+    mReplaySize = buf ? size : 0;
+    mReplayHead = 0;
+    mReplayCount = 0;
+    mReplayWrite = 0;
+    xSemaphoreGiveRecursive(mMutex);
+}
+
+bool EventHub::listening() const
+{
+    return mCount > 0 || (mReplayBuf && mLingering && millis() - mLastClientMs < REPLAY_LINGER_MS);
+}
+
+void EventHub::handleRequest(AsyncWebServerRequest *request)
+{
+    if(mCount >= MAX_CLIENTS)
+    {
+        request->send(503, "text/plain", "too many clients");
+        return;
+    }
+    request->send(new EventHubResponse(this));
+}
+
+void EventHub::addClient(AsyncWebServerRequest *request)
+{
+    AsyncClient *tcp = request->client();
+
+    xSemaphoreTakeRecursive(mMutex, portMAX_DELAY);
+
+    uint8_t index = 0;
+    while(index < MAX_CLIENTS && mClients[index]) index++;
+
+    if(index == MAX_CLIENTS) //filled up while the headers were sent
+    {
+        xSemaphoreGiveRecursive(mMutex);
+        delete request;
+        tcp->close(true);
+        return;
+    }
+
+    Client *client = new Client();
+    client->hub = this;
+    client->tcp = tcp;
+    client->index = index;
+    client->group = 0;
+    client->connectedMs = millis();
+    client->progressMs = client->connectedMs;
+    client->outPos = 0;
+    client->inFlight = 0;
+    client->sent = 0;
+    client->coalesced = 0;
+    client->dropped = 0;
+    client->replaying = false;
+    client->replayId = 0;
+    client->replayed = 0;
+    for(uint8_t i=0; i<MAX_SLOTS; i++)
+    {
+        client->slots[i].key[0] = 0;
+        client->slots[i].pending = false;
+        client->slots[i].urgent = false;
+    }
+
+    tcp->setRxTimeout(0);
+    tcp->onError(NULL, NULL);
+    tcp->onData(NULL, NULL); //nothing to receive on an event stream
+    tcp->onAck(onAck, client);
+    tcp->onPoll(onPoll, client);
+    tcp->onTimeout(onTimeout, client);
+    tcp->onDisconnect(onDisconnect, client);
+
+    mClients[index] = client;
+    mCount++;
+
+    if(mConnectHandler) mConnectHandler(index, request);
+
+    //after the handler, which may have set the group
+    if(mReplayBuf && request->hasHeader("Last-Event-ID"))
+    {
+        client->replaying = true;
+        client->replayId = strtoul(request->header("Last-Event-ID").c_str(), nullptr, 10);
+        flush(*client);
+    }
+
+    xSemaphoreGiveRecursive(mMutex);
+
+    delete request;
+}
+
+void EventHub::send(const char *data, const char *event, uint32_t id, const char *key, int16_t group, bool urgent)
+{
+    if(!listening()) return;
+
+    xSemaphoreTakeRecursive(mMutex, portMAX_DELAY);
+
+    bool recording = mReplayBuf && id != 0;
+    if(recording)
+    {
+        //several events within a millisecond get distinct ids, a reconnecting client would lose the ones sharing its last id
+        if((int32_t)(id - mReplayLastId) <= 0) id = mReplayLastId + 1;
+        mReplayLastId = id;
+    }
+
+    formatEvent(mMessage, data, event, id, 0);
+    bool recorded = recording && record(id, group, mMessage);
+
+    for(uint8_t i=0; i<MAX_CLIENTS; i++)
+    {
+        if(!mClients[i] || (group != ALL_GROUPS && mClients[i]->group != group)) continue;
+        if(!(recorded && mClients[i]->replaying)) enqueue(*mClients[i], key ? key : (event ? event : ""), mMessage, urgent); //else the replay gets to it
+        flush(*mClients[i]);
+    }
+
+    xSemaphoreGiveRecursive(mMutex);
+}
+
+void EventHub::sendTo(uint8_t client, const char *data, const char *event, uint32_t id, uint32_t reconnect, const char *key)
+{
+    if(client >= MAX_CLIENTS) return;
+
+    xSemaphoreTakeRecursive(mMutex, portMAX_DELAY);
+
+    if(mClients[client])
+    {
+        formatEvent(mMessage, data, event, id, reconnect);
+        enqueue(*mClients[client], key ? key : (event ? event : ""), mMessage);
+        flush(*mClients[client]);
+    }
+
+    xSemaphoreGiveRecursive(mMutex);
+}
+
+void EventHub::setGroup(uint8_t client, uint8_t group)
+{
+    if(client >= MAX_CLIENTS) return;
+
+    xSemaphoreTakeRecursive(mMutex, portMAX_DELAY);
+    if(mClients[client]) mClients[client]->group = group;
+    xSemaphoreGiveRecursive(mMutex);
+}
+
+void EventHub::formatEvent(String &out, const char *data, const char *event, uint32_t id, uint32_t reconnect)
+{
+    char head[24];
+    out = "";
+
+    if(reconnect)
+    {
+        snprintf(head, sizeof(head), "retry: %u\r\n", reconnect);
+        out += head;
+    }
+    if(id)
+    {
+        snprintf(head, sizeof(head), "id: %u\r\n", id);
+        out += head;
+    }
+    if(event && event[0])
+    {
+        out += "event: ";
+        out += event;
+        out += "\r\n";
+    }
+
+    //every line of the data gets its own field
+    out += "data: ";
+    if(!strchr(data, '\n'))
+    {
+        out += data;
+    }
+    else
+    {
+        out.reserve(out.length() + strlen(data) + 64);
+        for(const char *c = data; *c; c++)
+        {
+            if(*c == '\n') out += "\r\ndata: ";
+            else if(*c != '\r') out += *c;
+        }
+    }
+    out += "\r\n\r\n"; //end of the event
+}
+
+void EventHub::enqueue(Client &client, const char *key, const String &message, bool urgent)
+{
+    Slot *slot = nullptr;
+    Slot *free = nullptr;
+    for(uint8_t i=0; i<MAX_SLOTS && !slot; i++)
+    {
+        Slot &s = client.slots[i];
+        if(!s.pending) //a pending keyless message (e.g. sendTo without event) is never replaced
+        {
+            if(!free || free->key[0] != 0) free = &s; //prefer never used slots, they hold no buffer yet
+        }
+        if(s.key[0] != 0 && strncmp(s.key, key, MAX_KEY_LEN) == 0) slot = &s;
+    }
+
+    if(slot && slot->pending)
+    {
+        client.coalesced++;
+    }
+    else if(!slot)
+    {
+        if(!free)
+        {
+            client.dropped++;
+            return;
+        }
+        slot = free;
+        strlcpy(slot->key, key, sizeof(slot->key));
+    }
+
+    if(!slot->pending) slot->queuedMs = millis();
+    slot->pending = true;
+    slot->urgent = urgent;
+    slot->seq = mSeq++;
+    slot->message = message; //reuses the buffer of the previous value
+}
+
+bool EventHub::record(uint32_t id, int16_t group, const String &message)
+{
+    size_t length = message.length() + 1;
+    if(length > mReplaySize || length > UINT16_MAX) return false;
+
+    //messages are not split, one that doesn't fit behind the last starts over at the beginning
+    uint32_t start = mReplayWrite + length <= mReplaySize ? mReplayWrite : 0;
+    while(mReplayCount > 0 && (mReplayCount == REPLAY_MAX_EVENTS || replayOverlaps(start, start + length)))
+    {
+        mReplayHead = (mReplayHead + 1) % REPLAY_MAX_EVENTS;
+        mReplayCount--;
+    }
+
+    memcpy(mReplayBuf + start, message.c_str(), length);
+
+    ReplayEvent &e = mReplay[(mReplayHead + mReplayCount) % REPLAY_MAX_EVENTS];
+    e.id = id;
+    e.offset = start;
+    e.length = length;
+    e.group = group;
+    mReplayCount++;
+    mReplayWrite = start + length;
+    return true;
+}
+
+bool EventHub::replayOverlaps(uint32_t start, uint32_t end) const
+{
+    for(uint8_t i=0; i<mReplayCount; i++)
+    {
+        const ReplayEvent &e = mReplay[(mReplayHead + i) % REPLAY_MAX_EVENTS];
+        if(start < e.offset + e.length && e.offset < end) return true;
+    }
+    return false;
+}
+
+const EventHub::ReplayEvent *EventHub::replayAfter(uint32_t id, uint8_t group) const
+{
+    for(uint8_t i=0; i<mReplayCount; i++)
+    {
+        const ReplayEvent &e = mReplay[(mReplayHead + i) % REPLAY_MAX_EVENTS];
+        if((int32_t)(e.id - id) > 0 && (e.group == ALL_GROUPS || e.group == group)) return &e;
+    }
+    return nullptr;
+}
+
+bool EventHub::idle(const Client &client) const
+{
+    if(client.outPos < client.out.length() || client.inFlight > 0 || client.replaying) return false;
+    for(uint8_t i=0; i<MAX_SLOTS; i++)
+    {
+        if(client.slots[i].pending) return false;
+    }
+    return true;
+}
+
+void EventHub::flush(Client &client)
+{
+    AsyncClient *tcp = client.tcp;
+    bool wrote = false;
+
+    if(idle(client)) client.progressMs = millis(); //a stall starts with data waiting
+
+    for(;;)
+    {
+        if(client.outPos >= client.out.length())
+        {
+            //next message: the next kept event while replaying, then the oldest pending one, urgent ones first
+            const ReplayEvent *replay = client.replaying ? replayAfter(client.replayId, client.group) : nullptr;
+            if(replay)
+            {
+                client.out = mReplayBuf + replay->offset;
+                client.outPos = 0;
+                client.replayId = replay->id;
+                client.replayed++;
+            }
+            else
+            {
+                client.replaying = false;
+
+                Slot *next = nullptr;
+                for(uint8_t i=0; i<MAX_SLOTS; i++)
+                {
+                    Slot &s = client.slots[i];
+                    if(!s.pending) continue;
+                    if(!next || (s.urgent && !next->urgent) || (s.urgent == next->urgent && (int32_t)(s.seq - next->seq) < 0)) next = &s;
+                }
+                if(!next) break;
+
+                client.out = next->message;
+                client.outPos = 0;
+                next->pending = false;
+            }
+        }
+
+        size_t space = tcp->space();
+        if(space == 0) break;
+
+        size_t len = client.out.length() - client.outPos;
+        if(len > space) len = space;
+
+        size_t added = tcp->add(client.out.c_str() + client.outPos, len);
+        if(added == 0) break;
+
+        client.outPos += added;
+        client.inFlight += added;
+        wrote = true;
+
+        if(client.outPos >= client.out.length()) client.sent++;
+    }
+
+    if(wrote) tcp->send();
+}
+
+size_t EventHub::statsJson(char *buf, size_t bufLen)
+{
+    if(bufLen == 0) return 0;
+
+    size_t len = snprintf(buf, bufLen, "[");
+    uint32_t now = millis();
+
+    xSemaphoreTakeRecursive(mMutex, portMAX_DELAY);
+
+    bool first = true;
+    for(uint8_t i=0; i<MAX_CLIENTS && len < bufLen; i++)
+    {
+        const Client *client = mClients[i];
+        if(!client) continue;
+
+        uint8_t pending = 0;
+        uint32_t oldest = now;
+        for(uint8_t s=0; s<MAX_SLOTS; s++)
+        {
+            const Slot &slot = client->slots[s];
+            if(!slot.pending) continue;
+            pending++;
+            if((int32_t)(slot.queuedMs - oldest) < 0) oldest = slot.queuedMs;
+        }
+
+        len += snprintf(buf + len, bufLen - len, "%s{\"client\":%u,\"group\":%u,\"ip\":\"%s\",\"connectedS\":%u,\"sent\":%u,\"coalesced\":%u,\"dropped\":%u,"
+                                                 "\"replayed\":%u,\"pending\":%u,\"inFlight\":%u,\"lagMs\":%u,\"stallMs\":%u}",
+            first ? "" : ",", i, client->group, client->tcp->remoteIP().toString().c_str(), (now - client->connectedMs) / 1000,
+            client->sent, client->coalesced, client->dropped, client->replayed, pending, client->inFlight, now - oldest,
+            idle(*client) ? 0 : now - client->progressMs);
+        first = false;
+    }
+
+    xSemaphoreGiveRecursive(mMutex);
+
+    if(len < bufLen) len += snprintf(buf + len, bufLen - len, "]");
+    return len;
+}
+
+void EventHub::onAck(void *arg, AsyncClient *tcp, size_t len, uint32_t time)
+{
+    Client *client = (Client*)arg;
+    EventHub *hub = client->hub;
+
+    xSemaphoreTakeRecursive(hub->mMutex, portMAX_DELAY);
+    client->inFlight = len < client->inFlight ? client->inFlight - len : 0;
+    client->progressMs = millis();
+    hub->flush(*client);
+    xSemaphoreGiveRecursive(hub->mMutex);
+}
+
+void EventHub::onPoll(void *arg, AsyncClient *tcp)
+{
+    Client *client = (Client*)arg;
+    EventHub *hub = client->hub;
+
+    xSemaphoreTakeRecursive(hub->mMutex, portMAX_DELAY);
+    bool stalled = !hub->idle(*client) && millis() - client->progressMs > STALL_TIMEOUT_MS;
+    if(!stalled) hub->flush(*client);
+    xSemaphoreGiveRecursive(hub->mMutex);
+
+    if(stalled) tcp->close(true); //on the AsyncTCP task, like every other close of the connection
+}
+
+void EventHub::onTimeout(void *arg, AsyncClient *tcp, uint32_t time)
+{
+    tcp->close(true);
+}
+
+void EventHub::onDisconnect(void *arg, AsyncClient *tcp)
+{
+    Client *client = (Client*)arg;
+    EventHub *hub = client->hub;
+
+    xSemaphoreTakeRecursive(hub->mMutex, portMAX_DELAY);
+    hub->mClients[client->index] = nullptr;
+    hub->mCount--;
+    if(hub->mCount == 0)
+    {
+        hub->mLingering = true;
+        hub->mLastClientMs = millis();
+    }
+    xSemaphoreGiveRecursive(hub->mMutex);
+
+    delete client;
+    delete tcp;
+}
@@ -0,0 +1,171 @@
+#ifndef EVENTHUB_H
+#define EVENTHUB_H
+
+#include <Arduino.h>
+#include <functional>
+
+#include <AsyncTCP.h>
+#include <ESPAsyncWebServer.h>
+
+//Server sent events with latest-value-wins backpressure, in place of AsyncEventSource.
+//Every client holds at most one pending message per key (the event name unless given). A client that can't keep up
+//gets the newest value of each key once its connection drains, instead of a growing queue of outdated frames.
+//Messages without a key (no event name and no key given) are never replaced, each takes a slot of its own.
+//Clients that don't make progress for STALL_TIMEOUT_MS while data is waiting are disconnected.
+//With a replay buffer, the most recent events are kept, and a browser that reconnects with Last-Event-ID gets the ones it
+//missed before any new event.
+//send() may be called from any task, the connections are served from the AsyncTCP task.
+class EventHub : public AsyncWebHandler {
+
+public:
+    static const uint8_t MAX_CLIENTS = 8;
+
+    //distinct keys pending per client, further keys are dropped until a slot was sent
+    static const uint8_t MAX_SLOTS = 24;
+
+    static const uint8_t MAX_KEY_LEN = 31;
+
+    static const uint32_t STALL_TIMEOUT_MS = 15000;
+
+    //events kept for replay at most, the buffer limits them as well
+    static const uint8_t REPLAY_MAX_EVENTS = 64;
+
+    //after the last client left, events are still recorded this long, so it gets what it missed when it comes back
+    static const uint32_t REPLAY_LINGER_MS = 300000;
+
+    //send to the clients of every group
+    static const int16_t ALL_GROUPS = -1;
+
+    //called for a new client before any event is sent to it, from the AsyncTCP task. The request is valid only during the call.
+    typedef std::function<void(uint8_t client, AsyncWebServerRequest *request)> ConnectHandler;
+
+    EventHub(const char *url);
+    ~EventHub();
+
+    void onConnect(ConnectHandler handler) { mConnectHandler = handler; }
+
+    //keeps the most recent events sent with an id in buf, as a ring. The ids of the kept events are made strictly increasing.
+    //A client that connects with Last-Event-ID gets the kept events after that id first, events older than the ring are lost.
+    void setReplayBuffer(char *buf, size_t size);
+
+    //whether send() has any effect: a client is connected, or the last one left less than REPLAY_LINGER_MS ago
+    bool listening() const;
+
+    //queues an event for every client (of a group), replacing the pending message with the same key. Empty event names are left out.
+    //An urgent event is sent ahead of the other pending messages, except to a client that still gets the replay.
+    void send(const char *data, const char *event = nullptr, uint32_t id = 0, const char *key = nullptr, int16_t group = ALL_GROUPS,
+              bool urgent = false);
+
+    //same for a single client, reconnect sets the retry time of the browser in ms
+    void sendTo(uint8_t client, const char *data, const char *event = nullptr, uint32_t id = 0, uint32_t reconnect = 0, const char *key = nullptr);
+
+    //clients can be grouped, for example by the data they asked for. A new client is in group 0.
+    void setGroup(uint8_t client, uint8_t group);
+
+    //number of connected clients
+    uint8_t count() const { return mCount; }
+
+    //statistics of every client as JSON array. Returns the length, like snprintf.
+    size_t statsJson(char *buf, size_t bufLen);
+
+    //AsyncWebHandler
+    bool canHandle(AsyncWebServerRequest *request) override;
+    void handleRequest(AsyncWebServerRequest *request) override;
+    bool isRequestHandlerTrivial() override { return false; }
+
+    //called by the response once the headers are acknowledged, takes over the connection and deletes the request
+    void addClient(AsyncWebServerRequest *request);
+
+private:
+
+    struct Slot {
+        char key[MAX_KEY_LEN + 1]; //empty if unused
+        bool pending;
+        bool urgent;
+        uint32_t seq; //order of the pending messages, urgent ones first
+        uint32_t queuedMs;
+        String message; //formatted event, the buffer is reused for the next value
+    };
+
+    struct Client {
+        EventHub *hub;
+        AsyncClient *tcp;
+        uint8_t index;
+        uint8_t group;
+
+        uint32_t connectedMs;
+        uint32_t progressMs; //last ack, or when the client went idle
+
+        String out; //message being written
+        size_t outPos;
+        uint32_t inFlight; //bytes written but not acknowledged
+
+        uint32_t sent;
+        uint32_t coalesced; //pending messages replaced by a newer value
+        uint32_t dropped; //messages without a free slot
+
+        bool replaying; //kept events after replayId are sent before the slots
+        uint32_t replayId;
+        uint32_t replayed;
+
+        Slot slots[MAX_SLOTS];
+    };
+
+    //a kept event, the message is in the replay buffer
+    struct ReplayEvent {
+        uint32_t id;
+        uint32_t offset;
+        uint16_t length; //including the terminating zero
+        int16_t group;
+    };
+
+    //keeps the formatted message, dropping the oldest events until it fits. Must be called with the lock held.
+    bool record(uint32_t id, int16_t group, const String &message);
+
+    bool replayOverlaps(uint32_t start, uint32_t end) const;
+
+    //oldest kept event after id for a client of the group, nullptr if none
+    const ReplayEvent *replayAfter(uint32_t id, uint8_t group) const;
+
+    //stores the formatted message in the client. Must be called with the lock held.
+    void enqueue(Client &client, const char *key, const String &message, bool urgent = false);
+
+    //writes pending messages as far as the connection takes them. Must be called with the lock held.
+    void flush(Client &client);
+
+    bool idle(const Client &client) const;
+
+    static void formatEvent(String &out, const char *data, const char *event, uint32_t id, uint32_t reconnect);
+
+    //AsyncClient callbacks, arg is the Client
+    static void onAck(void *arg, AsyncClient *tcp, size_t len, uint32_t time);
+    static void onPoll(void *arg, AsyncClient *tcp);
+    static void onTimeout(void *arg, AsyncClient *tcp, uint32_t time);
+    static void onDisconnect(void *arg, AsyncClient *tcp);
+
+    String mUrl;
+    ConnectHandler mConnectHandler;
+
+    //recursive: closing a connection calls onDisconnect right away
+    SemaphoreHandle_t mMutex;
+
+    Client *mClients[MAX_CLIENTS];
+    uint8_t mCount;
+    uint32_t mSeq;
+
+    //formatted once per send, copied into the slots
+    String mMessage;
+
+    char *mReplayBuf;
+    size_t mReplaySize;
+    ReplayEvent mReplay[REPLAY_MAX_EVENTS];
+    uint8_t mReplayHead; //oldest event
+    uint8_t mReplayCount;
+    uint32_t mReplayWrite; //offset for the next message
+    uint32_t mReplayLastId;
+
+    bool mLingering; //the last client left at mLastClientMs
+    uint32_t mLastClientMs;
+};
+
+#endif
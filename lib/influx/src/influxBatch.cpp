@@ -0,0 +1,124 @@
+
+#include "influxBatch.hpp"
+
+InfluxBatch::InfluxBatch() : mLen(0), mBatchPoints(10), mMaxDelayMs(10000), mOldestMs(0), mRetryMs(0)
+{
+    memset(&mStats, 0, sizeof(mStats));
+    mMutex = xSemaphoreCreateMutex();
+}
+
+InfluxBatch::~InfluxBatch()
+{
+    vSemaphoreDelete(mMutex);
+}
+
+void InfluxBatch::configure(uint16_t batchPoints, uint32_t maxDelayMs)
+{
+    mBatchPoints = batchPoints > 0 ? batchPoints : 1;
+    mMaxDelayMs = maxDelayMs;
+}
+
+bool InfluxBatch::add(const char *line, size_t len, uint32_t nowMs)
+{
+    bool added = false;
+
+    if( xSemaphoreTake( mMutex, (TickType_t) 50 ) )
+    {
+        mStats.points++;
+
+        if(len <= MAX_LINE_LEN && mLen + len <= MAX_BYTES)
+        {
+            memcpy(mBuf + mLen, line, len);
+            mLen += len;
+            if(mStats.pending++ == 0) mOldestMs = nowMs;
+            added = true;
+        }
+        else
+        {
+            mStats.dropped++;
+        }
+
+        xSemaphoreGive(mMutex);
+    }
+
+    return added;
+}
+
+bool InfluxBatch::due(uint32_t nowMs)
+{
+    bool due = false;
+
+    if( xSemaphoreTake( mMutex, (TickType_t) 50 ) )
+    {
+        bool backoff = mStats.backoffMs > 0 && (int32_t)(nowMs - mRetryMs) < 0;
+        due = !backoff && mStats.pending > 0 && (mStats.pending >= mBatchPoints || nowMs - mOldestMs >= mMaxDelayMs || mStats.backoffMs > 0);
+
+        xSemaphoreGive(mMutex);
+    }
+
+    return due;
+}
+
+size_t InfluxBatch::peek(char *out, size_t maxLen, uint16_t &points)
+{
+    size_t len = 0;
+    points = 0;
+
+    if( xSemaphoreTake( mMutex, (TickType_t) 50 ) )
+    {
+        //whole lines only
+        size_t pos = 0;
+        while(pos < mLen && points < mBatchPoints)
+        {
+            const char *end = (const char*)memchr(mBuf + pos, '\n', mLen - pos);
+            size_t next = end ? end - mBuf + 1 : mLen;
+            if(next > maxLen) break;
+            pos = next;
+            points++;
+        }
+
+        memcpy(out, mBuf, pos);
+        len = pos;
+
+        xSemaphoreGive(mMutex);
+    }
+
+    return len;
+}
+
+void InfluxBatch::done(size_t len, uint16_t points, bool ok, uint32_t nowMs)
+{
+    if( xSemaphoreTake( mMutex, portMAX_DELAY ) )
+    {
+        if(ok)
+        {
+            //only the writer removes lines, the ones peeked are still at the start
+            memmove(mBuf, mBuf + len, mLen - len);
+            mLen -= len;
+            mStats.pending -= points;
+            mStats.written += points;
+            mStats.batches++;
+            mStats.backoffMs = 0;
+        }
+        else
+        {
+            mStats.failures++;
+            mStats.backoffMs = mStats.backoffMs ? mStats.backoffMs * 2 : MIN_BACKOFF_MS;
+            if(mStats.backoffMs > MAX_BACKOFF_MS) mStats.backoffMs = MAX_BACKOFF_MS;
+            mRetryMs = nowMs + mStats.backoffMs;
+        }
+
+        xSemaphoreGive(mMutex);
+    }
+}
+
+InfluxBatch::Stats InfluxBatch::getStats()
+{
+    Stats stats;
+
+    xSemaphoreTake( mMutex, portMAX_DELAY );
+    stats = mStats;
+    xSemaphoreGive(mMutex);
+
+    return stats;
+}
@@ -0,0 +1,68 @@
+#ifndef INFLUX_BATCH_H
+#define INFLUX_BATCH_H
+
+#include <Arduino.h>
+
+//Lines of InfluxDB line protocol waiting to be written, independent of the transport.
+//The pipeline adds a line per point, the writer task takes batches of whole lines and reports the result.
+//Failed batches stay in the buffer and are retried with exponential backoff. While the server is unreachable
+//new points are kept until the buffer is full, then they are dropped.
+class InfluxBatch {
+
+public:
+    static const size_t MAX_BYTES = 4096;
+
+    //longer lines are dropped, a batch always holds at least one line
+    static const size_t MAX_LINE_LEN = 512;
+
+    static const uint32_t MIN_BACKOFF_MS = 1000;
+    static const uint32_t MAX_BACKOFF_MS = 60000;
+
+    struct Stats {
+        uint32_t points; //added
+        uint32_t written; //points written successfully
+        uint32_t batches;
+        uint32_t failures;
+        uint32_t dropped;
+        uint32_t backoffMs; //current, 0 after a successful write
+        uint16_t pending;
+    };
+
+    InfluxBatch();
+    ~InfluxBatch();
+
+    //points per write, and the longest time a point waits for its batch to fill
+    void configure(uint16_t batchPoints, uint32_t maxDelayMs);
+
+    //appends one line including its newline. Returns false if the point was dropped.
+    bool add(const char *line, size_t len, uint32_t nowMs);
+
+    //true if a batch should be written now: enough points are pending or the oldest waited long enough, and no backoff is running
+    bool due(uint32_t nowMs);
+
+    //copies the oldest whole lines into out, at most maxLen (>= MAX_LINE_LEN) bytes and one batch of points.
+    //Returns the length, 0 if nothing is pending.
+    size_t peek(char *out, size_t maxLen, uint16_t &points);
+
+    //result of writing what peek returned: removes the lines, or keeps them and backs off
+    void done(size_t len, uint16_t points, bool ok, uint32_t nowMs);
+
+    Stats getStats();
+
+private:
+
+    char mBuf[MAX_BYTES];
+    size_t mLen;
+
+    uint16_t mBatchPoints;
+    uint32_t mMaxDelayMs;
+
+    uint32_t mOldestMs; //when the oldest pending point was added
+    uint32_t mRetryMs; //next attempt while backing off
+
+    Stats mStats;
+
+    SemaphoreHandle_t mMutex; //lines are added by the publish task and taken by the writer task
+};
+
+#endif
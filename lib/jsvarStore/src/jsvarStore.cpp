@@ -4,10 +4,18 @@
 #include <esp32-hal.h>
 
 JsvarStore::JsvarStore()
-    : mState(0)
+    : mNumVars(0)
+    , mState(0)
     , mCounter(0)
+    , mLineStart(0)
+    , mVarNameLen(0)
+    , mVarContentLen(0)
+    , mStats()
+    , mEpoch(0)
+    , mSubscriptions()
 {
     mMutex = xSemaphoreCreateMutex();
+    reset();
 }
 
 JsvarStore::~JsvarStore()
@@ -15,7 +23,18 @@ JsvarStore::~JsvarStore()
     vSemaphoreDelete(mMutex);
 }
 
-String JsvarStore::handleChar(const char &c)
+int8_t JsvarStore::registerVar(const char *varName)
+{
+    int8_t idx = NO_VAR;
+    if( xSemaphoreTake( mMutex, (TickType_t) 50 ) )
+    {
+        idx = claimVar(varName);
+        xSemaphoreGive(mMutex);
+    }
+    return idx;
+}
+
+int8_t JsvarStore::handleChar(const char &c)
 {
 
     if(mState == 0) //search for "var " with the space
@@ -23,6 +42,8 @@ String JsvarStore::handleChar(const char &c)
         const char var[] = "var ";
         if(mCounter <= 4 && var[mCounter] == c)
         {
+            if(mCounter == 0) mLineStart = ESP.getCycleCount();
+
             mCounter ++;
 
             if(mCounter == 4) //token found sucessfully
@@ -31,11 +52,11 @@ String JsvarStore::handleChar(const char &c)
                 mState = 1;
             }
         }
-        else //error case
+        else if(mCounter > 0) //error case, "var " was only partially matched
         {
-            reset();
+            error(c);
         }
-        
+
     }
     else if(mState == 1) //parse variable name until '='
     {
@@ -44,28 +65,29 @@ String JsvarStore::handleChar(const char &c)
             mState = 2;
             mCounter = 0;
         }
-        else if(mCounter < 10) //max var name length is 10
+        else if(mCounter < MAX_NAME_LEN) //max var name length is 10
         {
              //filter for reasonable characters
             if((c >= 'a' && c <= 'z') //lower case letters are most common, check first
                 || (c >= 'A' && c <= 'Z')
                 || (c >= '0' && c <= '9'))
             {
-                mVarName += c;
+                mVarName[mVarNameLen++] = c;
+                mVarName[mVarNameLen] = 0;
                 mCounter ++;
             }
             else if(c == ' ') //allow one space character at the end of the variable name
             {
-                mCounter = 10;
+                mCounter = MAX_NAME_LEN;
             }
             else
             {
-                reset();
+                error(c);
             }
         }
         else //error case
         {
-            reset();
+            error(c);
         }
     }
     else if(mState == 2) //expect a quotation mark or a [
@@ -73,95 +95,140 @@ String JsvarStore::handleChar(const char &c)
         if(c == '\"' || c == '[')
         {
             mState = 3;
-            mVarContent += c;
+            mVarContent[mVarContentLen++] = c;
         }
         else //error case
         {
-            reset();
+            error(c);
         }
     }
     else if(mState == 3) //parse content until '\"' or ']'
     {
-        if((c == '\"' && mVarContent.charAt(0) == '\"') || (c == ']' && mVarContent.charAt(0) == '[')) //end of content
+        if((c == '\"' && mVarContent[0] == '\"') || (c == ']' && mVarContent[0] == '[')) //end of content
         {
             mState = 4;
             mCounter = 0;
-            mVarContent += c;
+            mVarContent[mVarContentLen++] = c;
         }
-        else if(mCounter < 250) //max content length is 250
+        else if(mCounter < MAX_CONTENT_LEN - 2) //max content length is 250
         {
-            mVarContent += c;
+            mVarContent[mVarContentLen++] = c;
             mCounter ++;
         }
         else //error case
         {
-            reset();
+            error(c);
         }
     }
     else if(mState == 4) //expect semicolon
     {
         if(c == ';') //line was valid, commit
         {
-            if(mVarName.charAt(0) != 'h') //special treatment of history download
+            int8_t idx = NO_VAR;
+
+            if(mVarName[0] != 'h') //special treatment of history download
             {
                 uint64_t time = millis();
+                Subscription notify[MAX_SUBSCRIPTIONS];
+                uint8_t numNotify = 0;
+                View view;
+
                 if( xSemaphoreTake( mMutex, (TickType_t) 5 ) )
                 {
-                    auto var = mVars.find(mVarName);
-                    if(var == mVars.end())
+                    idx = claimVar(mVarName);
+
+                    if(idx != NO_VAR)
+                    {
+                        SVar &var = mVars[idx];
+                        memcpy(var.data, mVarContent, mVarContentLen);
+                        var.data[mVarContentLen] = 0;
+                        var.length = mVarContentLen;
+                        var.seq++;
+                        var.writeTime = time;
+                        var.trace.firstByte = mLineStart;
+                        var.trace.commit = ESP.getCycleCount();
+                        var.epoch = ++mEpoch;
+
+                        view = makeView(idx);
+                        for(uint8_t i=0; i<MAX_SUBSCRIPTIONS; i++)
+                        {
+                            const Subscription &sub = mSubscriptions[i];
+                            if((sub.callback || sub.queue) && (sub.id == ANY_VAR || sub.id == idx)) notify[numNotify++] = sub;
+                        }
+                    }
+                    xSemaphoreGive(mMutex);
+                }
+
+                //outside of the lock, subscribers may read the store. Only this task writes the slot, the view stays valid until the next commit.
+                for(uint8_t i=0; i<numNotify; i++)
+                {
+                    const Subscription &sub = notify[i];
+                    if(sub.queue)
                     {
-                        mVars.insert(std::pair<String,SVar>(String(mVarName), {String(mVarContent), time})); //insert in our stored data
+                        Event event = {view.id, sub.tag, view.seq, view.epoch};
+                        if(!xQueueSendToBack(sub.queue, &event, 0)) mStats.droppedEvents++;
                     }
                     else
                     {
-                        var->second.data = String(mVarContent);
-                        var->second.writeTime = time;
+                        uint32_t start = micros();
+                        sub.callback(view, sub.arg);
+                        if(micros() - start > CALLBACK_BUDGET_US) mStats.slowCallbacks++;
                     }
-                    xSemaphoreGive(mMutex);
                 }
             }
-            
-            String varName = mVarName;
+
+            mStats.committed++;
             reset();
-            
-            return varName;
+
+            return idx;
         }
         else //error case
         {
-            reset();
+            error(c);
         }
     }
 
-    return String();
+    return NO_VAR;
 }
 
 
 String JsvarStore::dumpVars()
 {
     String dump((char*)0); //do not reserve anything at first
-    dump.reserve(2000); //then reserve huge block, this should fit everything
 
     uint64_t time = millis();
 
     if( xSemaphoreTake( mMutex, (TickType_t) 50 ) )
     {
-        auto it = mVars.begin();
-        while(it != mVars.end())
+        //expire stale vars and calculate the exact size so the dump is a single allocation
+        size_t size = 0;
+        for(uint8_t i=0; i<mNumVars; i++)
         {
-            if(time - it->second.writeTime > DATA_TIMEOUT_MS)
+            SVar &var = mVars[i];
+            if(var.length > 0 && time - var.writeTime > DATA_TIMEOUT_MS)
             {
-                it = mVars.erase(it); // erase stale variable
+                var.length = 0; // erase stale variable, the slot stays reserved for its name
             }
-            else
+
+            if(var.length > 0)
+            {
+                size += 4 + strlen(var.name) + 1 + var.length + 3;
+            }
+        }
+
+        dump.reserve(size);
+
+        for(uint8_t i=0; i<mNumVars; i++)
+        {
+            const SVar &var = mVars[i];
+            if(var.length > 0)
             {
                 //reconstruct the original line syntax (without temporary strings involved)
                 dump += "var ";
-                dump += it->first;
+                dump += var.name;
                 dump += "=";
-                dump += it->second.data;
+                dump += var.data;
                 dump += ";\r\n";
-
-                ++it;
             }
         }
         xSemaphoreGive(mMutex);
@@ -171,27 +238,177 @@ String JsvarStore::dumpVars()
 }
 
 
-String JsvarStore::getVar(const String varName) const
+size_t JsvarStore::getVar(const char *varName, char *buf, size_t bufLen) const
+{
+    int8_t idx = findVar(varName); //names never change once assigned, no lock needed
+    if(idx == NO_VAR)
+    {
+        if(bufLen > 0) buf[0] = 0;
+        return 0;
+    }
+    return getVar(idx, buf, bufLen);
+}
+
+
+size_t JsvarStore::getVar(uint8_t id, char *buf, size_t bufLen, uint16_t *seq, Trace *trace) const
 {
-    String res;
+    size_t len = 0;
+    if(bufLen == 0) return 0;
+    buf[0] = 0;
+
     if( xSemaphoreTake( mMutex, (TickType_t) 50 ) )
     {
-        auto var = mVars.find(varName);
-        if(var != mVars.cend())
+        if(id < mNumVars && mVars[id].length > 0)
         {
-            res = var->second.data; //return a copy of the data
+            len = mVars[id].length;
+            if(len >= bufLen) len = bufLen - 1; //truncate to the buffer, never overflow
+            memcpy(buf, mVars[id].data, len); //return a copy of the data
+            buf[len] = 0;
+            if(seq) *seq = mVars[id].seq;
+            if(trace) *trace = mVars[id].trace;
         }
         xSemaphoreGive(mMutex);
     }
-    return res;
+    return len;
+}
+
+
+uint16_t JsvarStore::getSeq(uint8_t id) const
+{
+    if(id >= mNumVars) return 0;
+    return mVars[id].seq; //single aligned 16 bit read, no lock needed
+}
+
+
+const char *JsvarStore::getName(uint8_t id) const
+{
+    if(id >= mNumVars) return "";
+    return mVars[id].name; //names never change once assigned
+}
+
+
+String JsvarStore::getVar(const String varName) const
+{
+    char buf[MAX_CONTENT_LEN + 1];
+    getVar(varName.c_str(), buf, sizeof(buf));
+    return String(buf);
 }
 
 void JsvarStore::reset()
 {
     mState = 0;
     mCounter = 0;
-    mVarName.clear();
-    mVarContent.clear();
-    timeTaken = 0;
+    mVarNameLen = 0;
+    mVarName[0] = 0;
+    mVarContentLen = 0;
+    mVarContent[0] = 0;
+}
+
+void JsvarStore::markGap()
+{
+    if(mState != 0 || mCounter != 0) mStats.gaps++;
+    reset();
+}
+
+void JsvarStore::error(const char &c)
+{
+    mStats.errors++;
+    reset();
+
+    if(c == 'v') //resync right away, the line may have been cut off by the start of the next one
+    {
+        mLineStart = ESP.getCycleCount();
+        mCounter = 1;
+    }
+}
+
+int8_t JsvarStore::subscribe(uint8_t id, Callback callback, void *arg)
+{
+    Subscription subscription = {id, callback, arg, nullptr, 0};
+    return addSubscription(subscription);
+}
+
+int8_t JsvarStore::subscribe(uint8_t id, QueueHandle_t queue, uint8_t tag)
+{
+    Subscription subscription = {id, nullptr, nullptr, queue, tag};
+    return addSubscription(subscription);
+}
+
+int8_t JsvarStore::addSubscription(const Subscription &subscription)
+{
+    int8_t handle = -1;
+    if( xSemaphoreTake( mMutex, (TickType_t) 50 ) )
+    {
+        for(uint8_t i=0; i<MAX_SUBSCRIPTIONS && handle < 0; i++)
+        {
+            Subscription &sub = mSubscriptions[i];
+            if(!sub.callback && !sub.queue)
+            {
+                sub = subscription;
+                handle = i;
+            }
+        }
+        xSemaphoreGive(mMutex);
+    }
+    return handle;
+}
+
+void JsvarStore::unsubscribe(int8_t handle)
+{
+    if(handle < 0 || handle >= MAX_SUBSCRIPTIONS) return;
+
+    if( xSemaphoreTake( mMutex, (TickType_t) 50 ) )
+    {
+        mSubscriptions[handle].callback = nullptr;
+        mSubscriptions[handle].queue = nullptr;
+        xSemaphoreGive(mMutex);
+    }
+}
+
+bool JsvarStore::readVar(uint8_t id, Callback reader, void *arg) const
+{
+    bool found = false;
+    if( xSemaphoreTake( mMutex, (TickType_t) 50 ) )
+    {
+        if(id < mNumVars && mVars[id].length > 0)
+        {
+            reader(makeView(id), arg);
+            found = true;
+        }
+        xSemaphoreGive(mMutex);
+    }
+    return found;
+}
+
+JsvarStore::View JsvarStore::makeView(uint8_t id) const
+{
+    const SVar &var = mVars[id];
+    View view = {id, var.name, var.data, var.length, var.seq, var.epoch, var.trace};
+    return view;
+}
+
+int8_t JsvarStore::findVar(const char *varName) const
+{
+    for(uint8_t i=0; i<mNumVars; i++)
+    {
+        if(strcmp(mVars[i].name, varName) == 0) return i;
+    }
+    return NO_VAR;
 }
 
+int8_t JsvarStore::claimVar(const char *varName)
+{
+    int8_t idx = findVar(varName);
+    if(idx == NO_VAR && mNumVars < MAX_VARS)
+    {
+        idx = mNumVars;
+        SVar &var = mVars[idx];
+        strlcpy(var.name, varName, sizeof(var.name));
+        var.length = 0;
+        var.seq = 0;
+        var.epoch = 0;
+        var.writeTime = 0;
+        mNumVars++; //publish the slot only after it is initialized, getName/getSeq read without lock
+    }
+    return idx;
+}
@@ -3,8 +3,6 @@
 
 #include <Arduino.h>
 
-#include <map>
-
 #include "Stream.h"
 
 
@@ -12,50 +10,185 @@
 class JsvarStore {
 
 public:
+    //max var name length
+    static const uint8_t MAX_NAME_LEN = 10;
+
+    //max content length, including the enclosing quotation marks or brackets
+    static const uint16_t MAX_CONTENT_LEN = 252;
+
+    //number of distinct variables the store can hold
+    static const uint8_t MAX_VARS = 16;
+
+    //returned by handleChar if no variable was stored
+    static const int8_t NO_VAR = -1;
+
+    //subscribe to the commits of every variable
+    static const uint8_t ANY_VAR = 0xFF;
+
+    static const uint8_t MAX_SUBSCRIPTIONS = 8;
+
+    //callbacks taking longer are counted as slow, the parser waits for them
+    static const uint32_t CALLBACK_BUDGET_US = 50;
+
+    //parser statistics
+    struct Stats {
+        uint32_t committed; //lines parsed completely
+        uint32_t errors; //lines that started with "var " but were malformed
+        uint32_t gaps; //lines dropped because the input reported lost data
+        uint32_t slowCallbacks; //subscriber callbacks over CALLBACK_BUDGET_US
+        uint32_t droppedEvents; //events not posted because a subscriber queue was full
+    };
+
+    //cycle counter timestamps of the latest value of a variable
+    struct Trace {
+        uint32_t firstByte; //the 'v' of "var " was parsed
+        uint32_t commit; //the ';' was parsed and the value stored
+    };
+
+    //content of a variable without copying, only valid as long as the callback it was passed to runs
+    struct View {
+        uint8_t id;
+        const char *name;
+        const char *data; //zero terminated
+        uint16_t length;
+        uint16_t seq; //sequence number of the variable
+        uint32_t epoch; //commits of the whole store up to this one
+        Trace trace;
+    };
+
+    //posted to queue subscribers on a commit
+    struct Event {
+        uint8_t id;
+        uint8_t tag; //as given to subscribe
+        uint16_t seq;
+        uint32_t epoch;
+    };
+
+    typedef void (*Callback)(const View &var, void *arg);
+
     JsvarStore();
     ~JsvarStore();
 
-    //updates with new data from stream. Parses at most one variable before returning. Returns the name of the parsed variable.
-    String handleChar(const char &c);
+    //assign an ID to a variable name ahead of time, so IDs of known variables are fixed. Returns the ID or NO_VAR if the store is full.
+    int8_t registerVar(const char *varName);
+
+    //updates with new data from stream. Parses at most one variable before returning. Returns the ID of the stored variable or NO_VAR.
+    int8_t handleChar(const char &c);
 
     //returns all vars in the source formatting and checks for stale vars
     String dumpVars();
 
+    //copy the content of a specific var into buf (always zero terminated). Returns the content length or 0 if error or var not found.
+    size_t getVar(const char *varName, char *buf, size_t bufLen) const;
+
+    //same by ID, optionally returns the sequence number and trace of the copied content
+    size_t getVar(uint8_t id, char *buf, size_t bufLen, uint16_t *seq = nullptr, Trace *trace = nullptr) const;
+
+    //sequence number of a variable, incremented on every commit
+    uint16_t getSeq(uint8_t id) const;
+
+    //name of a variable, empty if the ID is not assigned
+    const char *getName(uint8_t id) const;
+
     //return the content of a specific var. Returns empty string if error or var not found.
     String getVar(const String varName) const;
 
     //reset the parser
     void reset();
 
+    //the input lost data at this point. Drops the line in progress and waits for the next "var ".
+    //Feed everything received before the loss first, so a line completed before it is kept.
+    void markGap();
+
+    //parser statistics
+    Stats getStats() const { return mStats; }
+
+    //calls callback on every commit of the variable (or of any with ANY_VAR) from the task calling handleChar, right after the commit.
+    //The callback may read the store, but keep it short: parsing continues when it returns.
+    //Returns a handle for unsubscribe or -1 if all subscriptions are taken.
+    int8_t subscribe(uint8_t id, Callback callback, void *arg);
+
+    //posts an Event to the queue on every commit without waiting, the content can be read with readVar or getVar
+    int8_t subscribe(uint8_t id, QueueHandle_t queue, uint8_t tag = 0);
+
+    void unsubscribe(int8_t handle);
+
+    //calls reader with the current content of a variable without copying it. The store is locked meanwhile, so the parser
+    //can't commit, don't block. Returns false without calling reader if the variable holds no data.
+    bool readVar(uint8_t id, Callback reader, void *arg) const;
+
+    //commits since construction
+    uint32_t getEpoch() const { return mEpoch; }
+
 protected:
 
 private:
 
     struct SVar{
-        String data;
+        char name[MAX_NAME_LEN + 1];
+        char data[MAX_CONTENT_LEN + 1];
+        uint16_t length; //0 if the slot holds no (or only stale) data
+        uint16_t seq;
+        uint32_t epoch; //store epoch of the last commit
         uint64_t writeTime;
+        Trace trace;
+    };
+
+    struct Subscription {
+        uint8_t id; //variable or ANY_VAR
+        Callback callback; //either a callback
+        void *arg;
+        QueueHandle_t queue; //or a queue
+        uint8_t tag;
     };
 
+    //adds a subscription, returns the handle
+    int8_t addSubscription(const Subscription &subscription);
+
+    //view of a slot. Must be called with the mutex held.
+    View makeView(uint8_t id) const;
+
+    //find the slot for the given name. Returns NO_VAR if not found
+    int8_t findVar(const char *varName) const;
+
+    //find or claim the slot for the given name. Must be called with the mutex held.
+    int8_t claimVar(const char *varName);
+
+    //malformed input: reset and check if the offending char already starts the next line
+    void error(const char &c);
+
     //semaphore for data access
     SemaphoreHandle_t mMutex;
 
-    //hold all the data as Strings in a map for easy access
-    std::map<String,SVar> mVars;
+    //hold all the data in fixed slots, no allocation after construction. Slots are never released once a name is assigned.
+    SVar mVars[MAX_VARS];
+
+    //number of slots in use
+    uint8_t mNumVars;
 
     //holds the current state of the parser
     uint8_t mState;
 
     //holds the chars parsed in the current state
     uint8_t mCounter;
-    
+
+    //cycle count when the current line started
+    uint32_t mLineStart;
+
     //holds the currently parsed variable name
-    String mVarName;
+    char mVarName[MAX_NAME_LEN + 1];
+    uint8_t mVarNameLen;
 
     //holds the content parsed so far
-    String mVarContent;
+    char mVarContent[MAX_CONTENT_LEN + 1];
+    uint16_t mVarContentLen;
+
+    Stats mStats;
+
+    uint32_t mEpoch;
 
-    //debug
-    unsigned long timeTaken;
+    //guarded by the mutex, nullptr callback and queue if unused
+    Subscription mSubscriptions[MAX_SUBSCRIPTIONS];
 
     static const uint32_t DATA_TIMEOUT_MS = 5000;
 };
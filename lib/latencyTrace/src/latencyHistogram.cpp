@@ -0,0 +1,61 @@
+#include "latencyHistogram.hpp"
+
+#include <string.h>
+
+LatencyHistogram::LatencyHistogram()
+{
+    reset();
+}
+
+void LatencyHistogram::record(uint32_t cycles)
+{
+    mBuckets[bucketOf(cycles)]++;
+    mCount++;
+    if(cycles > mMax) mMax = cycles;
+}
+
+uint32_t LatencyHistogram::percentile(uint8_t p) const
+{
+    if(mCount == 0) return 0;
+
+    //rank of the sample we are looking for, rounded up
+    uint32_t rank = ((uint64_t)mCount * p + 99) / 100;
+    if(rank == 0) rank = 1;
+
+    uint32_t seen = 0;
+    for(uint8_t i=0; i<NUM_BUCKETS; i++)
+    {
+        seen += mBuckets[i];
+        if(seen >= rank)
+        {
+            uint32_t bound = upperBound(i);
+            return bound < mMax ? bound : mMax; //never report more than the real maximum
+        }
+    }
+    return mMax;
+}
+
+void LatencyHistogram::reset()
+{
+    memset(mBuckets, 0, sizeof(mBuckets));
+    mCount = 0;
+    mMax = 0;
+}
+
+uint8_t LatencyHistogram::bucketOf(uint32_t cycles)
+{
+    if(cycles < (1UL << MIN_SHIFT)) return 0;
+
+    uint8_t msb = 31 - __builtin_clz(cycles);
+    uint8_t sub = (cycles >> (msb - 2)) & (SUB_BUCKETS - 1); //the two bits below the leading one
+    return 1 + (msb - MIN_SHIFT) * SUB_BUCKETS + sub;
+}
+
+uint32_t LatencyHistogram::upperBound(uint8_t bucket)
+{
+    if(bucket == 0) return (1UL << MIN_SHIFT) - 1;
+
+    uint8_t msb = (bucket - 1) / SUB_BUCKETS + MIN_SHIFT;
+    uint8_t sub = (bucket - 1) % SUB_BUCKETS;
+    return (uint32_t)(((uint64_t)(SUB_BUCKETS + sub + 1) << (msb - 2)) - 1);
+}
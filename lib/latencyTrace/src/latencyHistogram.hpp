@@ -0,0 +1,41 @@
+#ifndef LATENCYHISTOGRAM_H
+#define LATENCYHISTOGRAM_H
+
+#include <stdint.h>
+
+//Streaming histogram for latencies in CPU cycles with constant memory.
+//Buckets are logarithmic with 4 linear sub-buckets per power of two, so percentiles are accurate to 25%. The maximum is exact.
+class LatencyHistogram {
+
+public:
+    LatencyHistogram();
+
+    //add one sample
+    void record(uint32_t cycles);
+
+    //returns the upper bound of the bucket holding the given percentile (0-100), 0 if there are no samples
+    uint32_t percentile(uint8_t p) const;
+
+    uint32_t count() const { return mCount; }
+    uint32_t max() const { return mMax; }
+
+    void reset();
+
+    //values below 2^MIN_SHIFT cycles share the first bucket
+    static const uint8_t MIN_SHIFT = 6;
+    static const uint8_t SUB_BUCKETS = 4;
+    static const uint8_t NUM_BUCKETS = 1 + (32 - MIN_SHIFT) * SUB_BUCKETS;
+
+protected:
+
+    static uint8_t bucketOf(uint32_t cycles);
+    static uint32_t upperBound(uint8_t bucket);
+
+private:
+
+    uint32_t mBuckets[NUM_BUCKETS];
+    uint32_t mCount;
+    uint32_t mMax;
+};
+
+#endif
@@ -0,0 +1,127 @@
+
+#include "modbusRegisters.hpp"
+
+ModbusRegisters::ModbusRegisters() : mHasData(false), mUpdatedMs(0)
+{
+    memset(mRegs, 0, sizeof(mRegs));
+    mRegs[REG_VERSION] = LAYOUT_VERSION;
+    mMutex = xSemaphoreCreateMutex();
+}
+
+ModbusRegisters::~ModbusRegisters()
+{
+    vSemaphoreDelete(mMutex);
+}
+
+void ModbusRegisters::put32(uint16_t *regs, uint16_t address, uint64_t value)
+{
+    if(value > 0xFFFFFFFF) value = 0xFFFFFFFF;
+    regs[address] = value >> 16;
+    regs[address + 1] = value & 0xFFFF;
+}
+
+void ModbusRegisters::update(const SbmsData &sbms, uint32_t timeMs)
+{
+    //everything from the frame is prepared outside the lock, the snapshot is replaced at once
+    uint16_t regs[REG_CHARGE];
+    memset(regs, 0, sizeof(regs));
+
+    regs[REG_YEAR] = sbms.year;
+    regs[REG_MONTH] = sbms.month;
+    regs[REG_DAY] = sbms.day;
+    regs[REG_HOUR] = sbms.hour;
+    regs[REG_MINUTE] = sbms.minute;
+    regs[REG_SECOND] = sbms.second;
+    regs[REG_SOC] = sbms.stateOfChargePercent;
+
+    uint32_t batteryMV = 0;
+    for(uint8_t i=0; i<8; i++)
+    {
+        regs[REG_CELLS + i] = sbms.cellVoltageMV[i];
+        batteryMV += sbms.cellVoltageMV[i];
+    }
+
+    uint16_t minMV, maxMV;
+    sbms.cellRange(minMV, maxMV);
+    regs[REG_CELL_MIN] = minMV;
+    regs[REG_CELL_MAX] = maxMV;
+    regs[REG_CELL_DELTA] = maxMV - minMV;
+    regs[REG_BATTERY_MV] = batteryMV > 0xFFFF ? 0xFFFF : batteryMV;
+
+    regs[REG_TEMP_INT] = (uint16_t)sbms.temperatureInternalTenthC;
+    regs[REG_TEMP_EXT] = (uint16_t)sbms.temperatureExternalTenthC;
+
+    //two's complement, high word first
+    regs[REG_BATTERY_MA] = (uint32_t)sbms.batteryCurrentMA >> 16;
+    regs[REG_BATTERY_MA + 1] = (uint32_t)sbms.batteryCurrentMA & 0xFFFF;
+    put32(regs, REG_PV1_MA, sbms.pv1CurrentMA);
+    put32(regs, REG_PV2_MA, sbms.pv2CurrentMA);
+    put32(regs, REG_EXT_LOAD_MA, sbms.extLoadCurrentMA);
+
+    regs[REG_FLAGS] = sbms.flags;
+
+    if( xSemaphoreTake( mMutex, (TickType_t) 50 ) )
+    {
+        regs[REG_VERSION] = LAYOUT_VERSION;
+        regs[REG_FRAMES] = mRegs[REG_FRAMES] + 1;
+        memcpy(mRegs, regs, sizeof(regs)); //the counters behind REG_CHARGE stay
+        mHasData = true;
+        mUpdatedMs = timeMs;
+
+        xSemaphoreGive(mMutex);
+    }
+}
+
+void ModbusRegisters::updateCharge(const SbmsCounters &charge)
+{
+    if( xSemaphoreTake( mMutex, (TickType_t) 50 ) )
+    {
+        for(uint8_t i=0; i<SbmsCounters::NUM_COUNTERS; i++) put32(mRegs, REG_CHARGE + 2 * i, charge.value[i]);
+        xSemaphoreGive(mMutex);
+    }
+}
+
+void ModbusRegisters::updateEnergy(const SbmsCounters &energy)
+{
+    if( xSemaphoreTake( mMutex, (TickType_t) 50 ) )
+    {
+        for(uint8_t i=0; i<SbmsCounters::NUM_COUNTERS; i++) put32(mRegs, REG_ENERGY + 2 * i, energy.value[i]);
+        xSemaphoreGive(mMutex);
+    }
+}
+
+bool ModbusRegisters::readRegisters(uint16_t address, uint16_t count, uint8_t *out, uint32_t timeMs)
+{
+    if(!registersInRange(address, count)) return false;
+
+    if( !xSemaphoreTake( mMutex, (TickType_t) 50 ) ) return false;
+
+    uint32_t ageS = (timeMs - mUpdatedMs) / 1000;
+    mRegs[REG_AGE] = !mHasData || ageS > 0xFFFE ? 0xFFFF : ageS;
+
+    for(uint16_t i=0; i<count; i++)
+    {
+        uint16_t value = mRegs[address + i];
+        out[2 * i] = value >> 8;
+        out[2 * i + 1] = value & 0xFF;
+    }
+
+    xSemaphoreGive(mMutex);
+    return true;
+}
+
+bool ModbusRegisters::readBits(uint16_t address, uint16_t count, uint8_t *out)
+{
+    if(!bitsInRange(address, count)) return false;
+
+    if( !xSemaphoreTake( mMutex, (TickType_t) 50 ) ) return false;
+    uint16_t flags = mRegs[REG_FLAGS];
+    xSemaphoreGive(mMutex);
+
+    memset(out, 0, (count + 7) / 8);
+    for(uint16_t i=0; i<count; i++)
+    {
+        if(flags & (1 << (address + i))) out[i / 8] |= 1 << (i % 8);
+    }
+    return true;
+}
@@ -0,0 +1,98 @@
+#ifndef MODBUS_REGISTERS_H
+#define MODBUS_REGISTERS_H
+
+#include <Arduino.h>
+
+#include "sbmsData.hpp"
+#include "sbmsCounters.hpp"
+
+//Fixed Modbus register table of one source, rebuilt from every decoded sbms frame and the eA/eW counters.
+//Reads copy from this snapshot, nothing is decoded or allocated per request.
+//
+//Registers (function 3 and 4 read the same table, 0 based addresses, 32 bit values high word first):
+//   0      layout version (1)
+//   1      decoded frames, wraps
+//   2      age of the data in s, 0xFFFF if none yet
+//   3-8    sbms clock: year (2 digits), month, day, hour, minute, second
+//   9      state of charge %
+//  10-17   cell 1-8 mV
+//  18-20   lowest cell, highest cell, difference mV (unused cells ignored)
+//  21      battery voltage mV, sum of the cells
+//  22-23   internal, external temperature 0.1 °C, signed
+//  24-25   battery current mA, signed 32 bit, positive while charging
+//  26-27   PV1 current mA
+//  28-29   PV2 current mA
+//  30-31   external load current mA
+//  32      flags, bit n is SbmsData::FlagBit n
+//  40-53   charge counters mAh (eA): battery, PV1, PV2, DMPPT, PV1+PV2, load, external load
+//  54-67   energy counters 0.1 Wh (eW), same order
+//Coils and discrete inputs (function 1 and 2) 0-14 are the flags.
+class ModbusRegisters {
+
+public:
+    static const uint16_t LAYOUT_VERSION = 1;
+
+    enum Address : uint16_t {
+        REG_VERSION = 0,
+        REG_FRAMES = 1,
+        REG_AGE = 2,
+        REG_YEAR = 3,
+        REG_MONTH = 4,
+        REG_DAY = 5,
+        REG_HOUR = 6,
+        REG_MINUTE = 7,
+        REG_SECOND = 8,
+        REG_SOC = 9,
+        REG_CELLS = 10,
+        REG_CELL_MIN = 18,
+        REG_CELL_MAX = 19,
+        REG_CELL_DELTA = 20,
+        REG_BATTERY_MV = 21,
+        REG_TEMP_INT = 22,
+        REG_TEMP_EXT = 23,
+        REG_BATTERY_MA = 24,
+        REG_PV1_MA = 26,
+        REG_PV2_MA = 28,
+        REG_EXT_LOAD_MA = 30,
+        REG_FLAGS = 32,
+        REG_CHARGE = 40,
+        REG_ENERGY = REG_CHARGE + 2 * SbmsCounters::NUM_COUNTERS,
+        NUM_REGISTERS = REG_ENERGY + 2 * SbmsCounters::NUM_COUNTERS
+    };
+
+    static const uint16_t NUM_BITS = SbmsData::DFET + 1;
+
+    ModbusRegisters();
+    ~ModbusRegisters();
+
+    void update(const SbmsData &sbms, uint32_t timeMs);
+    void updateCharge(const SbmsCounters &charge);
+    void updateEnergy(const SbmsCounters &energy);
+
+    //true once an sbms frame was decoded
+    bool hasData() const { return mHasData; }
+
+    //the range is inside the table of registers or bits
+    static bool registersInRange(uint16_t address, uint16_t count) { return count > 0 && (uint32_t)address + count <= NUM_REGISTERS; }
+    static bool bitsInRange(uint16_t address, uint16_t count) { return count > 0 && (uint32_t)address + count <= NUM_BITS; }
+
+    //copies count registers starting at address into out, 2 bytes each, big endian.
+    //False if the range is outside the table or the table stayed locked by an update for too long.
+    bool readRegisters(uint16_t address, uint16_t count, uint8_t *out, uint32_t timeMs);
+
+    //packs count flags starting at address into out, lowest address in the lowest bit, like a coil response. False like readRegisters.
+    bool readBits(uint16_t address, uint16_t count, uint8_t *out);
+
+private:
+
+    //32 bit value into two registers, saturated
+    static void put32(uint16_t *regs, uint16_t address, uint64_t value);
+
+    uint16_t mRegs[NUM_REGISTERS];
+    bool mHasData;
+    uint32_t mUpdatedMs;
+
+    SemaphoreHandle_t mMutex; //update from the publish task, reads from the network task
+};
+
+#endif
@@ -0,0 +1,89 @@
+
+#include "modbusSlave.hpp"
+
+ModbusSlave::ModbusSlave(ModbusRegisters *units, uint8_t numUnits) : mUnits(units), mNumUnits(numUnits)
+{
+    memset(&mStats, 0, sizeof(mStats));
+}
+
+int ModbusSlave::frameLength(const uint8_t *buf, size_t len)
+{
+    if(len < MBAP_LEN) return 0;
+
+    uint16_t protocol = (buf[2] << 8) | buf[3];
+    uint16_t length = (buf[4] << 8) | buf[5]; //unit id and PDU
+    if(protocol != 0 || length < 2 || MBAP_LEN - 1 + length > MAX_ADU_LEN) return -1;
+
+    size_t frameLen = MBAP_LEN - 1 + length;
+    return len < frameLen ? 0 : frameLen;
+}
+
+size_t ModbusSlave::exception(uint8_t *response, uint8_t function, Exception code)
+{
+    mStats.exceptions++;
+    response[MBAP_LEN] = function | 0x80;
+    response[MBAP_LEN + 1] = code;
+    return MBAP_LEN + 2;
+}
+
+size_t ModbusSlave::process(const uint8_t *frame, size_t len, uint8_t *response, uint32_t timeMs)
+{
+    mStats.requests++;
+
+    //transaction and protocol id, unit id are echoed, the length is set at the end
+    memcpy(response, frame, MBAP_LEN);
+
+    const uint8_t *pdu = frame + MBAP_LEN;
+    size_t pduLen = len - MBAP_LEN;
+    uint8_t unit = frame[6];
+    uint8_t function = pdu[0];
+
+    size_t resLen;
+    if(function < 1 || function > 4)
+    {
+        resLen = exception(response, function, ILLEGAL_FUNCTION);
+    }
+    else if(pduLen != 5)
+    {
+        resLen = exception(response, function, ILLEGAL_VALUE);
+    }
+    else
+    {
+        uint8_t index = (unit == 0 || unit == 255) ? 0 : unit - 1;
+        ModbusRegisters *registers = index < mNumUnits ? &mUnits[index] : nullptr;
+
+        uint16_t address = (pdu[1] << 8) | pdu[2];
+        uint16_t count = (pdu[3] << 8) | pdu[4];
+        bool bits = function <= 2;
+        uint8_t *data = response + MBAP_LEN + 2;
+
+        if(!registers || !registers->hasData())
+        {
+            resLen = exception(response, function, TARGET_FAILED);
+        }
+        else if(count == 0 || count > (bits ? 2000 : 125))
+        {
+            resLen = exception(response, function, ILLEGAL_VALUE);
+        }
+        else if(bits ? !ModbusRegisters::bitsInRange(address, count) : !ModbusRegisters::registersInRange(address, count))
+        {
+            resLen = exception(response, function, ILLEGAL_ADDRESS);
+        }
+        else if(bits ? !registers->readBits(address, count, data) : !registers->readRegisters(address, count, data, timeMs))
+        {
+            resLen = exception(response, function, DEVICE_FAILURE); //a valid address, it just couldn't be read now
+        }
+        else
+        {
+            uint8_t bytes = bits ? (count + 7) / 8 : count * 2;
+            response[MBAP_LEN] = function;
+            response[MBAP_LEN + 1] = bytes;
+            resLen = MBAP_LEN + 2 + bytes;
+        }
+    }
+
+    uint16_t length = resLen - MBAP_LEN + 1;
+    response[4] = length >> 8;
+    response[5] = length & 0xFF;
+    return resLen;
+}
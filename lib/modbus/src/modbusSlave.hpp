@@ -0,0 +1,55 @@
+#ifndef MODBUS_SLAVE_H
+#define MODBUS_SLAVE_H
+
+#include <Arduino.h>
+
+#include "modbusRegisters.hpp"
+
+//Modbus TCP protocol on top of the register tables, independent of the transport.
+//Supports reading coils (1), discrete inputs (2), holding registers (3) and input registers (4), the table is read only.
+//Unit 1..n selects the table of source 0..n-1, unit 0 and 255 the first one.
+class ModbusSlave {
+
+public:
+    //MBAP header and the longest PDU
+    static const uint16_t MBAP_LEN = 7;
+    static const uint16_t MAX_ADU_LEN = MBAP_LEN + 253;
+
+    enum Exception : uint8_t {
+        ILLEGAL_FUNCTION = 0x01,
+        ILLEGAL_ADDRESS = 0x02,
+        ILLEGAL_VALUE = 0x03,
+        DEVICE_FAILURE = 0x04, //the table stayed locked, the master may retry
+        TARGET_FAILED = 0x0B //no such unit, or no data from it yet
+    };
+
+    struct Stats {
+        uint32_t requests;
+        uint32_t exceptions;
+        uint32_t malformed; //frames that were not modbus tcp, the connection is closed
+    };
+
+    ModbusSlave(ModbusRegisters *units, uint8_t numUnits);
+
+    //length of the frame at the start of buf once it is complete, 0 while more data is needed, -1 if it is no modbus tcp frame
+    static int frameLength(const uint8_t *buf, size_t len);
+
+    //answers one complete frame into response (MAX_ADU_LEN bytes). Returns the length of the response.
+    size_t process(const uint8_t *frame, size_t len, uint8_t *response, uint32_t timeMs);
+
+    //counts a frame rejected by frameLength
+    void countMalformed() { mStats.malformed++; }
+
+    Stats getStats() const { return mStats; }
+
+private:
+
+    size_t exception(uint8_t *response, uint8_t function, Exception code);
+
+    ModbusRegisters *mUnits;
+    uint8_t mNumUnits;
+
+    Stats mStats;
+};
+
+#endif
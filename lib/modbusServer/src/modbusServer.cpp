@@ -0,0 +1,104 @@
+
+#include "modbusServer.hpp"
+
+ModbusServer::ModbusServer(ModbusSlave &slave) : mSlave(slave), mServer(nullptr), mCount(0)
+{
+    memset(mClients, 0, sizeof(mClients));
+}
+
+void ModbusServer::begin(uint16_t port)
+{
+    if(mServer) return;
+
+    mServer = new AsyncServer(port);
+    mServer->setNoDelay(true); //small answers, don't wait for more
+    mServer->onClient(onClient, this);
+    mServer->begin();
+}
+
+void ModbusServer::onClient(void *arg, AsyncClient *tcp)
+{
+    ModbusServer *server = (ModbusServer*)arg;
+
+    Client *client = nullptr;
+    for(uint8_t i=0; i<MAX_CLIENTS; i++)
+    {
+        if(!server->mClients[i].tcp)
+        {
+            client = &server->mClients[i];
+            break;
+        }
+    }
+
+    if(!client)
+    {
+        tcp->onDisconnect([](void *arg, AsyncClient *tcp){ delete tcp; }, nullptr);
+        tcp->close(true);
+        return;
+    }
+
+    client->server = server;
+    client->tcp = tcp;
+    client->len = 0;
+    server->mCount++;
+
+    tcp->setRxTimeout(IDLE_TIMEOUT_S);
+    tcp->onData(onData, client);
+    tcp->onTimeout(onTimeout, client);
+    tcp->onDisconnect(onDisconnect, client);
+}
+
+void ModbusServer::onData(void *arg, AsyncClient *tcp, void *data, size_t len)
+{
+    Client *client = (Client*)arg;
+    ModbusServer *server = client->server;
+    const uint8_t *in = (const uint8_t*)data;
+
+    //requests may arrive split or several in one segment
+    while(len > 0)
+    {
+        size_t n = sizeof(client->buf) - client->len;
+        if(n > len) n = len;
+        memcpy(client->buf + client->len, in, n);
+        client->len += n;
+        in += n;
+        len -= n;
+
+        for(;;)
+        {
+            int frameLen = ModbusSlave::frameLength(client->buf, client->len);
+            if(frameLen == 0) break;
+            if(frameLen < 0)
+            {
+                server->mSlave.countMalformed();
+                tcp->close(true);
+                return;
+            }
+
+            size_t resLen = server->mSlave.process(client->buf, frameLen, server->mResponse, millis());
+            if(tcp->space() < resLen) //a client that does not read its answers
+            {
+                tcp->close(true);
+                return;
+            }
+            tcp->add((const char*)server->mResponse, resLen);
+            tcp->send();
+
+            client->len -= frameLen;
+            memmove(client->buf, client->buf + frameLen, client->len);
+        }
+    }
+}
+
+void ModbusServer::onTimeout(void *arg, AsyncClient *tcp, uint32_t time)
+{
+    tcp->close(true);
+}
+
+void ModbusServer::onDisconnect(void *arg, AsyncClient *tcp)
+{
+    Client *client = (Client*)arg;
+    client->server->mCount--;
+    client->tcp = nullptr;
+    delete tcp;
+}
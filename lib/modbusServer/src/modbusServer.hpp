@@ -0,0 +1,51 @@
+#ifndef MODBUS_SERVER_H
+#define MODBUS_SERVER_H
+
+#include <Arduino.h>
+
+#include <AsyncTCP.h>
+
+#include "modbusSlave.hpp"
+
+//Modbus TCP server on AsyncTCP. Frames are collected in a fixed buffer per connection and answered from the AsyncTCP task.
+class ModbusServer {
+
+public:
+    static const uint8_t MAX_CLIENTS = 4;
+
+    //connections without a request for this long are closed
+    static const uint32_t IDLE_TIMEOUT_S = 120;
+
+    ModbusServer(ModbusSlave &slave);
+
+    void begin(uint16_t port);
+
+    //number of connected clients
+    uint8_t count() const { return mCount; }
+
+    ModbusSlave &slave() { return mSlave; }
+
+private:
+
+    struct Client {
+        ModbusServer *server;
+        AsyncClient *tcp;
+        size_t len;
+        uint8_t buf[ModbusSlave::MAX_ADU_LEN];
+    };
+
+    static void onClient(void *arg, AsyncClient *tcp);
+    static void onData(void *arg, AsyncClient *tcp, void *data, size_t len);
+    static void onDisconnect(void *arg, AsyncClient *tcp);
+    static void onTimeout(void *arg, AsyncClient *tcp, uint32_t time);
+
+    ModbusSlave &mSlave;
+    AsyncServer *mServer;
+
+    Client mClients[MAX_CLIENTS]; //tcp is nullptr if unused
+    uint8_t mCount;
+
+    uint8_t mResponse[ModbusSlave::MAX_ADU_LEN];
+};
+
+#endif
@@ -0,0 +1,79 @@
+#ifndef MQTTSTREAM_H
+#define MQTTSTREAM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+//Publishing of payloads larger than the client buffer. Works with PubSubClient and anything with the same
+//beginPublish()/write()/endPublish() interface, like the stand-in of the host build.
+
+#ifndef MQTT_MAX_PACKET_SIZE
+#define MQTT_MAX_PACKET_SIZE 256 //same default as PubSubClient
+#endif
+
+//publishes an already serialized payload of any size, the client buffer only holds the header
+template<class TClient>
+bool mqttPublishBuffer(TClient &client, const char *topic, const char *payload, size_t len)
+{
+    if(!client.beginPublish(topic, len, false)) return false;
+
+    size_t written = 0;
+    while(written < len)
+    {
+        size_t thisWrite = client.write((const uint8_t *)payload + written, len - written);
+        if(thisWrite == 0) break; //error, couldn't even write a single byte. Prevent infinite loop.
+        written += thisWrite;
+    }
+
+    return client.endPublish();
+}
+
+//writer for serializeJson() that streams into a publish started with beginPublish(), in chunks of MQTT_MAX_PACKET_SIZE
+template<class TClient>
+struct MqttJsonWriter {
+    // Writes one byte, returns the number of bytes written (0 or 1)
+    size_t write(uint8_t c)
+    {
+        buf[bufi++] = c;
+        if(bufi == MQTT_MAX_PACKET_SIZE) flush();
+        return 1;
+    }
+    // Writes several bytes, returns the number of bytes written
+    size_t write(const uint8_t *buffer, size_t length)
+    {
+        size_t i = 0;
+        while(i < length && bufi < MQTT_MAX_PACKET_SIZE)
+        {
+            buf[bufi++] = buffer[i++];
+        }
+
+        if(bufi == MQTT_MAX_PACKET_SIZE) flush();
+
+        return i;
+    }
+
+    TClient &client;
+    uint8_t buf[MQTT_MAX_PACKET_SIZE];
+    size_t bufi;
+
+    MqttJsonWriter(TClient &client)
+        : client(client)
+        , bufi(0)
+    {
+    }
+
+    void flush()
+    {
+        size_t written = 0;
+        while(written < bufi)
+        {
+            size_t thisWrite = client.write(buf + written, bufi - written);
+            if(thisWrite == 0) return; //error, couldn't even write a single byte. Prevent infinite loop.
+            written += thisWrite;
+        }
+
+        bufi = 0;
+    }
+};
+
+#endif
@@ -0,0 +1,252 @@
+#include "otaWriter.hpp"
+
+#include <Update.h>
+#include <ctype.h>
+
+#define OTA_WRITER_STACK 4096
+#define OTA_WRITER_PRIORITY 2 //below the AsyncTCP task, it runs while the receiver waits for the network or a buffer
+#define OTA_WRITER_CORE 0
+
+OtaWriter::OtaWriter()
+    : mFree(NULL)
+    , mFull(NULL)
+    , mDone(NULL)
+    , mTask(NULL)
+    , mCurrent(nullptr)
+    , mFill(0)
+    , mStartMs(0)
+    , mLastWriteMs(0)
+    , mEndMs(0)
+    , mActive(false)
+    , mState(IDLE)
+    , mStatus()
+{
+    mExpected[0] = 0;
+}
+
+bool OtaWriter::begin(int command, const char *sha256, int ledPin)
+{
+    if(mActive) //the previous upload was not ended
+    {
+        if(mState == RECEIVING && millis() - mLastWriteMs <= STALE_MS) return false;
+
+        fail("stalled"); //cut off, or it failed and the client left
+        end(BUFFER_WAIT_MS);
+    }
+    if(mState == FINISHING) return false; //the writer is still busy with it
+
+    if(!mTask)
+    {
+        mFree = xQueueCreate(NUM_BUFFERS, sizeof(uint8_t*));
+        mFull = xQueueCreate(NUM_BUFFERS + 1, sizeof(Chunk)); //room for the end marker
+        mDone = xSemaphoreCreateBinary();
+        xTaskCreatePinnedToCore(writerTask, "otaWriter", OTA_WRITER_STACK, this, OTA_WRITER_PRIORITY, &mTask, OTA_WRITER_CORE);
+    }
+
+    memset(&mStatus, 0, sizeof(mStatus));
+    mStatus.command = command;
+    mState = IDLE;
+    mStartMs = millis();
+    mLastWriteMs = mStartMs;
+    mEndMs = 0;
+    mCurrent = nullptr;
+    mFill = 0;
+
+    //expected digest in lower case
+    size_t len = 0;
+    for(const char *c = sha256; *c && len < sizeof(mExpected) - 1; c++) mExpected[len++] = tolower(*c);
+    mExpected[len] = 0;
+    if(len != 0 && len != 64)
+    {
+        mState = FAILED;
+        snprintf(mStatus.error, sizeof(mStatus.error), "sha256 must have 64 hex digits");
+        mEndMs = millis();
+        return false;
+    }
+
+    //the buffers only exist during an update
+    xQueueReset(mFree);
+    for(uint8_t i=0; i<NUM_BUFFERS; i++)
+    {
+        uint8_t *buf = (uint8_t*)malloc(BUFFER_SIZE);
+        if(buf) xQueueSendToBack(mFree, &buf, 0);
+    }
+    if(uxQueueMessagesWaiting(mFree) == 0)
+    {
+        mState = FAILED;
+        snprintf(mStatus.error, sizeof(mStatus.error), "out of memory");
+        mEndMs = millis();
+        return false;
+    }
+
+    if(!Update.begin(UPDATE_SIZE_UNKNOWN, command, ledPin))
+    {
+        fail(Update.errorString());
+        mEndMs = millis();
+        uint8_t *buf;
+        while(xQueueReceive(mFree, &buf, 0)) free(buf);
+        return false;
+    }
+
+    mbedtls_sha256_init(&mSha);
+    mbedtls_sha256_starts_ret(&mSha, 0);
+
+    xSemaphoreTake(mDone, 0); //clear a leftover signal
+    mActive = true;
+    mState = RECEIVING;
+    return true;
+}
+
+bool OtaWriter::write(const uint8_t *data, size_t len)
+{
+    if(mState != RECEIVING) return false;
+
+    mStatus.received += len;
+    mLastWriteMs = millis();
+
+    while(len > 0)
+    {
+        if(!mCurrent)
+        {
+            if(uxQueueMessagesWaiting(mFree) == 0) mStatus.bufferWaits++;
+            if(!xQueueReceive(mFree, &mCurrent, pdMS_TO_TICKS(BUFFER_WAIT_MS)))
+            {
+                mCurrent = nullptr;
+                fail("flash write timeout");
+                return false;
+            }
+            mFill = 0;
+        }
+
+        size_t n = BUFFER_SIZE - mFill;
+        if(n > len) n = len;
+        memcpy(mCurrent + mFill, data, n);
+        mFill += n;
+        data += n;
+        len -= n;
+
+        if(mFill == BUFFER_SIZE && !sendCurrent()) return false;
+    }
+
+    return mState == RECEIVING;
+}
+
+bool OtaWriter::sendCurrent()
+{
+    Chunk chunk = {mCurrent, mFill};
+    mCurrent = nullptr;
+    mFill = 0;
+
+    //the queue holds every buffer, this never waits
+    return xQueueSendToBack(mFull, &chunk, portMAX_DELAY) == pdTRUE;
+}
+
+bool OtaWriter::end(uint32_t timeoutMs)
+{
+    if(!mActive) return mState == DONE;
+    mActive = false;
+
+    if(mCurrent)
+    {
+        if(mFill > 0) sendCurrent();
+        else xQueueSendToBack(mFree, &mCurrent, 0);
+        mCurrent = nullptr;
+    }
+
+    if(mState == RECEIVING) mState = FINISHING;
+
+    Chunk last = {nullptr, 0};
+    xQueueSendToBack(mFull, &last, portMAX_DELAY);
+
+    xSemaphoreTake(mDone, pdMS_TO_TICKS(timeoutMs));
+    return mState == DONE;
+}
+
+void OtaWriter::writerTask(void *parameter)
+{
+    OtaWriter *writer = (OtaWriter*)parameter;
+    Chunk chunk;
+    for(;;)
+    {
+        if(xQueueReceive(writer->mFull, &chunk, portMAX_DELAY)) writer->writeChunk(chunk);
+    }
+}
+
+void OtaWriter::writeChunk(const Chunk &chunk)
+{
+    if(!chunk.data)
+    {
+        finish();
+        return;
+    }
+
+    if(mState != FAILED)
+    {
+        mbedtls_sha256_update_ret(&mSha, chunk.data, chunk.len);
+        if(Update.write(chunk.data, chunk.len) != chunk.len) fail(Update.errorString());
+        else mStatus.written += chunk.len;
+    }
+
+    xQueueSendToBack(mFree, &chunk.data, 0);
+}
+
+void OtaWriter::finish()
+{
+    uint8_t digest[32];
+    mbedtls_sha256_finish_ret(&mSha, digest);
+    mbedtls_sha256_free(&mSha);
+
+    for(uint8_t i=0; i<sizeof(digest); i++) snprintf(mStatus.sha256 + 2 * i, 3, "%02x", digest[i]);
+
+    if(mState != FAILED && mExpected[0] && strcmp(mExpected, mStatus.sha256) != 0) fail("sha256 mismatch");
+
+    if(mState == FAILED)
+    {
+        Update.abort(); //the running image stays active
+    }
+    else if(!Update.end(true))
+    {
+        fail(Update.errorString());
+    }
+    else
+    {
+        mStatus.verified = mExpected[0] != 0;
+        mState = DONE;
+    }
+
+    mEndMs = millis();
+
+    //all buffers are back
+    uint8_t *buf;
+    while(xQueueReceive(mFree, &buf, 0)) free(buf);
+
+    xSemaphoreGive(mDone);
+}
+
+void OtaWriter::fail(const char *error)
+{
+    if(mState == FAILED) return; //keep the first error
+    snprintf(mStatus.error, sizeof(mStatus.error), "%s", error);
+    mState = FAILED;
+}
+
+OtaWriter::Status OtaWriter::getStatus() const
+{
+    Status status = mStatus;
+    status.state = mState;
+    status.elapsedMs = (mEndMs ? mEndMs : millis()) - mStartMs;
+    if(mState == IDLE) status.elapsedMs = 0;
+    status.bytesPerS = status.elapsedMs ? (uint64_t)status.written * 1000 / status.elapsedMs : 0;
+    return status;
+}
+
+size_t OtaWriter::statusJson(char *buf, size_t bufLen) const
+{
+    static const char *const STATE_NAMES[] = {"idle", "receiving", "finishing", "done", "failed"};
+
+    Status s = getStatus();
+    return snprintf(buf, bufLen, "{\"state\":\"%s\",\"type\":\"%s\",\"received\":%u,\"written\":%u,\"elapsedMs\":%u,\"bytesPerS\":%u,"
+                                 "\"bufferWaits\":%u,\"verified\":%s,\"sha256\":\"%s\",\"error\":\"%s\"}",
+        STATE_NAMES[s.state], s.command == U_SPIFFS ? "spiffs" : "flash", s.received, s.written, s.elapsedMs, s.bytesPerS,
+        s.bufferWaits, s.verified ? "true" : "false", s.sha256, s.error);
+}
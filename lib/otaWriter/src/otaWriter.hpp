@@ -0,0 +1,108 @@
+#ifndef OTAWRITER_H
+#define OTAWRITER_H
+
+#include <Arduino.h>
+
+#include "mbedtls/sha256.h"
+
+//Firmware and filesystem updates written from their own task.
+//The receiving side (the AsyncTCP task) only copies each chunk into a sector sized buffer, full buffers are written to flash by the
+//writer task. So the TCP window stays open while a sector is erased and written, as long as a buffer is free.
+//The image is hashed with SHA-256 while it is written. The update is only activated if the digest matches the expected one.
+class OtaWriter {
+
+public:
+    //one flash sector
+    static const size_t BUFFER_SIZE = 4096;
+    static const uint8_t NUM_BUFFERS = 4;
+
+    //the receiver gives up if the flash does not free a buffer in time
+    static const uint32_t BUFFER_WAIT_MS = 5000;
+
+    //a receiving update without data for this long is aborted by the next begin
+    static const uint32_t STALE_MS = 30000;
+
+    enum State : uint8_t {
+        IDLE,
+        RECEIVING,
+        FINISHING, //all data received, waiting for the writer
+        DONE, //written, verified and activated
+        FAILED
+    };
+
+    struct Status {
+        State state;
+        int command; //U_FLASH or U_SPIFFS
+        uint32_t received;
+        uint32_t written;
+        uint32_t elapsedMs;
+        uint32_t bytesPerS; //written
+        uint32_t bufferWaits; //chunks that waited for a free buffer, the flash was slower than the network
+        bool verified; //an expected digest was given and matched
+        char sha256[65]; //of the written image, once done
+        char error[64];
+    };
+
+    OtaWriter();
+
+    //starts an update of the given kind (U_FLASH or U_SPIFFS). sha256 is the expected digest in hex, or empty to accept any image.
+    //Returns false if another update is running or the update could not be started.
+    bool begin(int command, const char *sha256, int ledPin = -1);
+
+    //copies a chunk, waits for a free buffer if the flash falls behind. Returns false once the update failed, the rest can be dropped.
+    bool write(const uint8_t *data, size_t len);
+
+    //writes the rest and waits up to timeoutMs for verification and activation. Returns true if the update is done.
+    bool end(uint32_t timeoutMs);
+
+    //marks the update as failed, the rest of the data is ignored and end() aborts it
+    void fail(const char *error);
+
+    Status getStatus() const;
+
+    //status as JSON object. Returns the length, like snprintf.
+    size_t statusJson(char *buf, size_t bufLen) const;
+
+private:
+
+    //a filled buffer for the writer task, data is nullptr for the end of the image
+    struct Chunk {
+        uint8_t *data;
+        size_t len;
+    };
+
+    static void writerTask(void *parameter);
+
+    //processes one chunk, called by the writer task
+    void writeChunk(const Chunk &chunk);
+
+    //checks the digest and activates the update, called by the writer task
+    void finish();
+
+    //hands the current buffer to the writer
+    bool sendCurrent();
+
+    QueueHandle_t mFree; //empty buffers
+    QueueHandle_t mFull; //chunks for the writer
+    SemaphoreHandle_t mDone; //given by the writer after the last chunk
+    TaskHandle_t mTask;
+
+    //buffer being filled by the receiver
+    uint8_t *mCurrent;
+    size_t mFill;
+
+    mbedtls_sha256_context mSha;
+    char mExpected[65];
+
+    uint32_t mStartMs;
+    uint32_t mLastWriteMs;
+    uint32_t mEndMs;
+
+    //begin succeeded, end has not been called yet
+    bool mActive;
+
+    volatile State mState;
+    Status mStatus;
+};
+
+#endif
@@ -0,0 +1,43 @@
+
+#include "sbmsCounters.hpp"
+
+#include <cstring>
+
+SbmsCounters::SbmsCounters(const char *data)
+{
+    uint16_t pos = 0; //position in the unescaped content, 0 is the quotation mark
+    uint8_t digit = 0;
+    uint8_t counter = 0;
+
+    memset(value, 0, sizeof(value));
+
+    for(const char *c = data; *c && counter < NUM_COUNTERS; c++)
+    {
+        if(c[0] == '\\' && c[1] == '\\') c++;
+        if(pos++ == 0) continue;
+
+        //most significant digit first, like sbmsDecode
+        value[counter] = value[counter] * 91 + (uint8_t)(*c - 35);
+        if(++digit == DIGITS)
+        {
+            digit = 0;
+            counter++;
+        }
+    }
+}
+
+bool SbmsCounters::isValid(const char *data)
+{
+    uint16_t len = 0;
+    for(const char *c = data; *c; c++)
+    {
+        if(c[0] == '\\' && c[1] == '\\') c++;
+
+        bool quote = len == 0 || len == FRAME_LEN - 1;
+        if(quote && *c != '\"') return false;
+        if(!quote && (*c < '#' || *c > '}')) return false;
+
+        if(++len > FRAME_LEN) return false;
+    }
+    return len == FRAME_LEN;
+}
@@ -0,0 +1,39 @@
+#ifndef SBMS_COUNTERS_H
+#define SBMS_COUNTERS_H
+
+#include <WString.h>
+
+//decodes the content of the eA (charge in mAh) or eW (energy in 0.1 Wh) variable: 7 counters of 6 base91 digits.
+//The order is the one of the columns in sbms.html.
+class SbmsCounters {
+
+public:
+    static const uint8_t NUM_COUNTERS = 7;
+
+    enum Counter {
+        BATTERY = 0,
+        PV1 = 1,
+        PV2 = 2,
+        DMPPT = 3,
+        PV = 4, //PV1 + PV2
+        LOAD = 5,
+        EXT_LOAD = 6
+    };
+
+    //decodes the content including the enclosing quotation marks
+    SbmsCounters(const char *data);
+
+    //checks length and alphabet, like SbmsData::isValid
+    static bool isValid(const char *data);
+
+    //6 digits can exceed 32 bit
+    uint64_t value[NUM_COUNTERS];
+
+protected:
+
+    static const uint8_t DIGITS = 6;
+    static const uint16_t FRAME_LEN = NUM_COUNTERS * DIGITS + 2;
+
+};
+
+#endif
@@ -1,44 +1,16 @@
 
 #include "sbmsData.hpp"
 
-#include <cmath>
+#include <cstring>
 
-SbmsData::SbmsData(String dataString)
+SbmsData::SbmsData(const char *dataString)
 {
-    dataString.replace("\\\\", "\\"); //replace escaped "\" with single "\" 
-
-    const char *data = dataString.c_str();
-
-    uint16_t i = 1; //ignore quotation mark
-    year = decompress(data, i, 1);
-    month = decompress(data, i, 1);
-    day = decompress(data, i, 1);
-    hour = decompress(data, i, 1);
-    minute = decompress(data, i, 1);
-    second = decompress(data, i, 1);
-    stateOfChargePercent = decompress(data, i, 2);
-
-    for(uint8_t x=0; x<8; x++)
-    {
-        cellVoltageMV[x] = decompress(data, i, 2);
-    }
+    sbmsDecode(dataString, strlen(dataString), *this);
+}
 
-    temperatureInternalTenthC = decompress(data, i, 2) - 450;
-    temperatureExternalTenthC = decompress(data, i, 2) - 450;
-    
-    int8_t sign = data[i++] == '-'?-1:1;
-    batteryCurrentMA = decompress(data, i, 3) * sign;
-    pv1CurrentMA = decompress(data, i, 3);
-    pv2CurrentMA = decompress(data, i, 3);
-    extLoadCurrentMA = decompress(data, i, 3);
-    ad2 = decompress(data, i, 3);
-    ad3 = decompress(data, i, 3);
-    ad4 = decompress(data, i, 3);
-
-    heat1 = decompress(data, i, 3);
-    heat2 = decompress(data, i, 3);
-
-    flags = decompress(data, i, 3);
+bool SbmsData::isValid(const char *dataString)
+{
+    return sbmsIsValid(dataString, strlen(dataString));
 }
 
 bool SbmsData::getFlag(FlagBit bit) const
@@ -46,15 +18,26 @@ bool SbmsData::getFlag(FlagBit bit) const
     return flags & (1<<bit);
 }
 
-uint32_t SbmsData::decompress(const char *data, uint16_t &offset, uint8_t size)
+const char *SbmsData::flagName(uint8_t bit)
 {
-    uint32_t xx=0;
-    uint32_t expF = 1;
-    for (uint8_t z=0; z<size; z++)
+    //in the order of FlagBit
+    static const char *const NAMES[NUM_FLAGS] = {
+        "OV", "OVLK", "UV", "UVLK", "IOT", "COC", "DOC", "DSC", "CELF", "OPEN", "LVC", "ECCF", "CFET", "EOC", "DFET"
+    };
+    return bit < NUM_FLAGS ? NAMES[bit] : "";
+}
+
+void SbmsData::cellRange(uint16_t &minMV, uint16_t &maxMV) const
+{
+    minMV = -1;
+    maxMV = 0;
+
+    for(uint8_t i=0; i<8; i++)
     {
-        xx = xx + ((data[(offset+size-1)-z]-35)*expF);
-        expF *= 91; //increase exponent for next character
+        uint16_t v = cellVoltageMV[i];
+        if(v > 0 && v < minMV) minMV = v;
+        if(v > 0 && v > maxMV) maxMV = v;
     }
-    offset += size;
-    return xx;
-}
\ No newline at end of file
+
+    if(maxMV == 0) minMV = 0;
+}
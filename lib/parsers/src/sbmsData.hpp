@@ -3,31 +3,17 @@
 
 #include <WString.h>
 
-class SbmsData {
+#include "sbmsDecode.hpp"
+
+//the fields are decoded by the reference decoder in lib/sbmsDecode
+class SbmsData : public SbmsRecord {
 
 public:
-    SbmsData(String data);
-
-    uint16_t year;
-    uint8_t month;
-    uint8_t day;
-    uint8_t hour;
-    uint8_t minute;
-    uint8_t second;
-    uint8_t stateOfChargePercent;
-    uint16_t cellVoltageMV[8];
-    int16_t temperatureInternalTenthC;
-    int16_t temperatureExternalTenthC;
-    int32_t batteryCurrentMA;
-    uint32_t pv1CurrentMA;
-    uint32_t pv2CurrentMA;
-    uint32_t extLoadCurrentMA;
-    uint32_t ad2;
-    uint32_t ad3;
-    uint32_t ad4;
-    uint16_t heat1;
-    uint16_t heat2;
-    uint16_t flags;
+    //decodes the content of the sbms variable, including the enclosing quotation marks
+    SbmsData(const char *data);
+
+    //checks length and alphabet of the content of the sbms variable. Catches frames that lost or gained characters on the wire.
+    static bool isValid(const char *data);
 
     enum FlagBit {
         OV = 0,
@@ -47,14 +33,15 @@ public:
         DFET = 14
     };
 
-    bool getFlag(FlagBit bit) const;
+    static const uint8_t NUM_FLAGS = 15;
 
+    bool getFlag(FlagBit bit) const;
 
-protected:
-
-    //decompresses the specified value, moves offset along by the given size
-    uint32_t decompress(const char *data, uint16_t &offset, uint8_t size);
+    //name of a flag bit as in the JSON frame, e.g. "DOC"
+    static const char *flagName(uint8_t bit);
 
+    //lowest and highest cell voltage, unused cells (0 mV) are ignored. Both are 0 if no cell is in use.
+    void cellRange(uint16_t &minMV, uint16_t &maxMV) const;
 
 };
 
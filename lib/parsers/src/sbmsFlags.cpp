@@ -0,0 +1,54 @@
+#include "sbmsFlags.hpp"
+
+#include <stdio.h>
+
+SbmsFlagWatch::SbmsFlagWatch()
+    : mValid(false)
+    , mFlags(0)
+    , mSet(0)
+    , mCleared(0)
+{
+}
+
+bool SbmsFlagWatch::update(uint16_t flags)
+{
+    uint16_t previous = mValid ? mFlags & ALARM_MASK : 0;
+    uint16_t current = flags & ALARM_MASK;
+    bool first = !mValid;
+
+    mSet = current & ~previous;
+    mCleared = previous & ~current;
+    mFlags = flags;
+    mValid = true;
+
+    return first || mSet || mCleared;
+}
+
+//appends "key":["name",...] with the names of the bits
+static size_t appendNames(char *buf, size_t bufLen, size_t len, const char *key, uint16_t bits)
+{
+    if(len < bufLen) len += snprintf(buf + len, bufLen - len, "\"%s\":[", key);
+
+    bool first = true;
+    for(uint8_t i=0; i<SbmsData::NUM_FLAGS && len < bufLen; i++)
+    {
+        if(!(bits & (1 << i))) continue;
+        len += snprintf(buf + len, bufLen - len, "%s\"%s\"", first ? "" : ",", SbmsData::flagName(i));
+        first = false;
+    }
+
+    if(len < bufLen) len += snprintf(buf + len, bufLen - len, "],");
+    return len;
+}
+
+size_t SbmsFlagWatch::toJson(char *buf, size_t bufLen) const
+{
+    if(bufLen == 0) return 0;
+
+    size_t len = snprintf(buf, bufLen, "{");
+    len = appendNames(buf, bufLen, len, "active", active());
+    len = appendNames(buf, bufLen, len, "set", mSet);
+    len = appendNames(buf, bufLen, len, "cleared", mCleared);
+    if(len < bufLen) len += snprintf(buf + len, bufLen - len, "\"flags\":%u}", mFlags);
+    return len;
+}
@@ -0,0 +1,41 @@
+#ifndef SBMS_FLAGS_H
+#define SBMS_FLAGS_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "sbmsData.hpp"
+
+//Detects transitions of the protection flags from one frame to the next, so they can be published on their own, ahead of
+//the regular telemetry.
+class SbmsFlagWatch {
+
+public:
+    //every flag except the FET states and end of charge, which change in normal operation and are left to the frames
+    static const uint16_t ALARM_MASK = ((1 << SbmsData::NUM_FLAGS) - 1) & ~((1 << SbmsData::CFET) | (1 << SbmsData::EOC) | (1 << SbmsData::DFET));
+
+    SbmsFlagWatch();
+
+    //compares the flags of a frame with the previous ones. Returns true if a flag of ALARM_MASK changed, and for the first frame.
+    bool update(uint16_t flags);
+
+    //forgets the previous flags, the next frame counts as a transition
+    void reset() { mValid = false; }
+
+    //alarm flags of the last frame, and the ones set and cleared by it
+    uint16_t active() const { return mFlags & ALARM_MASK; }
+    uint16_t set() const { return mSet; }
+    uint16_t cleared() const { return mCleared; }
+
+    //{"active":["DOC"],"set":["DOC"],"cleared":[],"flags":64} with the names of the alarm flags and all flags of the last frame.
+    //Returns the length, like snprintf.
+    size_t toJson(char *buf, size_t bufLen) const;
+
+private:
+    bool mValid;
+    uint16_t mFlags;
+    uint16_t mSet;
+    uint16_t mCleared;
+};
+
+#endif
@@ -0,0 +1,51 @@
+#include "sbmsInflux.hpp"
+
+#include <stdarg.h>
+#include <stdio.h>
+
+//appends at position n, keeps counting once the buffer is full
+static size_t append(char *buf, size_t len, size_t n, const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    n += vsnprintf(buf + (n < len ? n : len), n < len ? len - n : 0, format, args);
+    va_end(args);
+    return n;
+}
+
+//tag values escape commas, spaces and equal signs
+static void escapeTag(const char *value, char *buf, size_t len)
+{
+    size_t n = 0;
+    for(const char *c = value; *c && n + 2 < len; c++)
+    {
+        if(*c == ',' || *c == ' ' || *c == '=') buf[n++] = '\\';
+        buf[n++] = *c;
+    }
+    buf[n] = 0;
+}
+
+size_t toInfluxSBMS(const SbmsData &sbms, const char *measurement, uint8_t source, const char *name, uint64_t timeNs, char *buf, size_t len)
+{
+    char tag[64] = "";
+    if(name && name[0]) escapeTag(name, tag, sizeof(tag));
+
+    uint16_t minMV, maxMV;
+    sbms.cellRange(minMV, maxMV);
+
+    size_t n = append(buf, len, 0, "%s,source=%u%s%s soc=%ui", measurement, source, tag[0] ? ",name=" : "", tag, sbms.stateOfChargePercent);
+
+    for(uint8_t i=0; i<8; i++)
+    {
+        n = append(buf, len, n, ",cell%u=%ui", i + 1, sbms.cellVoltageMV[i]);
+    }
+
+    n = append(buf, len, n, ",delta=%ui,tempInt=%.1f,tempExt=%.1f,battery=%di,pv1=%ui,pv2=%ui,extLoad=%ui,flags=%ui",
+        maxMV - minMV, sbms.temperatureInternalTenthC / 10.0, sbms.temperatureExternalTenthC / 10.0,
+        (int)sbms.batteryCurrentMA, (unsigned)sbms.pv1CurrentMA, (unsigned)sbms.pv2CurrentMA, (unsigned)sbms.extLoadCurrentMA, sbms.flags);
+
+    if(timeNs) n = append(buf, len, n, " %llu\n", (unsigned long long)timeNs);
+    else n = append(buf, len, n, "\n");
+
+    return n;
+}
@@ -0,0 +1,12 @@
+#ifndef SBMS_INFLUX_H
+#define SBMS_INFLUX_H
+
+#include "sbmsData.hpp"
+
+//renders a decoded sbms frame as one line of InfluxDB line protocol, terminated by a newline:
+//  <measurement>,source=<n>[,name=<name>] soc=..i,cell1=..i,...,cell8=..i,delta=..i,tempInt=..,tempExt=..,battery=..i,pv1=..i,pv2=..i,extLoad=..i,flags=..i [time]
+//Voltages in mV, currents in mA, temperatures in °C. The timestamp in ns is left out if 0, the server uses its own time then.
+//Returns the length of the line like snprintf, it is only complete if that is less than len.
+size_t toInfluxSBMS(const SbmsData &sbms, const char *measurement, uint8_t source, const char *name, uint64_t timeNs, char *buf, size_t len);
+
+#endif
@@ -0,0 +1,70 @@
+#include "sbmsJson.hpp"
+
+static StaticJsonDocument<SBMS_JSON_CAPACITY> docSBMS; //13 is the root element
+
+JsonDocument *toJsonSBMS(const SbmsData &sbms, bool delta)
+{
+    docSBMS.clear();
+
+    docSBMS["time"]["year"] = sbms.year;
+    docSBMS["time"]["month"] = sbms.month;
+    docSBMS["time"]["day"] = sbms.day;
+    docSBMS["time"]["hour"] = sbms.hour;
+    docSBMS["time"]["minute"] = sbms.minute;
+    docSBMS["time"]["second"] = sbms.second;
+
+    docSBMS["soc"] = sbms.stateOfChargePercent;
+
+    JsonArray volt = docSBMS.createNestedArray("cellsMV");
+    for(uint8_t i=0; i<8; i++)
+    {
+        volt.add(sbms.cellVoltageMV[i]);
+    }
+
+    docSBMS["tempInt"] = sbms.temperatureInternalTenthC / 10.0;
+    docSBMS["tempExt"] = sbms.temperatureExternalTenthC / 10.0;
+
+    JsonObject curr = docSBMS.createNestedObject("currentMA");
+
+    curr["battery"] = sbms.batteryCurrentMA;
+    curr["pv1"] = sbms.pv1CurrentMA;
+    curr["pv2"] = sbms.pv2CurrentMA;
+    curr["extLoad"] = sbms.extLoadCurrentMA;
+
+    docSBMS["ad2"] = sbms.ad2;
+    docSBMS["ad3"] = sbms.ad3;
+    docSBMS["ad4"] = sbms.ad4;
+
+    docSBMS["heat1"] = sbms.heat1;
+    docSBMS["heat2"] = sbms.heat2;
+
+    JsonObject flags = docSBMS.createNestedObject("flags");
+
+    flags["OV"] = sbms.getFlag(SbmsData::FlagBit::OV);
+    flags["OVLK"] = sbms.getFlag(SbmsData::FlagBit::OVLK);
+    flags["UV"] = sbms.getFlag(SbmsData::FlagBit::UV);
+    flags["UVLK"] = sbms.getFlag(SbmsData::FlagBit::UVLK);
+    flags["IOT"] = sbms.getFlag(SbmsData::FlagBit::IOT);
+    flags["COC"] = sbms.getFlag(SbmsData::FlagBit::COC);
+    flags["DOC"] = sbms.getFlag(SbmsData::FlagBit::DOC);
+    flags["DSC"] = sbms.getFlag(SbmsData::FlagBit::DSC);
+    flags["CELF"] = sbms.getFlag(SbmsData::FlagBit::CELF);
+    flags["OPEN"] = sbms.getFlag(SbmsData::FlagBit::OPEN);
+    flags["LVC"] = sbms.getFlag(SbmsData::FlagBit::LVC);
+    flags["ECCF"] = sbms.getFlag(SbmsData::FlagBit::ECCF);
+    flags["CFET"] = sbms.getFlag(SbmsData::FlagBit::CFET);
+    flags["EOC"] = sbms.getFlag(SbmsData::FlagBit::EOC);
+    flags["DFET"] = sbms.getFlag(SbmsData::FlagBit::DFET);
+
+    //optional calculated fields
+
+    if(delta)
+    {
+        uint16_t min, max;
+        sbms.cellRange(min, max);
+
+        flags["delta"] = max-min;
+    }
+
+    return &docSBMS;
+}
@@ -0,0 +1,15 @@
+#ifndef SBMS_JSON_H
+#define SBMS_JSON_H
+
+#include <ArduinoJson.h>
+
+#include "sbmsData.hpp"
+
+//capacity of the static document, calculated by https://arduinojson.org/v6/assistant/
+#define SBMS_JSON_CAPACITY (JSON_ARRAY_SIZE(8) + JSON_OBJECT_SIZE(4) + JSON_OBJECT_SIZE(6) + JSON_OBJECT_SIZE(13) + JSON_OBJECT_SIZE(15))
+
+//fills a static document with a decoded sbms frame and returns it. The document is reused by every call.
+//With delta set, the difference between the highest and the lowest cell voltage is added to the flags.
+JsonDocument *toJsonSBMS(const SbmsData &sbms, bool delta);
+
+#endif
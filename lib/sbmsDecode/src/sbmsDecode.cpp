@@ -0,0 +1,205 @@
+#include "sbmsDecode.hpp"
+
+#include <stdio.h>
+#include <string.h>
+
+//position of the most significant base91 digit and number of digits of each field, in the order of SbmsRecord
+struct Field {
+    uint8_t pos;
+    uint8_t digits;
+};
+
+enum FieldIndex {
+    F_YEAR = 0, F_MONTH, F_DAY, F_HOUR, F_MINUTE, F_SECOND,
+    F_SOC,
+    F_CELL1, //8 cells
+    F_TEMP_INT = F_CELL1 + 8, F_TEMP_EXT,
+    F_BATTERY, F_PV1, F_PV2, F_EXT_LOAD, F_AD2, F_AD3, F_AD4, F_HEAT1, F_HEAT2, F_FLAGS,
+    NUM_FIELDS
+};
+
+static const Field FIELDS[NUM_FIELDS] = {
+    {1, 1}, {2, 1}, {3, 1}, {4, 1}, {5, 1}, {6, 1},
+    {7, 2},
+    {9, 2}, {11, 2}, {13, 2}, {15, 2}, {17, 2}, {19, 2}, {21, 2}, {23, 2},
+    {25, 2}, {27, 2},
+    //the sign of the battery current is at SBMS_SIGN_POS
+    {30, 3}, {33, 3}, {36, 3}, {39, 3}, {42, 3}, {45, 3}, {48, 3}, {51, 3}, {54, 3}, {57, 3}
+};
+
+//unescapes "\\" into row, which is padded with the base91 zero digit. Returns the unescaped length of the whole input.
+static size_t unescape(const char *data, size_t len, char *row)
+{
+    if(!memchr(data, '\\', len)) //most frames contain no backslash
+    {
+        size_t n = strnlen(data, len);
+        memcpy(row, data, n < SBMS_FRAME_LEN ? n : SBMS_FRAME_LEN);
+        if(n < SBMS_FRAME_LEN) memset(row + n, '#', SBMS_FRAME_LEN - n);
+        return n;
+    }
+
+    size_t n = 0;
+    for(size_t i=0; i<len && data[i]; i++)
+    {
+        if(data[i] == '\\' && i + 1 < len && data[i+1] == '\\') i++;
+        if(n < SBMS_FRAME_LEN) row[n] = data[i];
+        n++;
+    }
+    if(n < SBMS_FRAME_LEN) memset(row + n, '#', SBMS_FRAME_LEN - n);
+    return n;
+}
+
+static bool checkRow(const char *row, size_t len)
+{
+    if(len != SBMS_FRAME_LEN) return false;
+    if(row[0] != '\"' || row[SBMS_FRAME_LEN - 1] != '\"') return false;
+
+    for(uint16_t i=1; i<SBMS_FRAME_LEN - 1; i++)
+    {
+        if(i != SBMS_SIGN_POS && (row[i] < '#' || row[i] > '}')) return false; //outside of the base91 alphabet
+    }
+    return true;
+}
+
+static inline uint8_t digit(char c)
+{
+    return (uint8_t)(c - '#');
+}
+
+//values[field * stride] holds the decoded fields
+static void assign(const uint32_t *values, size_t stride, bool negative, SbmsRecord &record)
+{
+    #define V(field) values[(field) * stride]
+    record.year = V(F_YEAR);
+    record.month = V(F_MONTH);
+    record.day = V(F_DAY);
+    record.hour = V(F_HOUR);
+    record.minute = V(F_MINUTE);
+    record.second = V(F_SECOND);
+    record.stateOfChargePercent = V(F_SOC);
+
+    for(uint8_t i=0; i<8; i++)
+    {
+        record.cellVoltageMV[i] = V(F_CELL1 + i);
+    }
+
+    record.temperatureInternalTenthC = V(F_TEMP_INT) - 450;
+    record.temperatureExternalTenthC = V(F_TEMP_EXT) - 450;
+    record.batteryCurrentMA = negative ? -(int32_t)V(F_BATTERY) : (int32_t)V(F_BATTERY);
+    record.pv1CurrentMA = V(F_PV1);
+    record.pv2CurrentMA = V(F_PV2);
+    record.extLoadCurrentMA = V(F_EXT_LOAD);
+    record.ad2 = V(F_AD2);
+    record.ad3 = V(F_AD3);
+    record.ad4 = V(F_AD4);
+    record.heat1 = V(F_HEAT1);
+    record.heat2 = V(F_HEAT2);
+    record.flags = V(F_FLAGS);
+    #undef V
+}
+
+bool sbmsIsValid(const char *data, size_t len)
+{
+    char row[SBMS_FRAME_LEN];
+    return checkRow(row, unescape(data, len, row));
+}
+
+void sbmsDecode(const char *data, size_t len, SbmsRecord &record)
+{
+    char row[SBMS_FRAME_LEN];
+    unescape(data, len, row);
+
+    uint32_t values[NUM_FIELDS];
+    for(uint8_t k=0; k<NUM_FIELDS; k++)
+    {
+        //most significant digit first
+        uint32_t v = 0;
+        for(uint8_t d=0; d<FIELDS[k].digits; d++) v = v * 91 + digit(row[FIELDS[k].pos + d]);
+        values[k] = v;
+    }
+
+    assign(values, 1, row[SBMS_SIGN_POS] == '-', record);
+}
+
+void sbmsDecodeBatch(const char *const *frames, const size_t *lens, size_t count, SbmsRecord *records, bool *valid)
+{
+    //one row per character position, one column per frame
+    uint8_t digits[SBMS_FRAME_LEN][SBMS_BATCH_BLOCK];
+    uint32_t values[NUM_FIELDS][SBMS_BATCH_BLOCK];
+    bool negative[SBMS_BATCH_BLOCK];
+
+    for(size_t base=0; base<count; base+=SBMS_BATCH_BLOCK)
+    {
+        size_t n = count - base < SBMS_BATCH_BLOCK ? count - base : SBMS_BATCH_BLOCK;
+        if(n < SBMS_BATCH_BLOCK) memset(digits, 0, sizeof(digits)); //the loops always run over the whole block
+
+        //transpose
+        for(size_t f=0; f<n; f++)
+        {
+            char row[SBMS_FRAME_LEN];
+            size_t len = unescape(frames[base + f], lens[base + f], row);
+            if(valid) valid[base + f] = checkRow(row, len);
+            negative[f] = row[SBMS_SIGN_POS] == '-';
+
+            for(uint16_t p=0; p<SBMS_FRAME_LEN; p++) digits[p][f] = digit(row[p]);
+        }
+
+        //the same steps for all frames of the block, no branches
+        for(uint8_t k=0; k<NUM_FIELDS; k++)
+        {
+            uint32_t *out = values[k];
+            for(size_t f=0; f<SBMS_BATCH_BLOCK; f++) out[f] = 0;
+
+            for(uint8_t d=0; d<FIELDS[k].digits; d++)
+            {
+                const uint8_t *column = digits[FIELDS[k].pos + d];
+                for(size_t f=0; f<SBMS_BATCH_BLOCK; f++) out[f] = out[f] * 91 + column[f];
+            }
+        }
+
+        for(size_t f=0; f<n; f++) assign(&values[0][f], SBMS_BATCH_BLOCK, negative[f], records[base + f]);
+    }
+}
+
+size_t sbmsFormatRaw(char *buf, size_t bufLen, uint16_t seq, uint64_t timeMs, const char *content, size_t length)
+{
+    int header = snprintf(buf, bufLen, "%u %llu ", seq, (unsigned long long)timeMs);
+    if(header < 0) return 0;
+
+    size_t n = header;
+    if(n < bufLen)
+    {
+        size_t copy = length < bufLen - n - 1 ? length : bufLen - n - 1;
+        memcpy(buf + n, content, copy);
+        buf[n + copy] = 0;
+    }
+    return n + length;
+}
+
+//parses a decimal number followed by a space, moves pos behind the space
+static bool parseNumber(const char *message, size_t len, size_t &pos, uint64_t &value)
+{
+    size_t start = pos;
+    value = 0;
+    while(pos < len && message[pos] >= '0' && message[pos] <= '9' && pos - start < 20)
+    {
+        value = value * 10 + (message[pos] - '0');
+        pos++;
+    }
+    if(pos == start || pos >= len || message[pos] != ' ') return false;
+    pos++;
+    return true;
+}
+
+bool sbmsParseRaw(const char *message, size_t len, SbmsRaw &raw)
+{
+    size_t pos = 0;
+    uint64_t seq;
+    if(!parseNumber(message, len, pos, seq) || seq > 0xFFFF) return false;
+    if(!parseNumber(message, len, pos, raw.timeMs)) return false;
+
+    raw.seq = seq;
+    raw.content = message + pos;
+    raw.length = len - pos;
+    return raw.length > 0;
+}
@@ -0,0 +1,73 @@
+#ifndef SBMS_DECODE_H
+#define SBMS_DECODE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+//Reference decoder of the sbms frame and of the raw messages published in passthrough mode.
+//Plain C++ without Arduino dependencies, so servers can build it as is. SbmsData of lib/parsers decodes with it as well.
+
+//decoded sbms frame, see SbmsData for the meaning of the flags
+struct SbmsRecord {
+    uint16_t year;
+    uint8_t month;
+    uint8_t day;
+    uint8_t hour;
+    uint8_t minute;
+    uint8_t second;
+    uint8_t stateOfChargePercent;
+    uint16_t cellVoltageMV[8];
+    int16_t temperatureInternalTenthC;
+    int16_t temperatureExternalTenthC;
+    int32_t batteryCurrentMA;
+    uint32_t pv1CurrentMA;
+    uint32_t pv2CurrentMA;
+    uint32_t extLoadCurrentMA;
+    uint32_t ad2;
+    uint32_t ad3;
+    uint32_t ad4;
+    uint16_t heat1;
+    uint16_t heat2;
+    uint16_t flags;
+};
+
+//length of an unescaped frame including the quotation marks, and the position of the sign of the battery current
+static const uint16_t SBMS_FRAME_LEN = 61;
+static const uint16_t SBMS_SIGN_POS = 29;
+
+//checks length and alphabet of the content of the sbms variable, including the enclosing quotation marks and the
+//escaping of the backslash. Catches frames that lost or gained characters on the wire.
+bool sbmsIsValid(const char *data, size_t len);
+
+//decodes the content of the sbms variable. Short or truncated input decodes to zero for the missing digits, check with
+//sbmsIsValid first.
+void sbmsDecode(const char *data, size_t len, SbmsRecord &record);
+
+//frames decoded together by sbmsDecodeBatch
+static const size_t SBMS_BATCH_BLOCK = 64;
+
+//decodes count frames into records and sets valid[i] (if given) to the result of sbmsIsValid. Same result as sbmsDecode,
+//but the frames are transposed in blocks of SBMS_BATCH_BLOCK so every field is decoded for the whole block in one loop
+//without branches, which the compiler vectorizes (-O3, SSE2/AVX2/NEON). Meant for servers decoding in bulk, it needs about
+//11 KB of stack.
+void sbmsDecodeBatch(const char *const *frames, const size_t *lens, size_t count, SbmsRecord *records, bool *valid = nullptr);
+
+//raw message of the passthrough mode: "<seq> <time> <content>", the content exactly as sent by the sbms.
+//The time is in ms since the epoch, or since boot (below SBMS_RAW_EPOCH_MIN) if the clock was not set.
+struct SbmsRaw {
+    uint16_t seq; //sequence number of the variable, a gap means values were replaced before they could be sent
+    uint64_t timeMs; //when the line was received
+    const char *content; //points into the message, not terminated
+    size_t length;
+};
+
+//times below are uptimes, 2001-09-09 in ms since the epoch
+static const uint64_t SBMS_RAW_EPOCH_MIN = 1000000000000ull;
+
+//formats a raw message into buf like snprintf: returns the full length, the message is complete if it is below bufLen
+size_t sbmsFormatRaw(char *buf, size_t bufLen, uint16_t seq, uint64_t timeMs, const char *content, size_t length);
+
+//splits a raw message, returns false if it is malformed
+bool sbmsParseRaw(const char *message, size_t len, SbmsRaw &raw);
+
+#endif
@@ -0,0 +1,466 @@
+#include "tlsClient.hpp"
+
+#include <WiFi.h>
+
+#include <lwip/sockets.h>
+
+#include "mbedtls/error.h"
+#include "mbedtls/sha256.h"
+
+TlsClient::TlsClient() : mSeeded(false), mHasCa(false), mHasPin(false), mHasSession(false), mSessionPort(0), mCertsVerified(0), mPinMatched(false), mConnected(false), mPeeked(-1)
+{
+    mbedtls_ssl_init(&mSsl);
+    mbedtls_ssl_config_init(&mConf);
+    mbedtls_x509_crt_init(&mCa);
+    mbedtls_entropy_init(&mEntropy);
+    mbedtls_ctr_drbg_init(&mDrbg);
+    mbedtls_net_init(&mNet);
+    mbedtls_ssl_session_init(&mSession);
+
+    memset(mPin, 0, sizeof(mPin));
+    mSessionHost[0] = 0;
+    memset(&mStats, 0, sizeof(mStats));
+}
+
+TlsClient::~TlsClient()
+{
+    stop();
+    mbedtls_ssl_session_free(&mSession);
+    mbedtls_x509_crt_free(&mCa);
+    mbedtls_ctr_drbg_free(&mDrbg);
+    mbedtls_entropy_free(&mEntropy);
+}
+
+bool TlsClient::setCACert(const char *pem, size_t len)
+{
+    mbedtls_x509_crt_free(&mCa);
+    mbedtls_x509_crt_init(&mCa);
+    mHasCa = false;
+
+    if(!pem || len == 0) return true;
+
+    int ret = mbedtls_x509_crt_parse(&mCa, (const unsigned char*)pem, len);
+    if(ret != 0)
+    {
+        fail(ret, "CA certificate");
+        mbedtls_x509_crt_free(&mCa);
+        mbedtls_x509_crt_init(&mCa);
+        return false;
+    }
+
+    mHasCa = true;
+    clearSession(); //verified against another CA
+    return true;
+}
+
+bool TlsClient::setFingerprint(const char *hex)
+{
+    mHasPin = false;
+    if(!hex || !hex[0]) return true;
+
+    uint8_t pin[32];
+    uint8_t n = 0;
+    for(const char *c = hex; *c; c++)
+    {
+        if(*c == ':' || *c == ' ') continue;
+
+        int v;
+        if(*c >= '0' && *c <= '9') v = *c - '0';
+        else if(*c >= 'a' && *c <= 'f') v = *c - 'a' + 10;
+        else if(*c >= 'A' && *c <= 'F') v = *c - 'A' + 10;
+        else return false;
+
+        if(n >= 64) return false;
+        if(n % 2 == 0) pin[n / 2] = v << 4;
+        else pin[n / 2] |= v;
+        n++;
+    }
+    if(n != 64) return false;
+
+    memcpy(mPin, pin, sizeof(mPin));
+    mHasPin = true;
+    clearSession();
+    return true;
+}
+
+void TlsClient::clearSession()
+{
+    mbedtls_ssl_session_free(&mSession);
+    mbedtls_ssl_session_init(&mSession);
+    mHasSession = false;
+}
+
+//called by mbedtls for every certificate of the chain, the server certificate last (depth 0)
+int TlsClient::verify(void *arg, mbedtls_x509_crt *crt, int depth, uint32_t *flags)
+{
+    TlsClient &client = *(TlsClient*)arg;
+    client.mCertsVerified++;
+
+    if(!client.mHasPin) return 0; //flags from the CA verification stand
+
+    if(depth == 0)
+    {
+        uint8_t digest[32];
+        mbedtls_sha256_ret(crt->raw.p, crt->raw.len, digest, 0);
+        client.mPinMatched = memcmp(digest, client.mPin, sizeof(digest)) == 0;
+
+        //a matching pin is enough on its own, without a CA only the pin counts
+        if(client.mPinMatched && !client.mHasCa) *flags = 0;
+        else if(!client.mPinMatched) *flags |= MBEDTLS_X509_BADCERT_OTHER;
+    }
+    else if(!client.mHasCa)
+    {
+        *flags = 0; //the chain can't be checked without a CA, the pin decides
+    }
+    return 0;
+}
+
+bool TlsClient::isName(const char *host)
+{
+    IPAddress literal;
+    return host && host[0] && !literal.fromString(host);
+}
+
+void TlsClient::fail(int error, const char *what)
+{
+    mStats.lastError = error;
+    char reason[48] = "";
+    if(error < 0) mbedtls_strerror(error, reason, sizeof(reason));
+    snprintf(mStats.error, sizeof(mStats.error), "%s%s%s", what, reason[0] ? ": " : "", reason);
+}
+
+int TlsClient::connect(IPAddress ip, uint16_t port)
+{
+    return connect(ip, nullptr, port);
+}
+
+int TlsClient::connect(const char *host, uint16_t port)
+{
+    IPAddress ip;
+    if(!WiFi.hostByName(host, ip))
+    {
+        mStats.connects++;
+        mStats.failures++;
+        fail(0, "DNS lookup failed");
+        return 0;
+    }
+    return connect(ip, host, port);
+}
+
+int TlsClient::connect(IPAddress ip, const char *host, uint16_t port)
+{
+    stop();
+    mStats.connects++;
+
+    if(!mHasCa && !mHasPin)
+    {
+        mStats.failures++;
+        fail(0, "no CA certificate or fingerprint");
+        return 0;
+    }
+
+    //mbedtls only matches names against the certificate, not IP addresses. A CA alone would accept any of its certificates.
+    if(!mHasPin && !isName(host))
+    {
+        mStats.failures++;
+        fail(0, "an IP address needs a fingerprint");
+        return 0;
+    }
+
+    //tcp connection with timeout
+    int fd = ::lwip_socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if(fd < 0)
+    {
+        mStats.failures++;
+        fail(0, "no socket");
+        return 0;
+    }
+    mNet.fd = fd;
+    mbedtls_net_set_nonblock(&mNet);
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = (uint32_t)ip;
+    addr.sin_port = htons(port);
+
+    int ret = ::lwip_connect(fd, (struct sockaddr*)&addr, sizeof(addr));
+    if(ret < 0 && errno == EINPROGRESS)
+    {
+        fd_set fdset;
+        FD_ZERO(&fdset);
+        FD_SET(fd, &fdset);
+        struct timeval tv = {CONNECT_TIMEOUT_MS / 1000, (CONNECT_TIMEOUT_MS % 1000) * 1000};
+        ret = ::lwip_select(fd + 1, nullptr, &fdset, nullptr, &tv) == 1 ? 0 : -1;
+
+        int error = 0;
+        socklen_t len = sizeof(error);
+        if(ret == 0 && (::lwip_getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &len) < 0 || error != 0)) ret = -1;
+    }
+    if(ret < 0)
+    {
+        mStats.failures++;
+        fail(0, "connection failed");
+        stop();
+        return 0;
+    }
+
+    if(!handshake(host, port))
+    {
+        mStats.failures++;
+        stop();
+        return 0;
+    }
+
+    mConnected = true;
+    return 1;
+}
+
+bool TlsClient::handshake(const char *host, uint16_t port)
+{
+    int ret;
+
+    if(!mSeeded)
+    {
+        ret = mbedtls_ctr_drbg_seed(&mDrbg, mbedtls_entropy_func, &mEntropy, nullptr, 0);
+        if(ret != 0)
+        {
+            fail(ret, "seed");
+            return false;
+        }
+
+        ret = mbedtls_ssl_config_defaults(&mConf, MBEDTLS_SSL_IS_CLIENT, MBEDTLS_SSL_TRANSPORT_STREAM, MBEDTLS_SSL_PRESET_DEFAULT);
+        if(ret != 0)
+        {
+            fail(ret, "config");
+            return false;
+        }
+        mbedtls_ssl_conf_rng(&mConf, mbedtls_ctr_drbg_random, &mDrbg);
+        mbedtls_ssl_conf_verify(&mConf, verify, this);
+        mSeeded = true;
+    }
+
+    //without a CA the chain can't be verified, verify() accepts the certificate by its pin
+    mbedtls_ssl_conf_authmode(&mConf, mHasCa ? MBEDTLS_SSL_VERIFY_REQUIRED : MBEDTLS_SSL_VERIFY_OPTIONAL);
+    mbedtls_ssl_conf_ca_chain(&mConf, mHasCa ? &mCa : nullptr, nullptr);
+
+    mbedtls_ssl_init(&mSsl);
+    ret = mbedtls_ssl_setup(&mSsl, &mConf);
+    //the name is checked against the certificate, an IP address is covered by the pin
+    if(ret == 0 && isName(host)) ret = mbedtls_ssl_set_hostname(&mSsl, host);
+    if(ret != 0)
+    {
+        fail(ret, "setup");
+        return false;
+    }
+    mbedtls_ssl_set_bio(&mSsl, &mNet, mbedtls_net_send, mbedtls_net_recv, nullptr);
+
+    const char *sessionHost = host ? host : "";
+    bool offered = mHasSession && mSessionPort == port && strcmp(mSessionHost, sessionHost) == 0;
+    if(offered && mbedtls_ssl_set_session(&mSsl, &mSession) != 0) offered = false;
+
+    mCertsVerified = 0;
+    mPinMatched = false;
+
+    uint32_t start = millis();
+    while((ret = mbedtls_ssl_handshake(&mSsl)) != 0)
+    {
+        if(ret != MBEDTLS_ERR_SSL_WANT_READ && ret != MBEDTLS_ERR_SSL_WANT_WRITE)
+        {
+            fail(ret, mHasPin && mCertsVerified > 0 && !mPinMatched ? "fingerprint mismatch" : "handshake");
+            if(offered) clearSession(); //don't get stuck on a session the server does not like
+            return false;
+        }
+        if(millis() - start > HANDSHAKE_TIMEOUT_MS)
+        {
+            fail(0, "handshake timeout");
+            return false;
+        }
+        vTaskDelay(1); //waiting for the server, let others run
+    }
+    uint32_t elapsed = millis() - start;
+
+    //for a resumed session the result of its full handshake
+    uint32_t result = mbedtls_ssl_get_verify_result(&mSsl);
+    if(result != 0 || (mHasPin && mCertsVerified > 0 && !mPinMatched))
+    {
+        char reason[48];
+        mbedtls_x509_crt_verify_info(reason, sizeof(reason), "", result);
+        size_t len = strlen(reason);
+        if(len > 0 && reason[len - 1] == '\n') reason[len - 1] = 0;
+        fail(MBEDTLS_ERR_X509_CERT_VERIFY_FAILED, mPinMatched || !mHasPin ? reason : "fingerprint mismatch");
+        clearSession();
+        mStats.verified = false;
+        return false;
+    }
+
+    mStats.verified = true;
+    mStats.cipher = mbedtls_ssl_get_ciphersuite(&mSsl); //static string of the suite table
+    mStats.resumed = offered && mCertsVerified == 0; //no certificate exchanged
+    mStats.lastHandshakeMs = elapsed;
+    if(mStats.resumed)
+    {
+        mStats.resumedHandshakes++;
+        mStats.totalResumedMs += elapsed;
+    }
+    else
+    {
+        if(offered) mStats.resumeRejected++;
+        mStats.fullHandshakes++;
+        mStats.totalFullMs += elapsed;
+        if(elapsed > mStats.maxFullMs) mStats.maxFullMs = elapsed;
+    }
+
+    //keep the session for the next connect. With tickets, the server may hand out a new one later, so it is saved again on stop.
+    if(mbedtls_ssl_get_session(&mSsl, &mSession) == 0)
+    {
+        mHasSession = true;
+        snprintf(mSessionHost, sizeof(mSessionHost), "%s", sessionHost);
+        mSessionPort = port;
+    }
+
+    mStats.lastError = 0;
+    mStats.error[0] = 0;
+    return true;
+}
+
+size_t TlsClient::write(uint8_t b)
+{
+    return write(&b, 1);
+}
+
+size_t TlsClient::write(const uint8_t *buf, size_t size)
+{
+    if(!mConnected) return 0;
+
+    size_t written = 0;
+    uint32_t start = millis();
+    while(written < size)
+    {
+        int ret = mbedtls_ssl_write(&mSsl, buf + written, size - written);
+        if(ret > 0)
+        {
+            written += ret;
+            start = millis();
+        }
+        else if(ret != MBEDTLS_ERR_SSL_WANT_READ && ret != MBEDTLS_ERR_SSL_WANT_WRITE)
+        {
+            fail(ret, "write");
+            stop();
+            break;
+        }
+        else if(millis() - start > WRITE_TIMEOUT_MS)
+        {
+            fail(0, "write timeout");
+            stop();
+            break;
+        }
+        else
+        {
+            vTaskDelay(1);
+        }
+    }
+    return written;
+}
+
+int TlsClient::available()
+{
+    if(!mConnected) return 0;
+
+    //processes a pending record without blocking, the socket is non-blocking
+    int ret = mbedtls_ssl_read(&mSsl, nullptr, 0);
+    if(ret < 0 && ret != MBEDTLS_ERR_SSL_WANT_READ && ret != MBEDTLS_ERR_SSL_WANT_WRITE)
+    {
+        if(ret != MBEDTLS_ERR_SSL_PEER_CLOSE_NOTIFY) fail(ret, "read");
+        stop();
+        return 0;
+    }
+    return mbedtls_ssl_get_bytes_avail(&mSsl) + (mPeeked >= 0 ? 1 : 0);
+}
+
+int TlsClient::read()
+{
+    uint8_t b;
+    return read(&b, 1) == 1 ? b : -1;
+}
+
+int TlsClient::read(uint8_t *buf, size_t size)
+{
+    if(size == 0) return 0;
+
+    if(mPeeked >= 0)
+    {
+        buf[0] = mPeeked;
+        mPeeked = -1;
+        return 1;
+    }
+
+    if(!mConnected) return -1;
+
+    int ret = mbedtls_ssl_read(&mSsl, buf, size);
+    if(ret > 0) return ret;
+    if(ret == MBEDTLS_ERR_SSL_WANT_READ || ret == MBEDTLS_ERR_SSL_WANT_WRITE) return -1;
+
+    if(ret != 0 && ret != MBEDTLS_ERR_SSL_PEER_CLOSE_NOTIFY) fail(ret, "read");
+    stop();
+    return -1;
+}
+
+int TlsClient::peek()
+{
+    if(mPeeked < 0)
+    {
+        uint8_t b;
+        if(read(&b, 1) == 1) mPeeked = b;
+    }
+    return mPeeked;
+}
+
+void TlsClient::flush()
+{
+    //writes are not buffered
+}
+
+void TlsClient::stop()
+{
+    if(mConnected)
+    {
+        //with tickets, the latest one is the one to offer next time
+        if(mbedtls_ssl_get_session(&mSsl, &mSession) != 0) clearSession();
+        mbedtls_ssl_close_notify(&mSsl);
+    }
+    mConnected = false;
+    mPeeked = -1;
+
+    mbedtls_ssl_free(&mSsl); //also frees the record buffers while disconnected
+    mbedtls_ssl_init(&mSsl);
+    mbedtls_net_free(&mNet);
+}
+
+uint8_t TlsClient::connected()
+{
+    if(!mConnected) return 0;
+
+    //a closed socket reads 0
+    uint8_t b;
+    int ret = ::lwip_recv(mNet.fd, &b, 1, MSG_PEEK | MSG_DONTWAIT);
+    if(ret == 0 || (ret < 0 && errno != EWOULDBLOCK && errno != EAGAIN))
+    {
+        if(mbedtls_ssl_get_bytes_avail(&mSsl) > 0) return 1; //the rest can still be read
+        fail(0, "connection closed");
+        stop();
+    }
+    return mConnected;
+}
+
+size_t TlsClient::statsJson(char *buf, size_t bufLen) const
+{
+    Stats s = mStats;
+    return snprintf(buf, bufLen, "{\"connects\":%u,\"full\":%u,\"resumed\":%u,\"resumeRejected\":%u,\"failures\":%u,\"lastHandshakeMs\":%u,"
+                                 "\"avgFullMs\":%u,\"maxFullMs\":%u,\"avgResumedMs\":%u,\"verified\":%s,\"resumedNow\":%s,\"session\":%s,"
+                                 "\"ca\":%s,\"pinned\":%s,\"cipher\":\"%s\",\"lastError\":%d,\"error\":\"%s\"}",
+        s.connects, s.fullHandshakes, s.resumedHandshakes, s.resumeRejected, s.failures, s.lastHandshakeMs,
+        s.fullHandshakes ? s.totalFullMs / s.fullHandshakes : 0, s.maxFullMs, s.resumedHandshakes ? s.totalResumedMs / s.resumedHandshakes : 0,
+        s.verified ? "true" : "false", s.resumed ? "true" : "false", mHasSession ? "true" : "false", mHasCa ? "true" : "false", mHasPin ? "true" : "false",
+        s.cipher ? s.cipher : "", s.lastError, s.error);
+}
@@ -0,0 +1,118 @@
+#ifndef TLSCLIENT_H
+#define TLSCLIENT_H
+
+#include <Arduino.h>
+#include <Client.h>
+
+#include "mbedtls/ssl.h"
+#include "mbedtls/x509_crt.h"
+#include "mbedtls/entropy.h"
+#include "mbedtls/ctr_drbg.h"
+#include "mbedtls/net_sockets.h"
+
+//TLS client on mbedtls, a drop-in for WiFiClient (e.g. for PubSubClient).
+//The session of the last connection is kept and offered again on the next connect to the same host. If the server accepts it
+//(session ID or session ticket, whatever it supports), the reconnect is an abbreviated handshake without certificates and
+//public key operations: tens of milliseconds instead of seconds of CPU.
+//The server is verified against a CA certificate, the pinned SHA-256 fingerprint of its certificate, or both. Without either,
+//connect refuses to connect. The CA only checks a host name: a server given by its IP address needs the fingerprint.
+class TlsClient : public Client {
+
+public:
+    static const uint32_t CONNECT_TIMEOUT_MS = 5000;
+    static const uint32_t HANDSHAKE_TIMEOUT_MS = 15000;
+
+    //a write that can't get rid of its data for this long closes the connection
+    static const uint32_t WRITE_TIMEOUT_MS = 5000;
+
+    struct Stats {
+        uint32_t connects; //attempts
+        uint32_t fullHandshakes;
+        uint32_t resumedHandshakes;
+        uint32_t resumeRejected; //a session was offered, but the server wanted a full handshake
+        uint32_t failures; //connection, handshake or verification failed
+        uint32_t lastHandshakeMs;
+        uint32_t maxFullMs;
+        uint32_t totalFullMs;
+        uint32_t totalResumedMs;
+        bool verified; //the current or last connection passed verification
+        bool resumed; //the current or last connection was resumed
+        const char *cipher; //suite of the current or last connection, nullptr before the first
+        int lastError; //mbedtls error code, 0 if none
+        char error[64];
+    };
+
+    TlsClient();
+    ~TlsClient();
+
+    //CA certificate(s) in PEM, len including the terminating zero. nullptr clears. Returns false if it does not parse.
+    bool setCACert(const char *pem, size_t len);
+
+    //SHA-256 fingerprint of the server certificate in hex, colons are allowed. Empty clears. Returns false if malformed.
+    bool setFingerprint(const char *hex);
+
+    //forgets the saved session, the next connect is a full handshake
+    void clearSession();
+
+    Stats getStats() const { return mStats; }
+
+    //statistics as JSON object. Returns the length, like snprintf.
+    size_t statsJson(char *buf, size_t bufLen) const;
+
+    int connect(IPAddress ip, uint16_t port) override;
+    int connect(const char *host, uint16_t port) override;
+    size_t write(uint8_t b) override;
+    size_t write(const uint8_t *buf, size_t size) override;
+    int available() override;
+    int read() override;
+    int read(uint8_t *buf, size_t size) override;
+    int peek() override;
+    void flush() override;
+    void stop() override;
+    uint8_t connected() override;
+    operator bool() override { return connected(); }
+
+private:
+
+    //resolves, connects and shakes hands. host is used for SNI and verification, may be nullptr.
+    int connect(IPAddress ip, const char *host, uint16_t port);
+
+    bool handshake(const char *host, uint16_t port);
+
+    //a host name to check the certificate against, not an IP address
+    static bool isName(const char *host);
+
+    //records an error and closes the connection
+    void fail(int error, const char *what);
+
+    static int verify(void *arg, mbedtls_x509_crt *crt, int depth, uint32_t *flags);
+
+    mbedtls_ssl_context mSsl;
+    mbedtls_ssl_config mConf;
+    mbedtls_x509_crt mCa;
+    mbedtls_entropy_context mEntropy;
+    mbedtls_ctr_drbg_context mDrbg;
+    mbedtls_net_context mNet;
+
+    bool mSeeded;
+    bool mHasCa;
+    bool mHasPin;
+    uint8_t mPin[32];
+
+    //session of the last connection, offered on the next connect to the same host and port
+    mbedtls_ssl_session mSession;
+    bool mHasSession;
+    char mSessionHost[64];
+    uint16_t mSessionPort;
+
+    //certificates seen by verify during the current handshake. A resumed handshake has none.
+    uint8_t mCertsVerified;
+    bool mPinMatched;
+
+    bool mConnected;
+    int mPeeked; //byte read by peek, -1 if none
+
+    Stats mStats;
+};
+
+#endif
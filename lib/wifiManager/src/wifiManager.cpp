@@ -0,0 +1,181 @@
+
+#include "wifiManager.hpp"
+
+WifiManager::WifiManager() : mState(OFF), mApActive(false), mEverConnected(false), mAttemptMs(0), mRetryMs(0), mDownMs(0), mUpMs(0), mEvents(0), mReason(0)
+{
+    memset(&mStats, 0, sizeof(mStats));
+    mMux = portMUX_INITIALIZER_UNLOCKED;
+}
+
+void WifiManager::begin()
+{
+    WiFi.onEvent([this](system_event_id_t event, system_event_info_t info){ onEvent(event, info); });
+}
+
+//runs on the event task, must not call into WiFi
+void WifiManager::onEvent(system_event_id_t event, system_event_info_t info)
+{
+    portENTER_CRITICAL(&mMux);
+    switch(event)
+    {
+        case SYSTEM_EVENT_STA_GOT_IP:
+            mEvents |= EVENT_GOT_IP;
+            break;
+        case SYSTEM_EVENT_STA_DISCONNECTED:
+            mEvents |= EVENT_DISCONNECTED;
+            mReason = info.disconnected.reason;
+            break;
+        case SYSTEM_EVENT_STA_LOST_IP:
+            mEvents |= EVENT_DISCONNECTED;
+            mReason = 0;
+            break;
+        case SYSTEM_EVENT_AP_START:
+            mEvents |= EVENT_AP_START;
+            break;
+        default:
+            break;
+    }
+    portEXIT_CRITICAL(&mMux);
+}
+
+void WifiManager::configure(const Config &config)
+{
+    uint32_t now = millis();
+    mConfig = config;
+
+    WiFi.setAutoReconnect(false); //retries are ours, with backoff
+
+    if(mConfig.staEnabled)
+    {
+        WiFi.mode(mApActive ? WIFI_MODE_APSTA : WIFI_MODE_STA);
+        if(mApActive) WiFi.softAP(mConfig.apSsid.c_str(), mConfig.apPassword.c_str()); //the credentials may have changed
+        WiFi.setHostname(mConfig.hostname.c_str());
+
+        mDownMs = now;
+        mStats.backoffMs = 0;
+        connect(now);
+    }
+    else
+    {
+        WiFi.disconnect();
+        mState = OFF;
+        startAp();
+    }
+}
+
+void WifiManager::connect(uint32_t now)
+{
+    WiFi.begin(mConfig.ssid.c_str(), mConfig.password.c_str()); //returns at once, the result comes as event
+    mState = CONNECTING;
+    mAttemptMs = now;
+    mStats.attempts++;
+}
+
+void WifiManager::retry(uint32_t now)
+{
+    mStats.backoffMs = mStats.backoffMs ? mStats.backoffMs * 2 : MIN_BACKOFF_MS;
+    if(mStats.backoffMs > MAX_BACKOFF_MS) mStats.backoffMs = MAX_BACKOFF_MS;
+    mRetryMs = now + mStats.backoffMs;
+    mState = BACKOFF;
+}
+
+void WifiManager::startAp()
+{
+    WiFi.mode(mConfig.staEnabled ? WIFI_MODE_APSTA : WIFI_MODE_AP); //adding the AP keeps the station as it is
+    WiFi.softAP(mConfig.apSsid.c_str(), mConfig.apPassword.c_str()); //the address is set once it runs, see EVENT_AP_START
+    mApActive = true;
+}
+
+void WifiManager::stopAp()
+{
+    WiFi.mode(WIFI_MODE_STA);
+    mApActive = false;
+}
+
+void WifiManager::update()
+{
+    uint32_t now = millis();
+
+    portENTER_CRITICAL(&mMux);
+    uint8_t events = mEvents;
+    mEvents = 0;
+    uint8_t reason = mReason;
+    portEXIT_CRITICAL(&mMux);
+
+    if(events & EVENT_AP_START)
+    {
+        WiFi.softAPConfig(IPAddress (192, 168, 4, 1), IPAddress (192, 168, 4, 1), IPAddress (255,255,255,0));
+        WiFi.softAPsetHostname("SBMS");
+    }
+
+    if(mConfig.staEnabled)
+    {
+        //a disconnect and a new address in one round: the address is newer.
+        //Leaving the old network for a new attempt is reported as disconnect too, it does not end the attempt.
+        bool leave = reason == WIFI_REASON_ASSOC_LEAVE && mState == CONNECTING;
+        if((events & EVENT_DISCONNECTED) && !leave && (mState == CONNECTED || mState == CONNECTING))
+        {
+            mStats.lastReason = reason;
+            if(mState == CONNECTED) mDownMs = now;
+            if(!(events & EVENT_GOT_IP)) retry(now);
+        }
+
+        if((events & EVENT_GOT_IP) && mState != CONNECTED)
+        {
+            uint32_t associate = now - mAttemptMs;
+            mStats.lastAssociateMs = associate;
+            if(associate > mStats.maxAssociateMs) mStats.maxAssociateMs = associate;
+            mStats.disconnectedMs += now - mDownMs;
+            mStats.connects++;
+            if(mEverConnected) mStats.reconnects++;
+            mEverConnected = true;
+            mStats.backoffMs = 0;
+            mUpMs = now;
+            mState = CONNECTED;
+        }
+
+        if(mState == CONNECTING && now - mAttemptMs > CONNECT_TIMEOUT_MS)
+        {
+            WiFi.disconnect(); //its event finds the state in backoff already
+            retry(now);
+        }
+        else if(mState == BACKOFF && (int32_t)(now - mRetryMs) >= 0)
+        {
+            connect(now);
+        }
+
+        if(!mApActive && mState != CONNECTED && now - mDownMs >= AP_FALLBACK_MS)
+        {
+            startAp();
+        }
+        else if(mApActive && mState == CONNECTED && now - mUpMs >= AP_RELEASE_MS && WiFi.softAPgetStationNum() == 0)
+        {
+            stopAp();
+        }
+    }
+
+    portENTER_CRITICAL(&mMux);
+    mStats.state = mState;
+    mStats.apActive = mApActive;
+    mStats.outageMs = mConfig.staEnabled && mState != CONNECTED ? now - mDownMs : 0;
+    portEXIT_CRITICAL(&mMux);
+}
+
+WifiManager::Stats WifiManager::getStats()
+{
+    portENTER_CRITICAL(&mMux);
+    Stats stats = mStats;
+    portEXIT_CRITICAL(&mMux);
+    return stats;
+}
+
+size_t WifiManager::statsJson(char *buf, size_t bufLen)
+{
+    static const char *STATES[] = {"off", "connecting", "connected", "backoff"};
+
+    Stats s = getStats();
+    return snprintf(buf, bufLen, "{\"state\":\"%s\",\"ap\":%s,\"apClients\":%u,\"rssi\":%d,\"attempts\":%u,\"connects\":%u,\"reconnects\":%u,"
+                                 "\"lastAssociateMs\":%u,\"maxAssociateMs\":%u,\"disconnectedMs\":%u,\"outageMs\":%u,\"backoffMs\":%u,\"lastReason\":%u}",
+        STATES[s.state], s.apActive ? "true" : "false", s.apActive ? WiFi.softAPgetStationNum() : 0, s.state == CONNECTED ? WiFi.RSSI() : 0,
+        s.attempts, s.connects, s.reconnects, s.lastAssociateMs, s.maxAssociateMs, s.disconnectedMs, s.outageMs, s.backoffMs, s.lastReason);
+}
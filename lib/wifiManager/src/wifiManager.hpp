@@ -0,0 +1,110 @@
+#ifndef WIFIMANAGER_H
+#define WIFIMANAGER_H
+
+#include <Arduino.h>
+
+#include <WiFi.h>
+
+//Station connection with exponential backoff and a fallback access point, driven by the WiFi events.
+//The event handler only records what happened, update() acts on it from the loop and never waits:
+//a lost connection is retried after 1, 2, 4 .. 60 s instead of restarting the whole WiFi every few seconds.
+//The fallback AP comes up when the station is down for AP_FALLBACK_MS and stays up while it is used,
+//so a router outage does not cut off the clients that are configuring the device.
+class WifiManager {
+
+public:
+    static const uint32_t MIN_BACKOFF_MS = 1000;
+    static const uint32_t MAX_BACKOFF_MS = 60000;
+
+    //an attempt without an IP address after this long has failed
+    static const uint32_t CONNECT_TIMEOUT_MS = 15000;
+
+    //the AP is started once the station is down this long, and stopped once it is connected this long and no client is on the AP
+    static const uint32_t AP_FALLBACK_MS = 20000;
+    static const uint32_t AP_RELEASE_MS = 60000;
+
+    enum State : uint8_t {
+        OFF, //station disabled, AP only
+        CONNECTING,
+        CONNECTED,
+        BACKOFF //waiting for the next attempt
+    };
+
+    struct Config {
+        bool staEnabled;
+        String hostname;
+        String ssid;
+        String password;
+        String apSsid;
+        String apPassword;
+    };
+
+    struct Stats {
+        State state;
+        bool apActive;
+        uint32_t attempts;
+        uint32_t connects;
+        uint32_t reconnects; //connects after a lost connection
+        uint32_t lastAssociateMs; //from the attempt to the IP address, of the last connect
+        uint32_t maxAssociateMs;
+        uint32_t disconnectedMs; //total time the enabled station was down, without the current outage
+        uint32_t outageMs; //current, 0 while connected
+        uint32_t backoffMs;
+        uint8_t lastReason; //of the last disconnect, wifi_err_reason_t
+    };
+
+    WifiManager();
+
+    //registers the event handler, once before the first configure
+    void begin();
+
+    //applies new settings and starts over with the connection. The AP stays up if it is active.
+    void configure(const Config &config);
+
+    //acts on the recorded events and timeouts, call from the loop
+    void update();
+
+    bool connected() const { return mState == CONNECTED; }
+    bool apActive() const { return mApActive; }
+
+    Stats getStats();
+
+    //stats as JSON object, returns the length like snprintf
+    size_t statsJson(char *buf, size_t bufLen);
+
+private:
+
+    enum Event : uint8_t {
+        EVENT_GOT_IP = 1,
+        EVENT_DISCONNECTED = 2,
+        EVENT_AP_START = 4
+    };
+
+    void onEvent(system_event_id_t event, system_event_info_t info);
+
+    void connect(uint32_t now);
+    void retry(uint32_t now);
+    void startAp();
+    void stopAp();
+
+    Config mConfig;
+
+    State mState;
+    bool mApActive;
+    bool mEverConnected;
+
+    uint32_t mAttemptMs; //start of the current attempt
+    uint32_t mRetryMs;
+    uint32_t mDownMs; //since when the station is down
+    uint32_t mUpMs; //since when it is connected
+
+    Stats mStats;
+
+    //written by the event task, taken by update()
+    uint8_t mEvents;
+    uint8_t mReason;
+
+    portMUX_TYPE mMux;
+};
+
+#endif
@@ -0,0 +1,323 @@
+//Host build of the data pipeline (env:native): uart bytes -> JsvarStore -> SbmsData -> JSON -> mqtt, with the libraries of the
+//firmware and MqttStandIn in place of the broker. Reads captured traffic from files or stdin.
+//
+//  pio run -e native
+//  .pio/build/native/program [-r n] [-s] [-p] [-d] [file...]
+//
+//  -r n  feed the input n times, for throughput measurements
+//  -s    stream the JSON with MqttJsonWriter instead of serializing into a buffer first
+//  -p    print every published message
+//  -d    print the store content at the end, the body of /rawData
+//  -b    run the benchmark suite instead and print its JSON report, compare with tools/bench_compare.py
+//  -u n  send every sbms frame as InfluxDB line protocol in batches of up to 1400 bytes to UDP port n on 127.0.0.1
+//  -m n  afterwards serve the modbus table of the last frame on 127.0.0.1 port n until killed
+//  -w    also publish the sbms frames in raw passthrough format and decode them again with sbmsDecodeBatch, like a server would
+//
+//Exits with 1 if a publish was malformed, no sbms frame made it through or a raw frame decoded differently.
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "jsvarStore.hpp"
+#include "sbmsData.hpp"
+#include "sbmsJson.hpp"
+#include "sbmsCounters.hpp"
+#include "sbmsInflux.hpp"
+#include "sbmsDecode.hpp"
+#include "mqttStream.hpp"
+#include "mqttStandIn.hpp"
+#include "benchSuite.hpp"
+#include "modbusRegisters.hpp"
+#include "modbusSlave.hpp"
+#include "influxBatch.hpp"
+
+JsvarStore store;
+MqttStandIn mqtt;
+ModbusRegisters modbusRegisters;
+ModbusSlave modbusSlave(&modbusRegisters, 1);
+InfluxBatch influxBatch;
+
+char jsonBuffer[2000];
+
+bool streaming = false;
+uint16_t influxPort = 0;
+
+uint32_t sbms_frames = 0;
+uint32_t sbms_invalid = 0;
+
+bool raw = false;
+std::vector<std::string> raw_messages;
+
+//same steps as handleSbmsVar() of the firmware, but called by the store at the commit with the content in place
+void handleSbms(const JsvarStore::View &var, void *arg)
+{
+  const char *sbmsString = var.data;
+
+  if(!SbmsData::isValid(sbmsString))
+  {
+    sbms_invalid++;
+    return;
+  }
+
+  sbms_frames++;
+
+  SbmsData sbms(sbmsString);
+  modbusRegisters.update(sbms, millis());
+
+  if(influxPort)
+  {
+    uint64_t timeNs = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+    char line[InfluxBatch::MAX_LINE_LEN];
+    size_t len = toInfluxSBMS(sbms, "sbms", 0, "", timeNs, line, sizeof(line));
+    if(len < sizeof(line)) influxBatch.add(line, len, millis());
+  }
+
+  JsonDocument *doc = toJsonSBMS(sbms, false);
+
+  if(streaming)
+  {
+    mqtt.beginPublish("/sbms", measureJson(*doc), false);
+    MqttJsonWriter<MqttStandIn> writer(mqtt);
+    serializeJson(*doc, writer);
+    writer.flush();
+    mqtt.endPublish();
+  }
+  else
+  {
+    size_t len = serializeJson(*doc, jsonBuffer, sizeof(jsonBuffer));
+    mqttPublishBuffer(mqtt, "/sbms", jsonBuffer, len);
+  }
+}
+
+//raw passthrough of the firmware, the messages are kept for decodeRaw()
+void handleRaw(const JsvarStore::View &var, void *arg)
+{
+  char message[28 + JsvarStore::MAX_CONTENT_LEN + 1];
+  size_t len = sbmsFormatRaw(message, sizeof(message), var.seq, millis(), var.data, var.length);
+  if(len >= sizeof(message)) return;
+
+  mqttPublishBuffer(mqtt, "/raw/sbms", message, len);
+  raw_messages.push_back(std::string(message, len));
+}
+
+//decodes the raw messages in one batch and compares them with the frame by frame decoder. Returns the number of differences.
+uint32_t decodeRaw()
+{
+  std::vector<const char *> frames;
+  std::vector<size_t> lens;
+  std::vector<SbmsRecord> expected;
+  for(const std::string &message : raw_messages)
+  {
+    SbmsRaw r;
+    if(!sbmsParseRaw(message.data(), message.size(), r)) continue;
+    frames.push_back(r.content);
+    lens.push_back(r.length);
+    SbmsRecord record;
+    memset(&record, 0, sizeof(record)); //memcmp below
+    sbmsDecode(r.content, r.length, record);
+    expected.push_back(record);
+  }
+
+  std::vector<SbmsRecord> records(frames.size());
+  std::vector<char> valid(frames.size());
+
+  auto start = std::chrono::steady_clock::now();
+  sbmsDecodeBatch(frames.data(), lens.data(), frames.size(), records.data(), (bool*)valid.data());
+  double elapsedNs = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+
+  uint32_t differences = raw_messages.size() - frames.size();
+  for(size_t i=0; i<frames.size(); i++)
+  {
+    if(valid[i] && memcmp(&records[i], &expected[i], sizeof(SbmsRecord)) != 0) differences++;
+  }
+
+  printf("raw: %u messages, %u differences, batch decode %.1f ns/frame\n", (unsigned)raw_messages.size(), differences, frames.empty() ? 0 : elapsedNs / frames.size());
+  return differences;
+}
+
+void handleS2(const JsvarStore::View &var, void *arg)
+{
+  mqtt.publish("/s2", var.data);
+}
+
+void handleCharge(const JsvarStore::View &var, void *arg)
+{
+  if(SbmsCounters::isValid(var.data)) modbusRegisters.updateCharge(SbmsCounters(var.data));
+}
+
+void handleEnergy(const JsvarStore::View &var, void *arg)
+{
+  if(SbmsCounters::isValid(var.data)) modbusRegisters.updateEnergy(SbmsCounters(var.data));
+}
+
+//writes the pending points like the influx task of the firmware, one datagram per batch
+void sendInflux(uint16_t port)
+{
+  int sock = socket(AF_INET, SOCK_DGRAM, 0);
+  sockaddr_in addr = {};
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  addr.sin_port = htons(port);
+
+  char lines[InfluxBatch::MAX_BYTES];
+  while(influxBatch.due(millis()))
+  {
+    uint16_t points;
+    size_t len = influxBatch.peek(lines, 1400, points);
+    if(len == 0) break;
+    bool ok = sendto(sock, lines, len, 0, (sockaddr*)&addr, sizeof(addr)) == (ssize_t)len;
+    influxBatch.done(len, points, ok, millis());
+    if(!ok) break;
+  }
+  close(sock);
+
+  InfluxBatch::Stats s = influxBatch.getStats();
+  printf("influx: %u points, %u written in %u datagrams, %u dropped\n", s.points, s.written, s.batches, s.dropped);
+}
+
+//answers modbus tcp requests like the firmware, one connection at a time
+int serveModbus(uint16_t port)
+{
+  int listener = socket(AF_INET, SOCK_STREAM, 0);
+  int yes = 1;
+  setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+
+  sockaddr_in addr = {};
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  addr.sin_port = htons(port);
+  if(bind(listener, (sockaddr*)&addr, sizeof(addr)) < 0 || listen(listener, 1) < 0)
+  {
+    perror("modbus");
+    return 2;
+  }
+
+  printf("modbus: listening on 127.0.0.1:%u\n", port);
+  fflush(stdout);
+
+  uint8_t request[ModbusSlave::MAX_ADU_LEN];
+  uint8_t response[ModbusSlave::MAX_ADU_LEN];
+  for(;;)
+  {
+    int conn = accept(listener, nullptr, nullptr);
+    if(conn < 0) continue;
+
+    size_t len = 0;
+    int frameLen = 0;
+    while(frameLen >= 0)
+    {
+      ssize_t n = recv(conn, request + len, sizeof(request) - len, 0);
+      if(n <= 0) break;
+      len += n;
+
+      while((frameLen = ModbusSlave::frameLength(request, len)) > 0)
+      {
+        size_t resLen = modbusSlave.process(request, frameLen, response, millis());
+        if(send(conn, response, resLen, 0) < 0) break;
+        len -= frameLen;
+        memmove(request, request + frameLen, len);
+      }
+    }
+    close(conn);
+
+    ModbusSlave::Stats s = modbusSlave.getStats();
+    printf("modbus: %u requests, %u exceptions\n", s.requests, s.exceptions);
+    fflush(stdout);
+  }
+}
+
+void printMessage(const MqttStandIn::Message &message)
+{
+  std::cout << message.topic << " " << message.payload << std::endl;
+}
+
+int main(int argc, char **argv)
+{
+  uint32_t repeat = 1;
+  bool dump = false;
+  uint16_t modbusPort = 0;
+  std::vector<const char *> files;
+
+  for(int i=1; i<argc; i++)
+  {
+    std::string arg = argv[i];
+    if(arg == "-r" && i + 1 < argc) repeat = atoi(argv[++i]);
+    else if(arg == "-s") streaming = true;
+    else if(arg == "-p") mqtt.onMessage(printMessage);
+    else if(arg == "-d") dump = true;
+    else if(arg == "-m" && i + 1 < argc) modbusPort = atoi(argv[++i]);
+    else if(arg == "-u" && i + 1 < argc) influxPort = atoi(argv[++i]);
+    else if(arg == "-w") raw = true;
+    else if(arg == "-b")
+    {
+      BenchSuite::Result results[BenchSuite::NUM_BENCHES];
+      BenchSuite::run(results);
+      printf("%s\n", BenchSuite::report(results, "native").c_str());
+      return 0;
+    }
+    else files.push_back(argv[i]);
+  }
+
+  std::vector<char> input;
+  if(files.empty())
+  {
+    input.assign(std::istreambuf_iterator<char>(std::cin), std::istreambuf_iterator<char>());
+  }
+  for(const char *file : files)
+  {
+    std::ifstream f(file, std::ios::binary);
+    if(!f)
+    {
+      std::cerr << "cannot open " << file << std::endl;
+      return 2;
+    }
+    input.insert(input.end(), std::istreambuf_iterator<char>(f), std::istreambuf_iterator<char>());
+  }
+
+  influxBatch.configure(InfluxBatch::MAX_BYTES, 0); //everything is sent at the end
+
+  store.subscribe(store.registerVar("sbms"), handleSbms, nullptr);
+  if(raw) store.subscribe(store.registerVar("sbms"), handleRaw, nullptr);
+  store.subscribe(store.registerVar("s2"), handleS2, nullptr);
+  store.subscribe(store.registerVar("eA"), handleCharge, nullptr);
+  store.subscribe(store.registerVar("eW"), handleEnergy, nullptr);
+
+  auto start = std::chrono::steady_clock::now();
+
+  for(uint32_t r=0; r<repeat; r++)
+  {
+    for(char c : input) store.handleChar(c);
+  }
+
+  double elapsedUs = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count() / 1000.0;
+  uint64_t bytes = (uint64_t)input.size() * repeat;
+
+  if(dump) std::cout << store.dumpVars().c_str();
+
+  JsvarStore::Stats p = store.getStats();
+  printf("input: %llu bytes\n", (unsigned long long)bytes);
+  printf("parser: %u committed, %u errors, %u gaps, %u slow callbacks\n", p.committed, p.errors, p.gaps, p.slowCallbacks);
+  printf("sbms: %u frames, %u invalid\n", sbms_frames, sbms_invalid);
+  printf("mqtt: %u messages, %llu bytes, %u errors\n", mqtt.messages(), (unsigned long long)mqtt.bytes(), mqtt.errors());
+  printf("time: %.0f us, %.1f ns/byte, %.2f us/sbms frame\n", elapsedUs, bytes ? elapsedUs * 1000 / bytes : 0, sbms_frames ? elapsedUs / sbms_frames : 0);
+
+  if(influxPort) sendInflux(influxPort);
+
+  if(raw && decodeRaw() > 0) return 1;
+
+  if(mqtt.errors() > 0 || sbms_frames == 0) return 1;
+
+  return modbusPort ? serveModbus(modbusPort) : 0;
+}
@@ -0,0 +1,96 @@
+#ifndef MQTT_STAND_IN_H
+#define MQTT_STAND_IN_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <string>
+
+//In-process stand-in for PubSubClient on the host. Accepts the publishing calls the firmware makes and checks them like
+//the broker would: the payload must have exactly the length announced in beginPublish().
+class MqttStandIn {
+public:
+    struct Message {
+        std::string topic;
+        std::string payload;
+    };
+
+    MqttStandIn()
+        : mPublishing(false)
+        , mExpected(0)
+        , mMessages(0)
+        , mBytes(0)
+        , mErrors(0)
+        , mOnMessage(nullptr)
+    {
+    }
+
+    bool connected() { return true; }
+
+    bool beginPublish(const char *topic, unsigned int plength, bool retained)
+    {
+        if(mPublishing) mErrors++; //previous publish was not ended
+        mPublishing = true;
+        mExpected = plength;
+        mCurrent.topic = topic;
+        mCurrent.payload.clear();
+        return true;
+    }
+
+    size_t write(uint8_t c)
+    {
+        return write(&c, 1);
+    }
+
+    size_t write(const uint8_t *buf, size_t size)
+    {
+        if(!mPublishing) return 0;
+        mCurrent.payload.append((const char *)buf, size);
+        return size;
+    }
+
+    int endPublish()
+    {
+        bool ok = mPublishing && mCurrent.payload.length() == mExpected;
+        mPublishing = false;
+
+        if(!ok)
+        {
+            mErrors++;
+            return 0;
+        }
+
+        mMessages++;
+        mBytes += mCurrent.payload.length();
+        if(mOnMessage) mOnMessage(mCurrent);
+        return 1;
+    }
+
+    bool publish(const char *topic, const char *payload)
+    {
+        size_t len = strlen(payload);
+        beginPublish(topic, len, false);
+        write((const uint8_t *)payload, len);
+        return endPublish();
+    }
+
+    //called for every complete message
+    void onMessage(void (*callback)(const Message &message)) { mOnMessage = callback; }
+
+    uint32_t messages() const { return mMessages; }
+    uint64_t bytes() const { return mBytes; }
+    uint32_t errors() const { return mErrors; }
+
+private:
+    bool mPublishing;
+    size_t mExpected;
+    Message mCurrent;
+
+    uint32_t mMessages;
+    uint64_t mBytes;
+    uint32_t mErrors;
+
+    void (*mOnMessage)(const Message &message);
+};
+
+#endif
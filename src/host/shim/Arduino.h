@@ -0,0 +1,44 @@
+#ifndef HOST_ARDUINO_H
+#define HOST_ARDUINO_H
+
+//Minimal Arduino, ESP32 and FreeRTOS API for the host build (env:native). Only what the libraries in lib/ use.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "WString.h"
+#include "freertos.h"
+
+//milliseconds since the program started
+uint32_t millis();
+uint32_t micros();
+
+class EspClass {
+public:
+    //emulated cycle counter of a 240MHz core, from the monotonic clock
+    uint32_t getCycleCount();
+    uint32_t getCpuFreqMHz() { return CPU_FREQ_MHZ; }
+
+    static const uint32_t CPU_FREQ_MHZ = 240;
+};
+
+extern EspClass ESP;
+
+#if defined(__GLIBC__) && !__GLIBC_PREREQ(2, 38) //older glibc has no strlcpy
+inline size_t strlcpy(char *dst, const char *src, size_t size)
+{
+    size_t len = strlen(src);
+    if(size > 0)
+    {
+        size_t n = len < size - 1 ? len : size - 1;
+        memcpy(dst, src, n);
+        dst[n] = 0;
+    }
+    return len;
+}
+#endif
+
+#endif
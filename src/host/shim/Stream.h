@@ -0,0 +1,6 @@
+#ifndef HOST_STREAM_H
+#define HOST_STREAM_H
+
+//included by the libraries, nothing in it is used on the host
+
+#endif
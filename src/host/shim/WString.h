@@ -0,0 +1,28 @@
+#ifndef HOST_WSTRING_H
+#define HOST_WSTRING_H
+
+#include <string>
+
+//Arduino String on top of std::string, as far as the libraries use it
+class String {
+public:
+    String() {}
+    String(const char *s) : mStr(s ? s : "") {}
+    String(const std::string &s) : mStr(s) {}
+
+    bool reserve(size_t size) { mStr.reserve(size); return true; }
+    size_t length() const { return mStr.length(); }
+    bool isEmpty() const { return mStr.empty(); }
+    const char *c_str() const { return mStr.c_str(); }
+
+    String &operator+=(const char *s) { mStr += s; return *this; }
+    String &operator+=(const String &s) { mStr += s.mStr; return *this; }
+    String &operator+=(char c) { mStr += c; return *this; }
+
+    bool operator==(const char *s) const { return mStr == s; }
+
+private:
+    std::string mStr;
+};
+
+#endif
@@ -0,0 +1,6 @@
+#ifndef HOST_ESP32_HAL_H
+#define HOST_ESP32_HAL_H
+
+#include "Arduino.h"
+
+#endif
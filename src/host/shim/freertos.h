@@ -0,0 +1,85 @@
+#ifndef HOST_FREERTOS_H
+#define HOST_FREERTOS_H
+
+#include <stdint.h>
+#include <chrono>
+#include <mutex>
+#include <deque>
+#include <vector>
+#include <string.h>
+
+//FreeRTOS mutexes on top of std::timed_mutex and queues that never block. One tick is one millisecond, like CONFIG_FREERTOS_HZ=1000.
+
+typedef uint32_t TickType_t;
+typedef int BaseType_t;
+
+#define pdTRUE 1
+#define pdFALSE 0
+#define portMAX_DELAY ((TickType_t) 0xffffffffUL)
+#define pdMS_TO_TICKS(ms) ((TickType_t)(ms))
+
+typedef std::timed_mutex *SemaphoreHandle_t;
+
+inline SemaphoreHandle_t xSemaphoreCreateMutex()
+{
+    return new std::timed_mutex();
+}
+
+inline void vSemaphoreDelete(SemaphoreHandle_t mutex)
+{
+    delete mutex;
+}
+
+inline BaseType_t xSemaphoreTake(SemaphoreHandle_t mutex, TickType_t ticks)
+{
+    if(ticks == portMAX_DELAY)
+    {
+        mutex->lock();
+        return pdTRUE;
+    }
+    return mutex->try_lock_for(std::chrono::milliseconds(ticks)) ? pdTRUE : pdFALSE;
+}
+
+inline BaseType_t xSemaphoreGive(SemaphoreHandle_t mutex)
+{
+    mutex->unlock();
+    return pdTRUE;
+}
+
+//fixed size items copied in and out, like a FreeRTOS queue
+struct HostQueue {
+    std::mutex mutex;
+    std::deque<std::vector<uint8_t>> items;
+    size_t length;
+    size_t itemSize;
+};
+
+typedef HostQueue *QueueHandle_t;
+
+inline QueueHandle_t xQueueCreate(size_t length, size_t itemSize)
+{
+    QueueHandle_t queue = new HostQueue();
+    queue->length = length;
+    queue->itemSize = itemSize;
+    return queue;
+}
+
+inline BaseType_t xQueueSendToBack(QueueHandle_t queue, const void *item, TickType_t ticks)
+{
+    std::lock_guard<std::mutex> lock(queue->mutex);
+    if(queue->items.size() >= queue->length) return pdFALSE;
+    const uint8_t *bytes = (const uint8_t*)item;
+    queue->items.emplace_back(bytes, bytes + queue->itemSize);
+    return pdTRUE;
+}
+
+inline BaseType_t xQueueReceive(QueueHandle_t queue, void *item, TickType_t ticks)
+{
+    std::lock_guard<std::mutex> lock(queue->mutex);
+    if(queue->items.empty()) return pdFALSE;
+    memcpy(item, queue->items.front().data(), queue->itemSize);
+    queue->items.pop_front();
+    return pdTRUE;
+}
+
+#endif
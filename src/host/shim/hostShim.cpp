@@ -0,0 +1,23 @@
+#include "Arduino.h"
+
+#include <chrono>
+
+static const std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+
+EspClass ESP;
+
+uint32_t millis()
+{
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - startTime).count();
+}
+
+uint32_t micros()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - startTime).count();
+}
+
+uint32_t EspClass::getCycleCount()
+{
+    uint64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - startTime).count();
+    return ns * CPU_FREQ_MHZ / 1000; //wraps like the real counter
+}
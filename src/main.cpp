@@ -24,6 +24,9 @@
 #include <WiFiClient.h>
 #include <PubSubClient.h>
 
+//alert posts
+#include <HTTPClient.h>
+
 //file system
 #include <SPIFFS.h>
 
@@ -34,38 +37,84 @@
 //rtos drivers
 #include "driver/uart.h"
 #include "esp_log.h"
+#include "esp_timer.h"
+#include <sys/time.h>
 
 //local libraries
 #include "jsvarStore.hpp"
 #include "sbmsData.hpp"
+#include "sbmsJson.hpp"
+#include "sbmsFlags.hpp"
+#include "sbmsCounters.hpp"
+#include "sbmsInflux.hpp"
+#include "sbmsDecode.hpp"
+#include "mqttStream.hpp"
+#include "allocTrack.hpp"
+#include "memBudget.hpp"
+#include "latencyHistogram.hpp"
+#include "benchSuite.hpp"
+#include "cellStats.hpp"
+#include "alertRules.hpp"
+#include "eventHub.hpp"
+#include "otaWriter.hpp"
+#include "assetBundle.hpp"
+#include "modbusRegisters.hpp"
+#include "modbusSlave.hpp"
+#include "modbusServer.hpp"
+#include "influxBatch.hpp"
+#include "wifiManager.hpp"
+#include "tlsClient.hpp"
+#include "apiCache.hpp"
+#include "assetBundleData.h" //generated from data/dist by tools/bundle_assets.py
 
 // Set LED_BUILTIN if it is not defined by Arduino framework
 // #define LED_BUILTIN 2
 
 //instances
 AsyncWebServer server(80);
-AsyncEventSource eventsData("/eData");
+EventHub eventsData("/eData");
+EventHub eventsVars("/eVars"); //raw variables for sbms.html, grouped by source
+
+//recent events of /eData for browsers that reconnect with Last-Event-ID, 10-20 frames depending on their size
+#define SSE_REPLAY_BYTES 8192
+static char sse_replay[SSE_REPLAY_BYTES];
+AssetBundle web_assets(ASSET_BUNDLE, ASSET_BUNDLE_COUNT); //web interface, served from the firmware image
+ApiCache api_cache("/api/"); //latest decoded values for pollers, entries are added by setupPublishing()
+WifiManager wifi_manager;
 
 WiFiClient mqttWifiClient;
+TlsClient mqttTlsClient; //used instead with mq_tls
 PubSubClient mqtt(mqttWifiClient);
 
-JsvarStore varStore;
-
 //------------------------- GLOBALS ---------------------
 
 //WIFI
-bool ap_fallback = false;
-unsigned long lastWiFiTime = 0;
-unsigned long lastWifiRetryTime = 0;
 bool wifiSettingsChanged = false;
 
 //MQTT
 unsigned long mqLastConnectionAttempt = 0;
+bool mqSettingsChanged = false;
+bool mqTlsConfigured = false; //CA and fingerprint are loaded into mqttTlsClient
+SemaphoreHandle_t mq_mutex = NULL; //held by the mqtt task while it connects, by the publish task while it publishes
+TaskHandle_t mqtt_task = NULL;
+bool mq_online = false; //the publish task holds mq_mutex and the client is connected, only valid in the publish task
+
+//alerts
+bool alertSettingsChanged = false;
+
+//sbms.html
+volatile bool var_push_reset = false; //a client of /eVars connected with a fresh snapshot, the pushed hashes may be older than it
 
 //system
 
 bool shouldReboot = false;
-bool web_ota_type_spiffs = false;
+
+//state of an upload to /update, kept in request->_tempObject (freed with the request)
+struct WebOtaUpload {
+  bool owner; //this upload started the writer, only it may write to and end it
+  bool spiffs;
+  char error[48]; //why it didn't start, if not the owner
+};
 
 //------------------------- SETTINGS --------------------
 
@@ -133,12 +182,17 @@ uint32_t s_mq_port = 1883;
 String s_mq_prefix = "/";
 String s_mq_user;
 String s_mq_password;
+bool s_mq_tls = false;
+String s_mq_fingerprint; //SHA-256 of the broker certificate in hex, checked in addition to or instead of the CA in MQTT_CA_FILE
+
+#define MQTT_TOPIC_MAX_LEN 128
+#define MQTT_CA_FILE "/cfg/mqtt_ca" //CA certificate(s) of the broker in PEM
 
 void readMqttSettings()
 {
   auto sMqtt = SPIFFS.open("/cfg/mqtt"); //default mode is read
 
-  const size_t capacity = JSON_OBJECT_SIZE(6) + 200;
+  const size_t capacity = JSON_OBJECT_SIZE(8) + 300;
   DynamicJsonDocument doc(capacity);
 
   auto err = deserializeJson(doc, sMqtt);
@@ -151,6 +205,8 @@ void readMqttSettings()
     s_mq_prefix = doc["mq_prefix"].as<String>();
     s_mq_user = doc["mq_user"].as<String>();
     s_mq_password = doc["mq_password"].as<String>();
+    s_mq_tls = doc["mq_tls"] | false;
+    s_mq_fingerprint = doc["mq_fingerprint"] | "";
   }
 
   sMqtt.close();
@@ -159,13 +215,24 @@ void readMqttSettings()
 
 bool data_sbms_enabled = true;
 bool data_sbms_diff = false;
+uint16_t data_sbms_interval = 0; //seconds between publications of the frames of a source, 0 for every frame
+bool data_flags_enabled = true; //transitions of the protection flags on their own topic, ahead of the frames
 bool data_s2_enabled = false;
+bool data_cells_enabled = true;
+uint16_t data_cells_interval = 60; //seconds between publications of the cell statistics
+uint16_t data_cell_low_mv = 2900;
+uint16_t data_cell_high_mv = 3550;
+bool data_raw_enabled = false; //raw passthrough of the variables in data_raw_vars
+#define RAW_VARS_UNSET 0xFFFFFFFFUL //no raw_vars in the settings, more bits than there are known variables
+uint32_t data_raw_vars = RAW_VARS_UNSET; //bit per variable ID, RAW_VARS_UNSET for RAW_VARS_DEFAULT. An empty list is 0 and publishes nothing.
+
+uint32_t rawVarMask(JsonArrayConst names); //defined next to the dispatch table
 
 void readDataSettings()
 {
   auto sData = SPIFFS.open("/cfg/data"); //default mode is read
 
-  const size_t capacity = JSON_OBJECT_SIZE(3) + 200;
+  const size_t capacity = JSON_OBJECT_SIZE(11) + JSON_ARRAY_SIZE(16) + 300;
   DynamicJsonDocument doc(capacity);
 
   auto err = deserializeJson(doc, sData);
@@ -174,7 +241,15 @@ void readDataSettings()
   {
     data_sbms_enabled = doc["sbms_enabled"].as<bool>();
     data_sbms_diff = doc["sbms_diff"].as<bool>();
+    data_sbms_interval = doc["sbms_interval"] | data_sbms_interval;
+    data_flags_enabled = doc["flags_enabled"] | data_flags_enabled;
     data_s2_enabled = doc["s2_enabled"].as<bool>();
+    data_cells_enabled = doc["cells_enabled"] | data_cells_enabled;
+    data_cells_interval = doc["cells_interval"] | data_cells_interval;
+    data_cell_low_mv = doc["cell_low_mv"] | data_cell_low_mv;
+    data_cell_high_mv = doc["cell_high_mv"] | data_cell_high_mv;
+    data_raw_enabled = doc["raw_enabled"] | data_raw_enabled;
+    if(doc.containsKey("raw_vars")) data_raw_vars = rawVarMask(doc["raw_vars"]);
   }
 
   sData.close();
@@ -203,17 +278,112 @@ void readSystemSettings()
 }
 
 
+//serial inputs. Source 0 is the sbms the module is plugged into, the others are additional SBMS or DSSR20 units.
+//Changes take effect after a reboot.
+#define UART_MAX_SOURCES 3
+
+struct UartSourceSettings {
+  bool enabled;
+  int rxPin;
+  int txPin;
+  String name; //prepended to topics and event names of the source, empty for the plain names
+};
+
+UartSourceSettings s_uart[UART_MAX_SOURCES] = {
+  {true, UART_PIN_NO_CHANGE, UART_PIN_NO_CHANGE, ""},
+  {false, 16, 17, "unit2"},
+  {false, 25, 26, "unit3"}
+};
+
+void readUartSettings()
+{
+  auto sUart = SPIFFS.open("/cfg/uart"); //default mode is read
+
+  const size_t capacity = JSON_OBJECT_SIZE(1) + JSON_ARRAY_SIZE(UART_MAX_SOURCES) + UART_MAX_SOURCES * JSON_OBJECT_SIZE(4) + 200;
+  DynamicJsonDocument doc(capacity);
+
+  auto err = deserializeJson(doc, sUart);
+
+  if(err == DeserializationError::Ok)
+  {
+    JsonArray sources = doc["sources"];
+    for(uint8_t i=0; i<UART_MAX_SOURCES && i<sources.size(); i++)
+    {
+      JsonObject source = sources[i];
+      s_uart[i].enabled = source["enabled"] | s_uart[i].enabled;
+      s_uart[i].rxPin = source["rx"] | s_uart[i].rxPin;
+      s_uart[i].txPin = source["tx"] | s_uart[i].txPin;
+      s_uart[i].name = source["name"] | s_uart[i].name.c_str();
+    }
+  }
+
+  sUart.close();
+}
+
+
 //------------------------- MQTT --------------------
 
+//full topic for publishing, built in place to avoid String concatenation on every publish
+char mqTopic[MQTT_TOPIC_MAX_LEN];
+
+const char *mqttTopic(const char *topic)
+{
+  snprintf(mqTopic, MQTT_TOPIC_MAX_LEN, "%s%s", s_mq_prefix.c_str(), topic);
+  return mqTopic;
+}
+
 void mqttCallback(char* topic, byte* payload, unsigned int length)
 {
   //we won't receive anything for now
 }
 
+#define MQTT_RETRY_MIN_MS 1000
+#define MQTT_RETRY_MAX_MS 60000
+
+struct MqttStats {
+  uint32_t attempts;
+  uint32_t connects;
+  uint32_t drops; //established connections that were lost
+  uint32_t lastConnectMs; //of the last successful connect, including the tls handshake
+  uint32_t connectedAt; //millis() of the last connect
+  uint32_t retryMs; //current backoff
+  bool connected;
+};
+MqttStats mq_stats = {0, 0, 0, 0, 0, MQTT_RETRY_MIN_MS, false};
+
+//loads the CA file and the fingerprint, once after every change of the settings. The saved tls session is dropped with them.
+void mqttTlsConfigure()
+{
+  mqTlsConfigured = true;
+
+  fs::File f = SPIFFS.open(MQTT_CA_FILE);
+  size_t len = f ? f.size() : 0;
+  char *pem = len > 0 ? (char*)malloc(len + 1) : NULL; //only while parsing
+  if(pem)
+  {
+    len = f.read((uint8_t*)pem, len);
+    pem[len] = 0;
+  }
+  f.close();
+
+  mqttTlsClient.setCACert(pem, pem ? len + 1 : 0);
+  free(pem);
+
+  mqttTlsClient.setFingerprint(s_mq_fingerprint.c_str());
+}
+
 void mqttSetup()
 {
+  if(s_mq_tls)
+  {
+    if(!mqTlsConfigured) mqttTlsConfigure();
+    mqtt.setClient(mqttTlsClient);
+  }
+  else
+  {
+    mqtt.setClient(mqttWifiClient);
+  }
 
-  //mqttWifiClient.setCACert(ca_cert);
   mqtt.setServer(s_mq_host.c_str(), s_mq_port);
   mqtt.setCallback(mqttCallback);
   mqtt.setKeepAlive(60); //default is 15 seconds
@@ -230,220 +400,144 @@ bool mqttConnect()
   return mqtt.connect(s_sta_hostname.c_str(), s_mq_user.c_str(), s_mq_password.c_str());
 }
 
+//connection management, run by the mqtt task. Takes the client from the publish task only to connect or disconnect,
+//while connected the publish task has it for itself and notices a lost connection, see mqttBeginIteration().
 void mqttUpdate()
 {
-  if(!s_mq_enabled)
+  if(mqSettingsChanged || (!s_mq_enabled && mq_stats.connected))
   {
-    if(mqtt.connected())
+    xSemaphoreTake(mq_mutex, portMAX_DELAY);
+    if(mqSettingsChanged)
     {
-      mqtt.disconnect();
+      mqSettingsChanged = false;
+      mqTlsConfigured = false;
+      mq_stats.retryMs = MQTT_RETRY_MIN_MS;
     }
+    if(mqtt.connected()) mqtt.disconnect(); //cause reinitialization, even if config failed. We want to see the problem immediately rather than later.
+    mq_stats.connected = false;
+    xSemaphoreGive(mq_mutex);
   }
-  else
-  {
-    if(!mqtt.connected() && millis() - mqLastConnectionAttempt > 1000)
-    {
-      printf("Connecting to %s : %d as %s", s_mq_host.c_str(), s_mq_port, s_sta_hostname.c_str());
-      mqttSetup();
-      if (mqttConnect())
-      {
-        //client.subscribe(TOPIC);
-      }
-      else
-      {
-        mqLastConnectionAttempt = millis();
-      }
-    }
-    mqtt.loop();
-  }
-}
-
-struct MqttJsonWriter {
-  // Writes one byte, returns the number of bytes written (0 or 1)
-  size_t write(uint8_t c)
-  { 
-    buf[bufi++] = c;
-    if(bufi == MQTT_MAX_PACKET_SIZE) flush();
-    return 1;
-  }
-  // Writes several bytes, returns the number of bytes written
-  size_t write(const uint8_t *buffer, size_t length)
-  { 
-    size_t i = 0;
-    while(i < length && bufi < MQTT_MAX_PACKET_SIZE)
-    {
-      buf[bufi++] = buffer[i++];
-    }
 
-    if(bufi == MQTT_MAX_PACKET_SIZE) flush();
-    
-    return i; 
-  }
+  if(!s_mq_enabled || mq_stats.connected || millis() - mqLastConnectionAttempt < mq_stats.retryMs) return;
 
-  uint8_t buf[MQTT_MAX_PACKET_SIZE];
-  size_t bufi;
+  //dns, tcp connect and the tls handshake may take seconds, the publish task goes on without mqtt meanwhile
+  xSemaphoreTake(mq_mutex, portMAX_DELAY);
 
-  MqttJsonWriter()
+  printf("Connecting to %s : %d as %s", s_mq_host.c_str(), s_mq_port, s_sta_hostname.c_str());
+  mqttSetup();
+  mq_stats.attempts++;
+  uint32_t start = millis();
+  if (mqttConnect())
   {
-    bufi = 0;
+    //client.subscribe(TOPIC);
+    mq_stats.connects++;
+    mq_stats.lastConnectMs = millis() - start;
+    mq_stats.connectedAt = millis();
+    mq_stats.retryMs = MQTT_RETRY_MIN_MS;
+    mq_stats.connected = true;
   }
-
-  void flush()
+  else
   {
-    size_t written = 0;
-    while(written < bufi)
-    {
-      size_t thisWrite = mqtt.write(buf + written, bufi - written);
-      if(thisWrite == 0) return; //error, couldn't even write a single byte. Prevent infinite loop.
-      written += thisWrite;
-    }
-
-    bufi = 0;
+    mqLastConnectionAttempt = millis();
+    mq_stats.retryMs = mq_stats.retryMs * 2 > MQTT_RETRY_MAX_MS ? MQTT_RETRY_MAX_MS : mq_stats.retryMs * 2;
   }
-};
-
-void mqttPublishJson(const JsonDocument *doc, const String topic)
-{
-
-  mqtt.beginPublish((s_mq_prefix + topic).c_str(), measureJson(*doc), false);
-
-  MqttJsonWriter writer;
-  serializeJson(*doc, writer);
 
-  writer.flush();
-
-  mqtt.endPublish();
+  xSemaphoreGive(mq_mutex);
 }
 
-
-//size calculated by https://arduinojson.org/v6/assistant/
-StaticJsonDocument<JSON_ARRAY_SIZE(8) + JSON_OBJECT_SIZE(4) + JSON_OBJECT_SIZE(6) + JSON_OBJECT_SIZE(13) + JSON_OBJECT_SIZE(15)> docSBMS; //13 is the root element
-
-JsonDocument* toJsonSBMS(const SbmsData &sbms)
+//publish task, before it handles new data. Takes the client unless the mqtt task is connecting, never waits for it.
+void mqttBeginIteration()
 {
-  docSBMS.clear();
-
-  docSBMS["time"]["year"] = sbms.year;
-  docSBMS["time"]["month"] = sbms.month;
-  docSBMS["time"]["day"] = sbms.day;
-  docSBMS["time"]["hour"] = sbms.hour;
-  docSBMS["time"]["minute"] = sbms.minute;
-  docSBMS["time"]["second"] = sbms.second;
-  
-  docSBMS["soc"] = sbms.stateOfChargePercent;
+  mq_online = false;
+  if(!mq_stats.connected || xSemaphoreTake(mq_mutex, 0) != pdTRUE) return;
 
-  JsonArray volt = docSBMS.createNestedArray("cellsMV");
-  for(uint8_t i=0; i<8; i++)
+  mqtt.loop();
+  mq_online = mqtt.connected();
+  if(!mq_online)
   {
-    volt.add(sbms.cellVoltageMV[i]);
+    xSemaphoreGive(mq_mutex);
+    mqLastConnectionAttempt = millis() - mq_stats.retryMs; //retry right away, a resumed tls session makes it cheap
+    mq_stats.drops++;
+    mq_stats.connected = false;
+    xTaskNotifyGive(mqtt_task);
   }
+}
 
-  docSBMS["tempInt"] = sbms.temperatureInternalTenthC / 10.0;
-  docSBMS["tempExt"] = sbms.temperatureExternalTenthC / 10.0;
-
-  JsonObject curr = docSBMS.createNestedObject("currentMA");
-
-  curr["battery"] = sbms.batteryCurrentMA;
-  curr["pv1"] = sbms.pv1CurrentMA;
-  curr["pv2"] = sbms.pv2CurrentMA;
-  curr["extLoad"] = sbms.extLoadCurrentMA;
-
-  docSBMS["ad2"] = sbms.ad2;
-  docSBMS["ad3"] = sbms.ad3;
-  docSBMS["ad4"] = sbms.ad4;
-
-  docSBMS["heat1"] = sbms.heat1;
-  docSBMS["heat2"] = sbms.heat2;
-
-  JsonObject flags = docSBMS.createNestedObject("flags");
-
-  flags["OV"] = sbms.getFlag(SbmsData::FlagBit::OV);
-  flags["OVLK"] = sbms.getFlag(SbmsData::FlagBit::OVLK);
-  flags["UV"] = sbms.getFlag(SbmsData::FlagBit::UV);
-  flags["UVLK"] = sbms.getFlag(SbmsData::FlagBit::UVLK);
-  flags["IOT"] = sbms.getFlag(SbmsData::FlagBit::IOT);
-  flags["COC"] = sbms.getFlag(SbmsData::FlagBit::COC);
-  flags["DOC"] = sbms.getFlag(SbmsData::FlagBit::DOC);
-  flags["DSC"] = sbms.getFlag(SbmsData::FlagBit::DSC);
-  flags["CELF"] = sbms.getFlag(SbmsData::FlagBit::CELF);
-  flags["OPEN"] = sbms.getFlag(SbmsData::FlagBit::OPEN);
-  flags["LVC"] = sbms.getFlag(SbmsData::FlagBit::LVC);
-  flags["ECCF"] = sbms.getFlag(SbmsData::FlagBit::ECCF);
-  flags["CFET"] = sbms.getFlag(SbmsData::FlagBit::CFET);
-  flags["EOC"] = sbms.getFlag(SbmsData::FlagBit::EOC);
-  flags["DFET"] = sbms.getFlag(SbmsData::FlagBit::DFET);
+void mqttEndIteration()
+{
+  if(mq_online) xSemaphoreGive(mq_mutex);
+  mq_online = false;
+}
 
-  //optional calculated fields
+#define MQTT_TASK_STACK 10240 //the tls handshake runs here: ecdhe, rsa and parsing the certificate chain
+#define MQTT_TASK_INTERVAL_MS 1000 //woken earlier by a lost connection or new settings
 
-  if(data_sbms_diff)
+//owns connecting and reconnecting, with a low priority on the network core so a broker that is down doesn't hold up the pipeline
+void mqttTask(void *parameter)
+{
+  for(;;)
   {
-    uint16_t min = -1;
-    uint16_t max = 0;
+    ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(MQTT_TASK_INTERVAL_MS));
 
-    for(uint8_t i=0; i<8; i++)
+    if(WiFi.status() == WL_CONNECTED)
     {
-      uint16_t v = sbms.cellVoltageMV[i];
-      if(v > 0 && v < min) min = v;
-      if(v > 0 && v > max) max = v;
+      AllocScope scope(ALLOC_MQTT);
+      mqttUpdate();
     }
-
-    flags["delta"] = max-min;
   }
-
-  return &docSBMS;
 }
 
+//publishes an already serialized payload of any size, the mqtt buffer only holds the header
+bool mqttPublish(const char *topic, const char *payload, size_t len)
+{
+  return mq_online && mqttPublishBuffer(mqtt, mqttTopic(topic), payload, len);
+}
 
-//------------------------- WIFI --------------------
+//a small payload that fits the mqtt buffer, kept by the broker for new subscribers
+bool mqttPublishRetained(const char *topic, const char *payload)
+{
+  return mq_online && mqtt.publish(mqttTopic(topic), payload, true);
+}
 
-void updateWifiState()
+void mqttPublishJson(const JsonDocument *doc, const char *topic)
 {
-  if(ap_fallback && s_sta_enabled)
-  {
-    WiFi.mode(WIFI_MODE_APSTA);
-  }
-  else if(!ap_fallback && s_sta_enabled)
-  {
-    WiFi.mode(WIFI_MODE_STA);
-  }
-  else if(!s_sta_enabled)
-  {
-    WiFi.mode(WIFI_MODE_AP);
-  }
+  if(!mq_online) return;
 
-  if(ap_fallback || !s_sta_enabled)
-  {
-    WiFi.softAP(s_ap_ssid.c_str(), s_ap_password.c_str());
-    delay(100);
-    WiFi.softAPConfig(IPAddress (192, 168, 4, 1), IPAddress (192, 168, 4, 1), IPAddress (255,255,255,0));
-    WiFi.softAPsetHostname("SBMS");
-    ArduinoOTA.setHostname("SBMS");
-  }
-  else
-  {
-    WiFi.softAPdisconnect();
-  }
-  
-  
-  if(s_sta_enabled) {
+  mqtt.beginPublish(mqttTopic(topic), measureJson(*doc), false);
 
-    WiFi.setHostname(s_sta_hostname.c_str());
-    ArduinoOTA.setHostname(s_sta_hostname.c_str());
+  MqttJsonWriter<PubSubClient> writer(mqtt);
+  serializeJson(*doc, writer);
 
-    WiFi.begin(s_sta_ssid.c_str(), s_sta_password.c_str());
-    WiFi.setAutoConnect(true);
-    WiFi.setAutoReconnect(true);
-  }
-  else
-  {
-    WiFi.disconnect();
-  }
+  writer.flush();
 
+  mqtt.endPublish();
+}
+
+
+//------------------------- WIFI --------------------
 
+//hands the settings to the wifi manager, which connects from the loop
+void wifiConfigure()
+{
+  WifiManager::Config config;
+  config.staEnabled = s_sta_enabled;
+  config.hostname = s_sta_hostname;
+  config.ssid = s_sta_ssid;
+  config.password = s_sta_password;
+  config.apSsid = s_ap_ssid;
+  config.apPassword = s_ap_password;
+
+  ArduinoOTA.setHostname(s_sta_enabled ? s_sta_hostname.c_str() : "SBMS");
+  wifi_manager.configure(config);
 }
 
 //-------------------------- OTA ----------------------
 
+//web updates: chunks are written to flash by the writer task, status at /ota
+OtaWriter ota_writer;
+
+#define OTA_FINISH_TIMEOUT_MS 20000 //the last sectors, verification and activation
+
 bool ota_arduino_started = false;
 int ota_arduino_command = 0;
 
@@ -499,18 +593,177 @@ void otaUpdate()
 }
 
 
+//------------------------- LATENCY --------------------
+
+//stages of a sbms frame on its way through the pipeline. All timestamps are cycle counts of the pipeline core, where both tasks run.
+enum LatencyStage : uint8_t {
+  LAT_RECEIVE = 0, //first byte of the line parsed until the ';' was committed to the store
+  LAT_QUEUE, //committed until dequeued by the publish task
+  LAT_DECODE, //dequeued until decoded into SbmsData
+  LAT_SERIALIZE, //decoded until serialized to JSON
+  LAT_MQTT, //handing the payload to mqtt until endPublish() returned
+  LAT_SSE, //handing the payload to eventsData.send() until it returned
+  LAT_TOTAL, //first byte until the last output was handed over
+  LAT_FLAGS, //first byte until a transition of the protection flags was handed over, only frames with one
+  LAT_NUM_STAGES
+};
+
+static const char *latencyStageNames[LAT_NUM_STAGES] = {"receive", "queue", "decode", "serialize", "mqtt", "sse", "total", "flags"};
+
+static LatencyHistogram latency[LAT_NUM_STAGES];
+static portMUX_TYPE latency_mux = portMUX_INITIALIZER_UNLOCKED;
+
+void latencyRecord(LatencyStage stage, uint32_t from, uint32_t to)
+{
+  portENTER_CRITICAL(&latency_mux);
+  latency[stage].record(to - from); //unsigned difference, correct across one counter wrap (~17s at 240MHz)
+  portEXIT_CRITICAL(&latency_mux);
+}
+
+void latencyReset()
+{
+  portENTER_CRITICAL(&latency_mux);
+  for(uint8_t i=0; i<LAT_NUM_STAGES; i++) latency[i].reset();
+  portEXIT_CRITICAL(&latency_mux);
+}
+
+String latencyReport()
+{
+  AllocScope scope(ALLOC_WEB);
+
+  uint32_t mhz = ESP.getCpuFreqMHz();
+
+  String res;
+  res.reserve(100 * LAT_NUM_STAGES);
+  res += "{";
+
+  for(uint8_t i=0; i<LAT_NUM_STAGES; i++)
+  {
+    portENTER_CRITICAL(&latency_mux);
+    LatencyHistogram h = latency[i]; //copy, percentiles are calculated outside of the critical section
+    portEXIT_CRITICAL(&latency_mux);
+
+    char stage[100];
+    snprintf(stage, sizeof(stage), "%s\"%s\":{\"count\":%u,\"p50Us\":%u,\"p99Us\":%u,\"maxUs\":%u}", i ? "," : "", latencyStageNames[i],
+      h.count(), h.percentile(50) / mhz, h.percentile(99) / mhz, h.max() / mhz);
+    res += stage;
+  }
+
+  res += "}";
+  return res;
+}
+
+
 //------------------------- SERIAL --------------------
-#define UART_RX_BUF 1024
+#define UART_RX_BUF 4096 //ring buffer of the driver, holds ~40 ms at 921600 baud while the task is blocked
 #define UART_TX_BUF 0
-#define UART_RES_STRLEN 10
-#define UART_RES_NUM_ELEMENTS 14
+#define UART_READ_CHUNK 256 //bytes copied out of the ring buffer per read, the buffer is carved from the memory budget
+#define UART_TASK_STACK 2048
+#define UART_PRINTF_MAX 128
+#define UART_EVENT_QUEUE_LEN 32
+#define UART_LINE_END ';' //every variable ends with it, the driver wakes the task when it arrives
+#define UART_PATTERN_QUEUE_LEN 32 //line ends the driver remembers until they are read
+#define UART_RES_NUM_ELEMENTS 14 //per source
+
+//WiFi and AsyncTCP run on core 0, the data pipeline (uart and publish task) is pinned to core 1
+#define PIPELINE_CORE 1
+#define UART_TASK_PRIORITY 15
+#define PUBLISH_TASK_PRIORITY 10
+#define PUBLISH_TASK_STACK 6144
+#define LOOP_TASK_STACK 8192 //fixed by the arduino core
+#define MQTT_SERVICE_INTERVAL_MS 100 //max time between two mqtt.loop() calls when no data arrives
+
+//variables with a fixed ID, registered in this order before the uart task starts. Others get the next free ID when first seen.
+enum VarId : uint8_t {
+  VAR_SBMS = 0,
+  VAR_S1,
+  VAR_S2,
+  VAR_XSBMS,
+  VAR_GSBMS,
+  VAR_EA,
+  VAR_EW,
+  VAR_DMPPT,
+  VAR_PV1,
+  VAR_PV2,
+  VAR_BTP,
+  VAR_BTN,
+  VAR_LD,
+  VAR_ELD,
+  VAR_NUM_KNOWN
+};
+
+//result event, one per committed variable
+struct UartEvent {
+  uint8_t source;
+  uint8_t id;
+  uint16_t seq;
+};
+
+struct UartSource;
+
+//name and handler of a variable with a fixed ID. The handler is called from the publish task when the variable has new data,
+//with the cycle count at which the event was dequeued.
+struct VarInfo {
+  const char *name;
+  void (*handler)(UartSource &src, uint8_t id, uint32_t dequeued);
+};
+
+//defined together with the handlers below
+extern const VarInfo knownVars[VAR_NUM_KNOWN];
+
+//pending IDs are used as bits
+static_assert(JsvarStore::MAX_VARS <= 32, "variable IDs must fit in a 32 bit mask");
+
+struct UartStats {
+  uint32_t events; //events received through the queue
+  uint32_t dropped; //events that did not fit in the queue
+  uint32_t coalesced; //values that were superseded before they could be handled
+  uint32_t fifoOverflows; //hardware fifo overflowed, received bytes were lost
+  uint32_t bufferFull; //driver ring buffer was full, received bytes were lost
+  uint32_t frameErrors;
+  uint32_t parityErrors;
+  uint32_t invalidFrames; //sbms frames that parsed but failed validation
+};
+
+//one serial input with its own parser and store. The index is also the uart port number.
+struct UartSource {
+  uint8_t index;
+  bool enabled;
+  JsvarStore store;
+
+  //queue for uart driver events
+  QueueHandle_t uartQueue;
+
+  //IDs whose event was dropped because the queue was full. Only the latest value matters, so they are handled with the next drain.
+  uint32_t pendingIds;
 
-//queue for uart events
-static QueueHandle_t uart_queue;
+  UartStats stats;
 
-//queue for result events
+  //last handled sequence number per variable, to count superseded values
+  uint16_t lastHandledSeq[JsvarStore::MAX_VARS];
+
+  //held while feeding the parser, by the uart task or a replay
+  SemaphoreHandle_t feedMutex;
+
+  //a replay feeds the parser instead of the uart
+  volatile bool replaying;
+
+  //UART_READ_CHUNK bytes, only used by the uart task of the source
+  uint8_t *rxBuf;
+};
+
+static UartSource uart_sources[UART_MAX_SOURCES];
+
+
+//queue for result events of all sources
 static QueueHandle_t uart_result_queue;
 
+//protects the pending IDs and stats of all sources
+static portMUX_TYPE uart_event_mux = portMUX_INITIALIZER_UNLOCKED;
+
+//woken by the uart tasks for every committed variable
+static TaskHandle_t publish_task = NULL;
+
 
 
 void uartPrintf(const char *fmt, ...)
@@ -519,12 +772,10 @@ void uartPrintf(const char *fmt, ...)
   va_list args;
   va_start(args,fmt);//Initialiasing the List 
 
-  size_t size_string=vsnprintf(NULL,0,fmt,args); //Calculating the size of the formed string 
-
-  char string[size_string+1]; //Initialising the string, leave room for 0 byte
-  
+  char string[UART_PRINTF_MAX]; //fixed size on the stack of the caller, longer output is cut off
 
-  vsnprintf(string,size_string+1,fmt,args); //Storing the outptut into the string 
+  size_t size_string=vsnprintf(string,sizeof(string),fmt,args); //Storing the outptut into the string 
+  if(size_string >= sizeof(string)) size_string = sizeof(string) - 1;
 
   va_end(args);
 
@@ -532,126 +783,774 @@ void uartPrintf(const char *fmt, ...)
 
 }
 
+uart_port_t uartPort(const UartSource &src)
+{
+  return (uart_port_t) src.index;
+}
 
-void uartTask(void *parameter)
+void uartCount(UartSource &src, uint32_t UartStats::*counter)
 {
-  uart_event_t event;
-  uint8_t rxBuf[UART_RX_BUF];
+  portENTER_CRITICAL(&uart_event_mux);
+  src.stats.*counter += 1;
+  portEXIT_CRITICAL(&uart_event_mux);
+}
 
-  for(;;)
+//feeds received bytes to the parser. Committed variables are passed on to the publish task. The caller holds the feed mutex.
+//subscribed to every variable of a source, called by the store right after the commit
+void uartCommitted(const JsvarStore::View &var, void *arg)
+{
+  UartSource &src = *(UartSource*)arg;
+  UartEvent parseEvent = {src.index, var.id, var.seq};
+
+  if(!xQueueSendToBack(uart_result_queue, &parseEvent, 0)) //don't wait in case the queue is full
   {
+    portENTER_CRITICAL(&uart_event_mux);
+    src.pendingIds |= 1 << var.id;
+    src.stats.dropped++;
+    portEXIT_CRITICAL(&uart_event_mux);
+  }
 
-    if(xQueueReceive(uart_queue, (void * )&event, (portTickType)portMAX_DELAY)) {
+  if(publish_task) xTaskNotifyGive(publish_task); //the publish task starts last in setup(), events wait in the queue until then
+}
 
-      if (event.type == UART_DATA) {
-        size_t len = 0;
-        ESP_ERROR_CHECK(uart_get_buffered_data_len(UART_NUM_0, (size_t*)&len));
+void uartFeed(UartSource &src, const uint8_t *buf, size_t len)
+{
+  for(size_t i=0; i<len; i++)
+  {
+    src.store.handleChar((char) buf[i]); //commits are delivered to the subscribers
+  }
+}
 
-        size_t readLen = uart_read_bytes(UART_NUM_0, rxBuf, len, 10);
+//reads len bytes from the ring buffer and feeds them to the parser. With gap set, the data after them was lost.
+void uartRead(UartSource &src, size_t len, bool gap = false)
+{
+  xSemaphoreTake(src.feedMutex, portMAX_DELAY);
 
-        for(size_t i=0; i<readLen; i++)
-        {
-          String parsed = varStore.handleChar((char) rxBuf[i]);
+  while(len > 0)
+  {
+    int readLen = uart_read_bytes(uartPort(src), src.rxBuf, len < UART_READ_CHUNK ? len : UART_READ_CHUNK, 0);
+    if(readLen <= 0) break;
+    len -= readLen;
 
-          if(!parsed.isEmpty())
-          {
-            char parseEvent[UART_RES_STRLEN];
-            strlcpy(parseEvent, parsed.c_str(), UART_RES_STRLEN);
+    uartFeed(src, src.rxBuf, readLen);
+  }
 
-            xQueueSendToBack(uart_result_queue, parseEvent, 0); //don't wait in case the queue is full
-          }
-        }
+  if(gap) src.store.markGap();
+
+  xSemaphoreGive(src.feedMutex);
+}
+
+size_t uartBuffered(const UartSource &src)
+{
+  size_t len = 0;
+  uart_get_buffered_data_len(uartPort(src), &len);
+  return len;
+}
+
+//received data was lost after what is in the ring buffer now. Parse what arrived before the loss, so a line
+//completed before it is kept, then drop the line in progress and resync at the next "var ".
+void uartRecover(UartSource &src)
+{
+  uartRead(src, uartBuffered(src), true);
+}
+
+//one task per source, the parameter is the UartSource
+void uartTask(void *parameter)
+{
+  UartSource &src = *(UartSource *)parameter;
+  uart_event_t event;
+
+  AllocTrack::setTaskSubsystem(ALLOC_UART);
+
+  for(;;)
+  {
+
+    if(xQueueReceive(src.uartQueue, (void * )&event, (portTickType)portMAX_DELAY)) {
+
+      if(src.replaying) //the replay owns the parser, discard what is received meanwhile
+      {
+        uart_flush_input(uartPort(src));
+        continue;
       }
-      else
+
+      switch(event.type)
       {
-        varStore.reset();
+        case UART_PATTERN_DET:
+        {
+          //read up to and including the line end, so whole variables arrive per wakeup
+          int pos = uart_pattern_pop_pos(uartPort(src));
+          uartRead(src, pos < 0 ? uartBuffered(src) : pos + 1); //position queue overflowed, take everything
+          break;
+        }
+
+        case UART_DATA:
+          //line ends wake the task, data events only matter if the buffer fills with something that has none
+          if(uartBuffered(src) >= UART_RX_BUF / 2) uartRead(src, uartBuffered(src));
+          break;
+
+        case UART_FIFO_OVF:
+          uartCount(src, &UartStats::fifoOverflows);
+          uartRecover(src);
+          break;
+
+        case UART_BUFFER_FULL:
+          uartCount(src, &UartStats::bufferFull);
+          uartRecover(src);
+          break;
+
+        case UART_FRAME_ERR:
+          uartCount(src, &UartStats::frameErrors);
+          uartRecover(src);
+          break;
+
+        case UART_PARITY_ERR:
+          uartCount(src, &UartStats::parityErrors);
+          uartRecover(src);
+          break;
+
+        default: //break or other events, no data was lost
+          break;
       }
-      
+
     }
   }
 }
 
-String uartPopEvent()
+//drains all queued events, including those that were dropped. Fills a bitmask of the variable IDs with new data per source.
+void uartDrainEvents(uint32_t ids[UART_MAX_SOURCES])
 {
-  char event[UART_RES_STRLEN];
+  UartEvent event;
+  uint32_t events[UART_MAX_SOURCES] = {0};
+
+  for(uint8_t i=0; i<UART_MAX_SOURCES; i++) ids[i] = 0;
 
-  if(xQueueReceive(uart_result_queue, event, 0))
+  while(xQueueReceive(uart_result_queue, &event, 0))
   {
-    return event; //auto-cast to String
+    ids[event.source] |= 1 << event.id;
+    events[event.source]++;
   }
 
-  return String((char*)0); //return empty string without reserving a nullbyte
+  portENTER_CRITICAL(&uart_event_mux);
+  for(uint8_t i=0; i<UART_MAX_SOURCES; i++)
+  {
+    ids[i] |= uart_sources[i].pendingIds;
+    uart_sources[i].pendingIds = 0;
+    uart_sources[i].stats.events += events[i];
+  }
+  portEXIT_CRITICAL(&uart_event_mux);
+}
+
+uint8_t uartEnabledSources()
+{
+  uint8_t num = 0;
+  for(uint8_t i=0; i<UART_MAX_SOURCES; i++)
+  {
+    if(uart_sources[i].enabled) num++;
+  }
+  return num;
 }
 
 
+//needs the uart settings, call after reading them
 void setupSerial()
 {
 
   //create queue for result events
 
-  uart_result_queue = xQueueCreate(UART_RES_NUM_ELEMENTS, UART_RES_STRLEN);
+  uart_result_queue = xQueueCreate(UART_RES_NUM_ELEMENTS * UART_MAX_SOURCES, sizeof(UartEvent));
 
+  static const char *taskNames[UART_MAX_SOURCES] = {"uart0", "uart1", "uart2"};
 
-  //configure uart and create reading task
+  MemBudget::reserve(ALLOC_STORE, "uartSources", sizeof(uart_sources)); //stores of all sources, enabled or not
 
-  uart_config_t uartConfig = {
-        .baud_rate = 921600,
-        .data_bits = UART_DATA_8_BITS,
-        .parity = UART_PARITY_DISABLE,
-        .stop_bits = UART_STOP_BITS_1,
-        .flow_ctrl = UART_HW_FLOWCTRL_DISABLE
-    };
+  for(uint8_t i=0; i<UART_MAX_SOURCES; i++)
+  {
+    UartSource &src = uart_sources[i];
+    src.index = i;
+    src.enabled = i == 0 || s_uart[i].enabled; //the sbms on uart 0 is always read
 
-  uart_param_config(UART_NUM_0, &uartConfig);
+    if(!src.enabled) continue;
 
-  uart_driver_install(UART_NUM_0, UART_RX_BUF, UART_TX_BUF, 20, &uart_queue, 0);
+    src.feedMutex = xSemaphoreCreateMutex();
+    src.rxBuf = (uint8_t*)MemBudget::carve(ALLOC_UART, taskNames[i], UART_READ_CHUNK);
 
-  xTaskCreate(uartTask, "uart", 2048 + UART_RX_BUF, NULL, 15, NULL);
 
-}
+    //assign the fixed IDs before anything can be parsed
 
+    for(uint8_t v=0; v<VAR_NUM_KNOWN; v++)
+    {
+      src.store.registerVar(knownVars[v].name);
+    }
 
+    src.store.subscribe(JsvarStore::ANY_VAR, uartCommitted, &src);
 
 
+    //configure uart and create reading task
 
-void setup()
-{
-  
-  //setup peripherals
-  setupSerial();
+    uart_config_t uartConfig = {
+          .baud_rate = 921600,
+          .data_bits = UART_DATA_8_BITS,
+          .parity = UART_PARITY_DISABLE,
+          .stop_bits = UART_STOP_BITS_1,
+          .flow_ctrl = UART_HW_FLOWCTRL_DISABLE
+      };
 
-  pinMode(LED_BUILTIN, OUTPUT);
+    uart_param_config(uartPort(src), &uartConfig);
 
-  //load settings
-  SPIFFS.begin();
+    //uart 0 keeps its default pins. The default pins of uart 1 are used by the flash, the other sources must be configured.
+    if(i > 0) uart_set_pin(uartPort(src), s_uart[i].txPin, s_uart[i].rxPin, UART_PIN_NO_CHANGE, UART_PIN_NO_CHANGE);
 
-  readSystemSettings();
-  readWifiSettings();
-  readMqttSettings();
-  readDataSettings();
-  
+    uart_driver_install(uartPort(src), UART_RX_BUF, UART_TX_BUF, UART_EVENT_QUEUE_LEN, &src.uartQueue, 0);
 
-  //setup libraries
-  updateWifiState();
-  
-  //mqttSetup(); //will be set up automatically when enabled
-  
-  //setup OTA
-  otaSetup();
-  
+    //raise an event for every line end. No idle time is required around it, the sbms sends continuously.
+    uart_enable_pattern_det_intr(uartPort(src), UART_LINE_END, 1, 10000, 0, 0);
+    uart_pattern_queue_reset(uartPort(src), UART_PATTERN_QUEUE_LEN);
 
+    TaskHandle_t task = NULL;
+    xTaskCreatePinnedToCore(uartTask, taskNames[i], UART_TASK_STACK, &src, UART_TASK_PRIORITY, &task, PIPELINE_CORE);
+    MemBudget::addTask(task, UART_TASK_STACK);
+  }
 
-  //setup webserver
+}
+//------------------------- REPLAY --------------------
+
+//load generator for the parser: replays captured traffic from SPIFFS into the input path of a source, in place of its uart.
+//Controlled through /replay, see the README.
+#define REPLAY_MAX_DATA 4096
+#define REPLAY_TASK_STACK 3072
+#define REPLAY_CHUNK 64 //bytes fed per mutex hold
+#define REPLAY_UNPACED_BYTES 4096 //bytes per burst interval without a baud rate, ~40 Mbaud at 1 ms
+
+struct ReplayConfig {
+  uint8_t source;
+  uint32_t baud; //10 bits per byte on the wire, 0 for as fast as possible
+  uint32_t seconds;
+  uint32_t corruptPpm; //probability of a byte to be replaced with a random one, per million bytes
+  uint8_t truncatePercent; //probability of a line to be cut off at a random position
+  uint32_t burstMs; //data is paced to the baud rate, but released in bursts of this interval
+};
 
-  eventsData.onConnect([](AsyncEventSourceClient *client){
+struct ReplayResult {
+  bool running;
+  uint32_t startTime; //millis
+  uint32_t elapsedMs;
+  uint32_t bytes;
+  uint32_t lines;
+  uint32_t corrupted; //bytes replaced
+  uint32_t truncated; //lines cut off
+  JsvarStore::Stats parserStart; //parser and uart stats when the replay started, reported as differences
+  UartStats uartStart;
+};
 
-    //send event with message "hello!", id current millis
-    // and set reconnect delay to 1 second
-    client->send("hello there!",NULL,millis(),1000);
+static ReplayConfig replay_config;
+static ReplayResult replay_result;
+static volatile bool replay_stop = false;
+
+static uint8_t replay_data[REPLAY_MAX_DATA];
+static size_t replay_len = 0;
+
+//feeds the data in a loop, paced and mangled as configured
+void replayTask(void *parameter)
+{
+  UartSource &src = uart_sources[replay_config.source];
+  ReplayResult &res = replay_result;
+
+  uint8_t chunk[REPLAY_CHUNK];
+  uint64_t start = esp_timer_get_time();
+  uint64_t due = 0; //bytes due by now according to the baud rate
+  size_t pos = 0;
+  bool lineStart = true;
+  bool skipLine = false;
+  uint8_t cutIn = 0; //chars left until the current line is cut off, 0 if it is not
+
+  while(!replay_stop && (esp_timer_get_time() - start) < replay_config.seconds * 1000000ULL)
+  {
+    vTaskDelay(pdMS_TO_TICKS(replay_config.burstMs)); //wait at least a tick, so lower priority tasks on the core keep running
+
+    if(replay_config.baud) due = (esp_timer_get_time() - start) * (replay_config.baud / 10) / 1000000;
+    else due = res.bytes + REPLAY_UNPACED_BYTES;
+
+    while(res.bytes < due && !replay_stop)
+    {
+      size_t len = 0;
+      size_t skipped = 0; //bound, so the loop returns even if a line break never comes
+      while(len < REPLAY_CHUNK && res.bytes + len < due && skipped < REPLAY_MAX_DATA && !replay_stop)
+      {
+        uint8_t c = replay_data[pos++];
+        if(pos == replay_len) pos = 0;
+
+        if(c == '\n')
+        {
+          res.lines++;
+          skipLine = false;
+          cutIn = 0;
+        }
+        else if(skipLine)
+        {
+          skipped++;
+          continue; //a cut off line resumes with the line break, like after a transmission gap
+        }
+        else if(cutIn && --cutIn == 0)
+        {
+          skipLine = true;
+          res.truncated++;
+          skipped++;
+          continue;
+        }
+        else if(lineStart && replay_config.truncatePercent && esp_random() % 100 < replay_config.truncatePercent)
+        {
+          cutIn = 1 + esp_random() % 80; //let the line run for a random length, then cut it off
+        }
+
+        lineStart = c == '\n';
+
+        if(replay_config.corruptPpm && esp_random() % 1000000 < replay_config.corruptPpm)
+        {
+          c = esp_random();
+          res.corrupted++;
+        }
+
+        chunk[len++] = c;
+      }
+
+      if(len == 0) break; //only skipped data, wait for the next burst
+
+      xSemaphoreTake(src.feedMutex, portMAX_DELAY);
+      uartFeed(src, chunk, len);
+      xSemaphoreGive(src.feedMutex);
+
+      res.bytes += len;
+    }
+  }
+
+  xSemaphoreTake(src.feedMutex, portMAX_DELAY);
+  src.store.markGap(); //don't leave a partial line for the uart
+  xSemaphoreGive(src.feedMutex);
+
+  res.elapsedMs = millis() - res.startTime;
+  res.running = false;
+  src.replaying = false;
+
+  vTaskDelete(NULL);
+}
+
+//starts a replay of the given file. Returns false if one is running, the source is disabled or the file is empty or has no line break.
+bool replayStart(const ReplayConfig &config, const char *file)
+{
+  if(replay_result.running || config.source >= UART_MAX_SOURCES || !uart_sources[config.source].enabled) return false;
+
+  fs::File f = SPIFFS.open(file);
+  replay_len = 0;
+  if(f) replay_len = f.read(replay_data, sizeof(replay_data));
+  f.close();
+
+  if(replay_len == 0 || !memchr(replay_data, '\n', replay_len)) return false; //truncated lines resume at a line break
+
+  UartSource &src = uart_sources[config.source];
+
+  replay_config = config;
+  if(replay_config.burstMs == 0) replay_config.burstMs = 1;
+
+  replay_stop = false;
+  replay_result = ReplayResult();
+  replay_result.running = true;
+  replay_result.startTime = millis();
+  replay_result.parserStart = src.store.getStats();
+  portENTER_CRITICAL(&uart_event_mux);
+  replay_result.uartStart = src.stats;
+  portEXIT_CRITICAL(&uart_event_mux);
+
+  //take over the parser, the uart task discards its data from now on
+  src.replaying = true;
+  xSemaphoreTake(src.feedMutex, portMAX_DELAY);
+  src.store.markGap();
+  xSemaphoreGive(src.feedMutex);
+
+  xTaskCreatePinnedToCore(replayTask, "replay", REPLAY_TASK_STACK, NULL, UART_TASK_PRIORITY, NULL, PIPELINE_CORE);
+  return true;
+}
+
+String replayReport()
+{
+  const ReplayResult &res = replay_result;
+  const UartSource &src = uart_sources[replay_config.source];
+
+  JsvarStore::Stats p = src.store.getStats();
+  portENTER_CRITICAL(&uart_event_mux);
+  UartStats s = src.stats;
+  portEXIT_CRITICAL(&uart_event_mux);
+
+  uint32_t elapsed = res.running ? millis() - res.startTime : res.elapsedMs;
+  uint32_t committed = p.committed - res.parserStart.committed;
+
+  char buf[400];
+  snprintf(buf, sizeof(buf), "{\"running\":%s,\"source\":%u,\"baud\":%u,\"elapsedMs\":%u,\"bytes\":%u,\"lines\":%u,\"corrupted\":%u,\"truncated\":%u,"
+                             "\"committed\":%u,\"varsPerSec\":%u,\"parseErrors\":%u,\"gaps\":%u,\"dropped\":%u,\"coalesced\":%u,\"invalidFrames\":%u}",
+    res.running ? "true" : "false", replay_config.source, replay_config.baud, elapsed, res.bytes, res.lines, res.corrupted, res.truncated,
+    committed, elapsed ? (uint32_t)(committed * 1000ULL / elapsed) : 0, p.errors - res.parserStart.errors, p.gaps - res.parserStart.gaps,
+    s.dropped - res.uartStart.dropped, s.coalesced - res.uartStart.coalesced, s.invalidFrames - res.uartStart.invalidFrames);
+
+  return String(buf);
+}
+//------------------------- BENCH --------------------
+
+//microbenchmarks of the pipeline, run on the pipeline core from their own task. Controlled through /bench.
+#define BENCH_TASK_STACK 4096
+
+static BenchSuite::Result bench_results[BenchSuite::NUM_BENCHES];
+static volatile bool bench_running = false;
+static bool bench_done = false;
+static uint8_t bench_rounds = 9;
+
+void benchTask(void *parameter)
+{
+  BenchSuite::run(bench_results, bench_rounds);
+  bench_done = true;
+  bench_running = false;
+  vTaskDelete(NULL);
+}
+
+//above the publish task, so publishing does not end up in the results. The uart tasks still preempt it.
+bool benchStart(uint8_t rounds)
+{
+  if(bench_running) return false;
+  bench_running = true;
+  bench_rounds = rounds;
+  xTaskCreatePinnedToCore(benchTask, "bench", BENCH_TASK_STACK, NULL, PUBLISH_TASK_PRIORITY + 1, NULL, PIPELINE_CORE);
+  return true;
+}
+//------------------------- ALERTS --------------------
+
+//alert rules from /cfg/alerts, compiled once and evaluated by the publish task against every sbms frame.
+//Every source has its own copy of the table, so each keeps its own alert states.
+#define ALERT_POST_QUEUE_LEN 8
+#define ALERT_POST_TASK_STACK 4096
+#define ALERT_POST_TIMEOUT_MS 2000
+
+static AlertRules alert_rules[UART_MAX_SOURCES];
+static SemaphoreHandle_t alert_mutex = NULL; //guards the tables against /alerts while they are recompiled
+static char alert_error[80] = ""; //first compile error of the current configuration
+
+//the http post blocks on the network, it is handed to its own task with everything it needs
+struct AlertPost {
+  char url[96];
+  char body[240];
+};
+
+static QueueHandle_t alert_post_queue = NULL;
+static char alert_post_url[96] = "";
+static uint32_t alert_post_dropped = 0;
+
+void readAlertSettings()
+{
+  auto sAlerts = SPIFFS.open("/cfg/alerts"); //default mode is read
+
+  const size_t capacity = JSON_OBJECT_SIZE(2) + JSON_ARRAY_SIZE(AlertRules::MAX_RULES) + AlertRules::MAX_RULES * JSON_OBJECT_SIZE(5) + 1500;
+  DynamicJsonDocument doc(capacity);
+
+  auto err = deserializeJson(doc, sAlerts);
+
+  xSemaphoreTake(alert_mutex, portMAX_DELAY);
+
+  alert_error[0] = 0;
+  for(uint8_t i=0; i<UART_MAX_SOURCES; i++) alert_rules[i].clear();
+
+  if(err == DeserializationError::Ok)
+  {
+    strlcpy(alert_post_url, doc["post_url"] | "", sizeof(alert_post_url));
+
+    for(JsonObject rule : doc["rules"].as<JsonArray>())
+    {
+      uint8_t actions = 0;
+      if(rule["mqtt"] | true) actions |= AlertRules::ACTION_MQTT;
+      if(rule["sse"] | true) actions |= AlertRules::ACTION_SSE;
+      if(rule["post"] | false) actions |= AlertRules::ACTION_POST;
+
+      const char *name = rule["name"] | "alert";
+      const char *expr = rule["rule"] | "";
+
+      for(uint8_t i=0; i<UART_MAX_SOURCES; i++)
+      {
+        //all tables get the same rules, report an error once
+        if(!alert_rules[i].add(name, expr, actions, alert_error[0] ? nullptr : alert_error, sizeof(alert_error))) break;
+      }
+    }
+  }
+
+  xSemaphoreGive(alert_mutex);
+
+  sAlerts.close();
+}
+
+void alertPostTask(void *parameter)
+{
+  AlertPost post;
+  for(;;)
+  {
+    if(xQueueReceive(alert_post_queue, &post, portMAX_DELAY) != pdTRUE) continue;
+    if(WiFi.status() != WL_CONNECTED) continue;
+
+    HTTPClient http;
+    http.setTimeout(ALERT_POST_TIMEOUT_MS);
+    if(http.begin(post.url))
+    {
+      http.addHeader("Content-Type", "application/json");
+      http.POST((uint8_t*)post.body, strlen(post.body));
+      http.end();
+    }
+  }
+}
+
+//queues a post, never blocks the caller. Returns false if the queue is full.
+bool alertPost(uint8_t source, const char *event)
+{
+  if(alert_post_url[0] == 0) return true;
+
+  AlertPost post;
+  strlcpy(post.url, alert_post_url, sizeof(post.url));
+  snprintf(post.body, sizeof(post.body), "{\"source\":%u,\"event\":%s}", source, event);
+
+  if(xQueueSend(alert_post_queue, &post, 0) == pdTRUE) return true;
+  alert_post_dropped++;
+  return false;
+}
+
+//the post task waits on the network, not on the pipeline core
+void setupAlerts()
+{
+  alert_mutex = xSemaphoreCreateMutex();
+  alert_post_queue = xQueueCreate(ALERT_POST_QUEUE_LEN, sizeof(AlertPost));
+  TaskHandle_t task = NULL;
+  xTaskCreatePinnedToCore(alertPostTask, "alertPost", ALERT_POST_TASK_STACK, NULL, 1, &task, PIPELINE_CORE == 1 ? 0 : 1);
+  MemBudget::addTask(task, ALERT_POST_TASK_STACK);
+  readAlertSettings();
+}
+//------------------------- MODBUS --------------------
+
+//optional Modbus TCP server with a register table per source, see modbusRegisters.hpp for the layout.
+//The tables are updated by the publish task, requests are answered from them on the AsyncTCP task.
+//Changes take effect after a reboot.
+bool modbus_enabled = false;
+uint16_t modbus_port = 502;
+
+static ModbusRegisters modbus_registers[UART_MAX_SOURCES];
+static ModbusSlave modbus_slave(modbus_registers, UART_MAX_SOURCES);
+static ModbusServer modbus_server(modbus_slave);
+
+void readModbusSettings()
+{
+  auto sModbus = SPIFFS.open("/cfg/modbus"); //default mode is read
+
+  const size_t capacity = JSON_OBJECT_SIZE(2) + 100;
+  DynamicJsonDocument doc(capacity);
+
+  auto err = deserializeJson(doc, sModbus);
+
+  if(err == DeserializationError::Ok)
+  {
+    modbus_enabled = doc["enabled"] | modbus_enabled;
+    modbus_port = doc["port"] | modbus_port;
+  }
+
+  sModbus.close();
+}
+
+//after the network stack is up
+void setupModbus()
+{
+  MemBudget::reserve(ALLOC_OTHER, "modbus", sizeof(modbus_registers));
+
+  if(modbus_enabled) modbus_server.begin(modbus_port);
+}
+//------------------------- INFLUXDB --------------------
+
+//every decoded sbms frame as a point in InfluxDB line protocol, written in batches over UDP or HTTP by its own task.
+//Timestamps come from NTP. Until the clock is set the points go without, the server uses the time of arrival then.
+//Changes take effect after a reboot.
+#define INFLUX_TASK_STACK 4096
+#define INFLUX_POLL_MS 200
+#define INFLUX_UDP_MAX_LEN 1400 //one datagram without fragmentation
+#define INFLUX_HTTP_TIMEOUT_MS 3000
+
+bool influx_enabled = false;
+bool influx_udp = true;
+String influx_host = "";
+uint16_t influx_port = 8089;
+String influx_path = "/write?db=sbms&precision=ns"; //http only
+String influx_token = ""; //http only, InfluxDB 2 API token
+String influx_measurement = "sbms";
+uint16_t influx_batch_points = 5;
+uint16_t influx_max_delay = 10; //seconds a point waits for its batch
+String influx_ntp = "pool.ntp.org";
+
+static InfluxBatch influx_batch;
+
+void readInfluxSettings()
+{
+  auto sInflux = SPIFFS.open("/cfg/influx"); //default mode is read
+
+  const size_t capacity = JSON_OBJECT_SIZE(10) + 400;
+  DynamicJsonDocument doc(capacity);
+
+  auto err = deserializeJson(doc, sInflux);
+
+  if(err == DeserializationError::Ok)
+  {
+    influx_enabled = doc["enabled"] | influx_enabled;
+    influx_udp = strcmp(doc["protocol"] | "udp", "http") != 0;
+    influx_host = doc["host"] | influx_host.c_str();
+    influx_port = doc["port"] | influx_port;
+    influx_path = doc["path"] | influx_path.c_str();
+    influx_token = doc["token"] | influx_token.c_str();
+    influx_measurement = doc["measurement"] | influx_measurement.c_str();
+    influx_batch_points = doc["batch"] | influx_batch_points;
+    influx_max_delay = doc["max_delay"] | influx_max_delay;
+    influx_ntp = doc["ntp"] | influx_ntp.c_str();
+  }
+
+  sInflux.close();
+}
+
+//ns since the epoch, 0 while the clock is not set
+uint64_t influxTime()
+{
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  if(tv.tv_sec < 1600000000) return 0;
+  return (uint64_t)tv.tv_sec * 1000000000ULL + (uint64_t)tv.tv_usec * 1000ULL;
+}
+
+bool influxWrite(const char *lines, size_t len)
+{
+  if(influx_udp)
+  {
+    WiFiUDP udp;
+    if(!udp.beginPacket(influx_host.c_str(), influx_port)) return false;
+    udp.write((const uint8_t*)lines, len);
+    return udp.endPacket();
+  }
+
+  HTTPClient http;
+  http.setTimeout(INFLUX_HTTP_TIMEOUT_MS);
+  if(!http.begin(influx_host, influx_port, influx_path)) return false;
+  http.addHeader("Content-Type", "text/plain; charset=utf-8");
+  if(influx_token.length() > 0) http.addHeader("Authorization", "Token " + influx_token);
+  int code = http.POST((uint8_t*)lines, len);
+  http.end();
+  return code >= 200 && code < 300;
+}
+
+//waits on the network, not on the pipeline
+void influxTask(void *parameter)
+{
+  static char lines[InfluxBatch::MAX_BYTES]; //not on the task stack
+
+  for(;;)
+  {
+    vTaskDelay(pdMS_TO_TICKS(INFLUX_POLL_MS));
+    if(WiFi.status() != WL_CONNECTED) continue;
+
+    while(influx_batch.due(millis()))
+    {
+      uint16_t points;
+      size_t len = influx_batch.peek(lines, influx_udp ? INFLUX_UDP_MAX_LEN : sizeof(lines), points);
+      if(len == 0) break;
+      influx_batch.done(len, points, influxWrite(lines, len), millis());
+    }
+  }
+}
+
+//called from the publish task for every decoded frame
+void influxAdd(const UartSourceSettings &settings, uint8_t source, const SbmsData &sbms)
+{
+  char line[InfluxBatch::MAX_LINE_LEN];
+  size_t len = toInfluxSBMS(sbms, influx_measurement.c_str(), source, settings.name.c_str(), influxTime(), line, sizeof(line));
+  if(len < sizeof(line)) influx_batch.add(line, len, millis());
+}
+
+//after the network stack is up
+void setupInflux()
+{
+  MemBudget::reserve(ALLOC_OTHER, "influx", sizeof(influx_batch));
+
+  if(!influx_enabled || influx_host.length() == 0) return;
+
+  if(influx_ntp.length() > 0) configTime(0, 0, influx_ntp.c_str());
+
+  influx_batch.configure(influx_batch_points, influx_max_delay * 1000);
+  TaskHandle_t task = NULL;
+  xTaskCreatePinnedToCore(influxTask, "influx", INFLUX_TASK_STACK, NULL, 1, &task, PIPELINE_CORE == 1 ? 0 : 1);
+  MemBudget::addTask(task, INFLUX_TASK_STACK);
+}
+//defined below, next to loop()
+void setupPublishing();
+CellStats cellStatsCopy(uint8_t source);
+void setupHousekeeping();
+
+void setup()
+{
+  
+  pinMode(LED_BUILTIN, OUTPUT);
+
+  MemBudget::addTask(xTaskGetCurrentTaskHandle(), LOOP_TASK_STACK); //setup() runs on the loop task
+
+  //load settings
+  SPIFFS.begin();
+
+  readSystemSettings();
+  readWifiSettings();
+  readMqttSettings();
+  readDataSettings();
+  readUartSettings();
+  readModbusSettings();
+  readInfluxSettings();
+
+  //setup peripherals
+  setupSerial();
+  setupAlerts();
+  
+
+  //setup libraries
+  wifi_manager.begin();
+  wifiConfigure();
+  
+  //mqttSetup(); //will be set up automatically when enabled
+  
+  //setup OTA
+  otaSetup();
+  
+
+
+  //setup webserver
+
+  eventsData.onConnect([](uint8_t client, AsyncWebServerRequest *request){
+
+    //send event with message "hello!" and set reconnect delay to 1 second.
+    //No id, it would move the position of the browser past the events that are replayed to it
+    eventsData.sendTo(client, "hello there!", NULL, 0, 1000);
   });
 
+  eventsData.setReplayBuffer(sse_replay, sizeof(sse_replay));
+  MemBudget::reserve(ALLOC_SSE, "sseReplay", sizeof(sse_replay));
+
   server.addHandler(&eventsData);
 
+  //a new client gets all variables of its source at once, then only the ones that changed
+  eventsVars.onConnect([](uint8_t client, AsyncWebServerRequest *request){
+    uint8_t source = request->hasParam("source") ? request->getParam("source")->value().toInt() : 0;
+    if(source >= UART_MAX_SOURCES || !uart_sources[source].enabled)
+    {
+      eventsVars.setGroup(client, UART_MAX_SOURCES); //nothing is sent to this group
+      return;
+    }
+
+    eventsVars.setGroup(client, source);
+    eventsVars.sendTo(client, uart_sources[source].store.dumpVars().c_str(), "snapshot", 0, 1000);
+    var_push_reset = true;
+  });
+
+  server.addHandler(&eventsVars);
+
 
   server.on("/", HTTP_GET, [](AsyncWebServerRequest *request){
         request->redirect("/index.html");
@@ -669,7 +1568,14 @@ void setup()
   });
 
   server.on("/rawData", HTTP_GET, [](AsyncWebServerRequest *request){
-        request->send(200, "text/javascript", varStore.dumpVars());
+        uint8_t source = 0; //the sbms the module is plugged into, unless another source is selected with ?source=n
+        if(request->hasParam("source")) source = request->getParam("source")->value().toInt();
+        if(source >= UART_MAX_SOURCES || !uart_sources[source].enabled)
+        {
+          request->send(404, "text/plain", "Not found");
+          return;
+        }
+        request->send(200, "text/javascript", uart_sources[source].store.dumpVars());
     });
   
   server.on("/dummyData", HTTP_GET, [](AsyncWebServerRequest *request){
@@ -680,6 +1586,168 @@ void setup()
       request->send(200, "text/plain", F(VERSION_STR));
     });
 
+  server.on("/stats", HTTP_GET, [](AsyncWebServerRequest *request){
+        char res[400 * UART_MAX_SOURCES];
+        size_t len = snprintf(res, sizeof(res), "{\"sources\":[");
+
+        for(uint8_t i=0; i<UART_MAX_SOURCES; i++)
+        {
+          if(!uart_sources[i].enabled) continue;
+
+          portENTER_CRITICAL(&uart_event_mux);
+          UartStats s = uart_sources[i].stats;
+          portEXIT_CRITICAL(&uart_event_mux);
+          JsvarStore::Stats p = uart_sources[i].store.getStats();
+          len += snprintf(res + len, sizeof(res) - len, "%s{\"source\":%u,\"uart\":{\"events\":%u,\"dropped\":%u,\"coalesced\":%u,\"fifoOverflows\":%u,\"bufferFull\":%u,"
+                                     "\"frameErrors\":%u,\"parityErrors\":%u,\"invalidFrames\":%u},"
+                                     "\"parser\":{\"committed\":%u,\"errors\":%u,\"gaps\":%u,\"slowCallbacks\":%u,\"droppedEvents\":%u}}",
+            i ? "," : "", i, s.events, s.dropped, s.coalesced, s.fifoOverflows, s.bufferFull, s.frameErrors, s.parityErrors, s.invalidFrames,
+            p.committed, p.errors, p.gaps, p.slowCallbacks, p.droppedEvents);
+        }
+
+        snprintf(res + len, sizeof(res) - len, "]}");
+        request->send(200, "application/json", res);
+    });
+
+  server.on("/cells", HTTP_GET, [](AsyncWebServerRequest *request){
+        uint8_t source = request->hasParam("source") ? request->getParam("source")->value().toInt() : 0;
+        if(source >= UART_MAX_SOURCES)
+        {
+          request->send(400, "text/plain", "invalid source");
+          return;
+        }
+
+        char res[600];
+        size_t len = cellStatsCopy(source).toJson(res, sizeof(res));
+        if(len >= sizeof(res)) request->send(500, "text/plain", "buffer too small");
+        else request->send(200, "application/json", res);
+    });
+
+  server.on("/sse", HTTP_GET, [](AsyncWebServerRequest *request){
+        char res[2 * 240 * EventHub::MAX_CLIENTS];
+        size_t len = snprintf(res, sizeof(res), "{\"eData\":");
+        len += eventsData.statsJson(res + len, sizeof(res) - len);
+        if(len < sizeof(res)) len += snprintf(res + len, sizeof(res) - len, ",\"eVars\":");
+        if(len < sizeof(res)) len += eventsVars.statsJson(res + len, sizeof(res) - len);
+        if(len < sizeof(res)) len += snprintf(res + len, sizeof(res) - len, "}");
+        if(len >= sizeof(res)) request->send(500, "text/plain", "buffer too small");
+        else request->send(200, "application/json", res);
+    });
+
+  server.on("/mqtt", HTTP_GET, [](AsyncWebServerRequest *request){
+        MqttStats s = mq_stats;
+        char tls[480] = "null";
+        if(s_mq_tls) mqttTlsClient.statsJson(tls, sizeof(tls));
+        char res[700];
+        snprintf(res, sizeof(res), "{\"enabled\":%s,\"connected\":%s,\"state\":%d,\"attempts\":%u,\"connects\":%u,\"drops\":%u,\"lastConnectMs\":%u,\"connectedS\":%u,\"retryMs\":%u,\"tls\":%s}",
+          s_mq_enabled ? "true" : "false", s.connected ? "true" : "false", mqtt.state(), s.attempts, s.connects, s.drops, s.lastConnectMs,
+          s.connected ? (uint32_t)(millis() - s.connectedAt) / 1000 : 0, s.retryMs, tls);
+        request->send(200, "application/json", res);
+    });
+
+  server.on("/wifi", HTTP_GET, [](AsyncWebServerRequest *request){
+        char res[320];
+        wifi_manager.statsJson(res, sizeof(res));
+        request->send(200, "application/json", res);
+    });
+
+  server.on("/modbus", HTTP_GET, [](AsyncWebServerRequest *request){
+        ModbusSlave::Stats s = modbus_slave.getStats();
+        char res[160];
+        snprintf(res, sizeof(res), "{\"enabled\":%s,\"port\":%u,\"clients\":%u,\"requests\":%u,\"exceptions\":%u,\"malformed\":%u}",
+          modbus_enabled ? "true" : "false", modbus_port, modbus_server.count(), s.requests, s.exceptions, s.malformed);
+        request->send(200, "application/json", res);
+    });
+
+  server.on("/influx", HTTP_GET, [](AsyncWebServerRequest *request){
+        InfluxBatch::Stats s = influx_batch.getStats();
+        char res[220];
+        snprintf(res, sizeof(res), "{\"enabled\":%s,\"timeSet\":%s,\"points\":%u,\"written\":%u,\"batches\":%u,\"failures\":%u,\"dropped\":%u,\"pending\":%u,\"backoffMs\":%u}",
+          influx_enabled ? "true" : "false", influxTime() ? "true" : "false", s.points, s.written, s.batches, s.failures, s.dropped, s.pending, s.backoffMs);
+        request->send(200, "application/json", res);
+    });
+
+  server.on("/alerts", HTTP_GET, [](AsyncWebServerRequest *request){
+        char res[120 * AlertRules::MAX_RULES];
+        size_t len = 0;
+
+        xSemaphoreTake(alert_mutex, portMAX_DELAY);
+        const AlertRules &rules = alert_rules[0];
+        len += snprintf(res + len, sizeof(res) - len, "{\"error\":\"%s\",\"postDropped\":%u,\"rules\":[", alert_error, alert_post_dropped);
+        for(uint8_t r=0; r<rules.size() && len < sizeof(res); r++)
+        {
+          len += snprintf(res + len, sizeof(res) - len, "%s{\"name\":\"%s\",\"rule\":\"%s\",\"active\":[", r ? "," : "", rules.name(r), rules.expr(r));
+          for(uint8_t i=0; i<UART_MAX_SOURCES && len < sizeof(res); i++)
+          {
+            len += snprintf(res + len, sizeof(res) - len, "%s%s", i ? "," : "", alert_rules[i].active(r) ? "true" : "false");
+          }
+          if(len < sizeof(res)) len += snprintf(res + len, sizeof(res) - len, "]}");
+        }
+        xSemaphoreGive(alert_mutex);
+
+        if(len < sizeof(res)) len += snprintf(res + len, sizeof(res) - len, "]}");
+        if(len >= sizeof(res)) request->send(500, "text/plain", "buffer too small");
+        else request->send(200, "application/json", res);
+    });
+
+  server.on("/latency", HTTP_GET, [](AsyncWebServerRequest *request){
+        if(request->hasParam("reset")) latencyReset();
+        request->send(200, "application/json", latencyReport());
+    });
+
+  server.on("/replay", HTTP_GET, [](AsyncWebServerRequest *request){
+        if(request->hasParam("stop")) replay_stop = true;
+
+        if(request->hasParam("start"))
+        {
+          auto param = [request](const char *name, uint32_t def) -> uint32_t {
+            return request->hasParam(name) ? request->getParam(name)->value().toInt() : def;
+          };
+
+          ReplayConfig config;
+          config.source = param("source", 0);
+          config.baud = param("baud", 921600);
+          config.seconds = param("seconds", 10);
+          config.corruptPpm = param("corrupt", 0);
+          config.truncatePercent = param("truncate", 0);
+          config.burstMs = param("burst", 1);
+
+          String file = request->hasParam("file") ? request->getParam("file")->value() : String("/testdata");
+
+          if(!replayStart(config, file.c_str()))
+          {
+            request->send(409, "text/plain", "replay running, source disabled or no data with line breaks");
+            return;
+          }
+        }
+
+        request->send(200, "application/json", replayReport());
+    });
+
+  server.on("/bench", HTTP_GET, [](AsyncWebServerRequest *request){
+        if(request->hasParam("run"))
+        {
+          uint8_t rounds = request->hasParam("rounds") ? request->getParam("rounds")->value().toInt() : 9;
+          if(!benchStart(rounds))
+          {
+            request->send(409, "text/plain", "benchmark running");
+            return;
+          }
+        }
+
+        if(bench_running) request->send(202, "application/json", "{\"running\":true}");
+        else if(!bench_done) request->send(404, "text/plain", "no results, start with /bench?run");
+        else request->send(200, "application/json", BenchSuite::report(bench_results, "esp32"));
+    });
+
+  server.on("/alloc", HTTP_GET, [](AsyncWebServerRequest *request){
+        request->send(200, "application/json", AllocTrack::report());
+    });
+
+  server.on("/memory", HTTP_GET, [](AsyncWebServerRequest *request){
+        request->send(200, "application/json", MemBudget::report());
+    });
+
   server.on("/debug", HTTP_GET, [](AsyncWebServerRequest *request){
 
         size_t num_tasks = uxTaskGetNumberOfTasks();
@@ -725,51 +1793,86 @@ void setup()
     }
     else
     {
-      request->send(200, F("text/html"), F("<form method='POST' action='/update' enctype='multipart/form-data'><input type='file' name='update'><input type='submit' value='Update'></form>"));
+      request->send(200, F("text/html"), F("<form method='POST' action='/update' enctype='multipart/form-data'><input type='text' name='sha256' size='64' placeholder='SHA-256 of the image (optional)'><br><input type='file' name='update'><input type='submit' value='Update'></form>"));
     }
     
   });
   server.on("/update", HTTP_POST, [](AsyncWebServerRequest *request){
-    shouldReboot = !Update.hasError() && web_ota_type_spiffs; // only reboot if we updated the spiffs. this allows to update firmware and spiffs and only reboot if both are done.
-    AsyncWebServerResponse *response = request->beginResponse(200, F("text/plain"), (!Update.hasError())?"OK":"FAIL");
+    WebOtaUpload *upload = (WebOtaUpload*)request->_tempObject;
+    bool ok = false;
+    String res;
+    if(!upload || !upload->owner)
+    {
+      res = String("FAIL: ") + (upload ? upload->error : "no file");
+    }
+    else
+    {
+      OtaWriter::Status status = ota_writer.getStatus();
+      ok = status.state == OtaWriter::DONE;
+      shouldReboot = ok && upload->spiffs; // only reboot if we updated the spiffs. this allows to update firmware and spiffs and only reboot if both are done.
+      res = ok ? String("OK") : String("FAIL: ") + status.error;
+    }
+    AsyncWebServerResponse *response = request->beginResponse(ok ? 200 : 500, F("text/plain"), res);
     response->addHeader("Connection", "close");
     request->send(response);
   },[](AsyncWebServerRequest *request, String filename, size_t index, uint8_t *data, size_t len, bool final){
     if(!index){
-      int type = U_FLASH;
-      if (filename.startsWith(F("spiffs")))
+      WebOtaUpload *upload = (WebOtaUpload*)calloc(1, sizeof(WebOtaUpload));
+      request->_tempObject = upload;
+      if(!upload) return;
+
+      bool spiffs = filename.startsWith(F("spiffs"));
+
+      //expected digest from the query or from a form field before the file
+      String sha256;
+      if(request->hasParam("sha256")) sha256 = request->getParam("sha256")->value();
+      else if(request->hasParam("sha256", true)) sha256 = request->getParam("sha256", true)->value();
+
+      if(system_ota_limit && millis() > 300000)
       {
-        SPIFFS.end();
-        web_ota_type_spiffs = true;
-        type = U_SPIFFS;
+        snprintf(upload->error, sizeof(upload->error), "OTA time limit is passed");
       }
-      else
+      else if(ota_writer.begin(spiffs ? U_SPIFFS : U_FLASH, sha256.c_str(), LED_BUILTIN))
       {
-        web_ota_type_spiffs = false;
+        upload->owner = true;
+        upload->spiffs = spiffs;
+        if(spiffs) SPIFFS.end(); //before the first write to the partition
       }
-      if(!Update.begin(UPDATE_SIZE_UNKNOWN, type, LED_BUILTIN)){
-        // error Update.printError(Serial);
-      }
-    }
-    if(!Update.hasError()){
-      if(Update.write(data, len) != len){
-        // error Update.printError(Serial);
+      else
+      {
+        OtaWriter::Status status = ota_writer.getStatus();
+        bool busy = status.state == OtaWriter::RECEIVING || status.state == OtaWriter::FINISHING;
+        snprintf(upload->error, sizeof(upload->error), "%s", busy ? "update in progress" : status.error);
       }
     }
+
+    //a rejected upload must not touch the update of another one
+    WebOtaUpload *upload = (WebOtaUpload*)request->_tempObject;
+    if(!upload || !upload->owner) return;
+
+    ota_writer.write(data, len); //ignored once the update failed
+
     if(final){
-      if(Update.end(true)){
-        // success
-        if(web_ota_type_spiffs)
-        {
-          SPIFFS.begin();
-        }
-      } else {
-        // error Update.printError(Serial);
+      ota_writer.end(OTA_FINISH_TIMEOUT_MS);
+      if(upload->spiffs)
+      {
+        SPIFFS.begin(); //mount again, the old image if the update failed
       }
     }
   });
 
+  server.on("/ota", HTTP_GET, [](AsyncWebServerRequest *request){
+        char res[300];
+        ota_writer.statusJson(res, sizeof(res));
+        request->send(200, "application/json", res);
+    });
+
 
+  //decoded values for pollers: /api/sbms?source=n, /api/flags?source=n and /api/pack, /api/ lists them
+  server.addHandler(&api_cache);
+
+  //the web interface is compiled in, SPIFFS only serves files that are not part of the bundle
+  server.addHandler(&web_assets);
   server.serveStatic("/", SPIFFS, "/dist/").setCacheControl("max-age=600"); // Cache static responses for 10 minutes (600 seconds)
 
   server.onNotFound([](AsyncWebServerRequest *request){
@@ -790,7 +1893,19 @@ void setup()
       f.write(data, len);
       request->send(200, "text/plain", "saved");
       readMqttSettings();
-      if(mqtt.connected()) mqtt.disconnect(); //cause reinitialization, even if config failed. We want to see the problem immediately rather than later.
+      mqSettingsChanged = true; //the mqtt task reconnects
+      if(mqtt_task) xTaskNotifyGive(mqtt_task);
+    }
+    else if (request->url() == "/cfg/mqtt_ca") {
+      fs::File f = SPIFFS.open(MQTT_CA_FILE, index == 0 ? "w" : "a"); //a certificate chain may come in several parts
+      f.write(data, len);
+      f.close();
+      if(index + len >= total)
+      {
+        request->send(200, "text/plain", "saved");
+        mqSettingsChanged = true;
+        if(mqtt_task) xTaskNotifyGive(mqtt_task);
+      }
     }
     else if (request->url() == "/cfg/data") {
       fs::File f = SPIFFS.open("/cfg/data", "w");
@@ -804,15 +1919,42 @@ void setup()
       request->send(200, "text/plain", "saved");
       readSystemSettings();
     }
+    else if (request->url() == "/cfg/uart") {
+      fs::File f = SPIFFS.open("/cfg/uart", "w");
+      f.write(data, len);
+      request->send(200, "text/plain", "saved, reboot to apply");
+    }
+    else if (request->url() == "/cfg/modbus") {
+      fs::File f = SPIFFS.open("/cfg/modbus", "w");
+      f.write(data, len);
+      request->send(200, "text/plain", "saved, reboot to apply");
+    }
+    else if (request->url() == "/cfg/influx") {
+      fs::File f = SPIFFS.open("/cfg/influx", "w");
+      f.write(data, len);
+      request->send(200, "text/plain", "saved, reboot to apply");
+    }
+    else if (request->url() == "/cfg/alerts") {
+      fs::File f = SPIFFS.open("/cfg/alerts", "w");
+      f.write(data, len);
+      request->send(200, "text/plain", "saved");
+      alertSettingsChanged = true;
+    }
 
   });
 
   
   server.begin();
+  setupModbus();
+  setupInflux();
   
 
+  //start the pipeline and periodic tasks last, everything they use is set up now
+  setupPublishing();
+  setupHousekeeping();
 }
 
+//runs from the housekeeping timer
 void updateLed()
 {
   if(s_sta_enabled && WiFi.status() == WL_CONNECTED)
@@ -820,7 +1962,7 @@ void updateLed()
     digitalWrite(BUILTIN_LED, millis()%2000 < 1900);
   }
   else if(s_sta_enabled) {
-    if(ap_fallback){
+    if(wifi_manager.apActive()){
       digitalWrite(BUILTIN_LED, millis()%500 < 100);
     }
     else {
@@ -833,109 +1975,597 @@ void updateLed()
 
 }
 
+//never blocks, reconnects are scheduled by the wifi manager
 bool handleWiFi()
 {
-  auto t = millis();
-
   if(wifiSettingsChanged)
   {
     wifiSettingsChanged = false;
-    lastWiFiTime = t + 5000; //give it a little extra time
-    lastWifiRetryTime = t;
-    ap_fallback = false;
-    updateWifiState();
-    
+    wifiConfigure();
   }
 
-  if(s_sta_enabled && WiFi.status() == WL_CONNECTED)
+  wifi_manager.update();
+
+  return wifi_manager.connected();
+}
+
+//serialized sbms frame for all outputs, carved by setupPublishing()
+#define JSON_BUFFER_SIZE 2000
+char *jsonBuffer = NULL;
+static uint8_t json_buffer_block;
+
+#define FLAGS_JSON_SIZE 300
+#define PACK_JSON_SIZE 120
+
+//entries of api_cache, -1 for disabled sources
+static int8_t api_sbms[UART_MAX_SOURCES];
+static int8_t api_flags[UART_MAX_SOURCES];
+static int8_t api_pack;
+
+//------------------------- VARIABLE HANDLERS --------------------
+
+//topic and event name of a variable: "<source name>/<var>", or just "<var>" for a source without a name
+const char *sourceTopic(const UartSource &src, const char *var, char *buf, size_t len)
+{
+  const String &name = s_uart[src.index].name;
+  if(name.isEmpty()) snprintf(buf, len, "%s", var);
+  else snprintf(buf, len, "%s/%s", name.c_str(), var);
+  return buf;
+}
+
+//latest values of every unit, combined into pack level values when more than one source is enabled
+struct UnitValues {
+  uint32_t time; //millis of the last update, 0 if never
+  int32_t batteryCurrentMA;
+  uint16_t minCellMV;
+  uint16_t maxCellMV;
+};
+
+static UnitValues unit_values[UART_MAX_SOURCES];
+
+#define UNIT_TIMEOUT_MS 5000 //units without data for this long are left out of the pack values
+
+void updatePack(const UartSource &src, const SbmsData &sbms)
+{
+  UnitValues &unit = unit_values[src.index];
+  unit.time = millis() | 1; //never 0 once updated
+  unit.batteryCurrentMA = sbms.batteryCurrentMA;
+  sbms.cellRange(unit.minCellMV, unit.maxCellMV);
+}
+
+void publishPack(bool toMqtt, bool toEvents)
+{
+  static uint32_t seq = 0; //ETag of /api/pack
+
+  bool toApi = api_cache.wanted(api_pack);
+  if(!toMqtt && !toEvents && !toApi) return;
+
+  uint8_t units = 0;
+  int32_t currentMA = 0;
+  uint16_t minCellMV = -1;
+  uint16_t maxCellMV = 0;
+  uint32_t now = millis();
+
+  for(uint8_t i=0; i<UART_MAX_SOURCES; i++)
   {
-    lastWiFiTime = t;
-    if(ap_fallback) {
-      ap_fallback = false;
-      updateWifiState();
-    }
-    
+    const UnitValues &unit = unit_values[i];
+    if(!uart_sources[i].enabled || unit.time == 0 || now - unit.time > UNIT_TIMEOUT_MS) continue;
+
+    units++;
+    currentMA += unit.batteryCurrentMA;
+    if(unit.maxCellMV > 0 && unit.minCellMV < minCellMV) minCellMV = unit.minCellMV; //0 if the unit reports no cells
+    if(unit.maxCellMV > maxCellMV) maxCellMV = unit.maxCellMV;
   }
-  else if(s_sta_enabled && WiFi.status() != WL_CONNECTED)
+
+  if(units == 0) return;
+
+  char pack[PACK_JSON_SIZE];
+  size_t len = snprintf(pack, sizeof(pack), "{\"units\":%u,\"currentMA\":%d,\"minCellMV\":%u,\"maxCellMV\":%u,\"deltaMV\":%u}",
+    units, currentMA, minCellMV, maxCellMV, maxCellMV >= minCellMV ? maxCellMV - minCellMV : 0);
+
+  if(toApi) api_cache.update(api_pack, ++seq, pack, len);
+
+  if(toMqtt)
   {
-    
-    if(t-lastWifiRetryTime > 2000) //continue retrying every 2s even if AP is on
+    AllocScope scope(ALLOC_MQTT);
+    mqttPublish("pack", pack, len);
+  }
+
+  if(toEvents)
+  {
+    AllocScope scope(ALLOC_SSE);
+    eventsData.send(pack, "pack", millis());
+  }
+}
+
+//per cell statistics of every source. Updated by the publish task, read by the web server under the lock.
+static CellStats cell_stats[UART_MAX_SOURCES];
+static uint32_t cell_stats_published[UART_MAX_SOURCES];
+static portMUX_TYPE cell_stats_mux = portMUX_INITIALIZER_UNLOCKED;
+
+//copy of the statistics of a source, consistent with a single frame
+CellStats cellStatsCopy(uint8_t source)
+{
+  portENTER_CRITICAL(&cell_stats_mux);
+  CellStats copy = cell_stats[source];
+  portEXIT_CRITICAL(&cell_stats_mux);
+  return copy;
+}
+
+void updateCellStats(const UartSource &src, const SbmsData &sbms, bool toMqtt)
+{
+  uint32_t now = millis();
+
+  portENTER_CRITICAL(&cell_stats_mux);
+  CellStats &stats = cell_stats[src.index];
+  stats.setThresholds(data_cell_low_mv, data_cell_high_mv);
+  stats.update(sbms, now);
+  portEXIT_CRITICAL(&cell_stats_mux);
+
+  if(!toMqtt || now - cell_stats_published[src.index] < data_cells_interval * 1000UL) return;
+  cell_stats_published[src.index] = now;
+
+  char json[600];
+  size_t len = cellStatsCopy(src.index).toJson(json, sizeof(json));
+  if(len >= sizeof(json)) return;
+
+  char topic[MQTT_TOPIC_MAX_LEN];
+  AllocScope scope(ALLOC_MQTT);
+  mqttPublish(sourceTopic(src, "cells", topic, sizeof(topic)), json, len);
+}
+
+//protection flags of every source as of the last frame
+static SbmsFlagWatch flag_watch[UART_MAX_SOURCES];
+static bool flags_unsent[UART_MAX_SOURCES]; //the last transition didn't make it to the broker, the state is sent again
+
+//publishes transitions of the protection flags as soon as the frame is decoded, ahead of everything else done with it and not
+//limited by sbms_interval. Retained, so the topic holds the current state.
+void publishFlags(const UartSource &src, const SbmsData &sbms, bool toEvents, uint16_t seq, uint32_t firstByte)
+{
+  bool changed = flag_watch[src.index].update(sbms.flags);
+  bool toMqtt = s_mq_enabled && (changed || (flags_unsent[src.index] && mq_online));
+  bool toApi = api_cache.wanted(api_flags[src.index]) && (changed || api_cache.waiting(api_flags[src.index]));
+  if(!changed && !toMqtt && !toApi) return;
+
+  char json[FLAGS_JSON_SIZE];
+  size_t len = flag_watch[src.index].toJson(json, sizeof(json));
+  if(len >= sizeof(json)) return;
+
+  char topic[MQTT_TOPIC_MAX_LEN];
+  sourceTopic(src, "flags", topic, sizeof(topic));
+
+  if(toMqtt)
+  {
+    AllocScope scope(ALLOC_MQTT);
+    flags_unsent[src.index] = !mqtt.publish(mqttTopic(topic), json, true);
+  }
+
+  if(toEvents && changed)
+  {
+    AllocScope scope(ALLOC_SSE);
+    eventsData.send(json, topic, millis(), nullptr, EventHub::ALL_GROUPS, true); //ahead of the frames a slow client still waits for
+  }
+
+  if(toApi) api_cache.update(api_flags[src.index], seq, json, len);
+
+  if(changed) latencyRecord(LAT_FLAGS, firstByte, ESP.getCycleCount());
+}
+
+//evaluates the alert rules and acts on every raised or cleared alert. MQTT messages are retained, so the topic holds the current state.
+void raiseAlerts(const UartSource &src, const SbmsData &sbms)
+{
+  AlertRules &rules = alert_rules[src.index];
+  if(rules.size() == 0) return;
+
+  AlertRules::Event events[AlertRules::MAX_RULES];
+  uint8_t numEvents = rules.evaluate(sbms, millis(), events, AlertRules::MAX_RULES);
+
+  for(uint8_t i=0; i<numEvents; i++)
+  {
+    const AlertRules::Event &event = events[i];
+    uint8_t actions = rules.actions(event.rule);
+
+    char json[200];
+    if(rules.eventJson(event, json, sizeof(json)) >= sizeof(json)) continue;
+
+    char var[8 + AlertRules::MAX_NAME_LEN];
+    snprintf(var, sizeof(var), "alert/%s", rules.name(event.rule));
+    char topic[MQTT_TOPIC_MAX_LEN];
+    sourceTopic(src, var, topic, sizeof(topic));
+
+    if((actions & AlertRules::ACTION_MQTT) && mq_online)
     {
-      lastWifiRetryTime = t;
-      updateWifiState();
+      AllocScope scope(ALLOC_MQTT);
+      mqttPublishRetained(topic, json);
     }
-    else if(t-lastWiFiTime > 20000 && !ap_fallback) //enable AP after 20s
+
+    if((actions & AlertRules::ACTION_SSE) && eventsData.listening())
     {
-      lastWifiRetryTime = t;
-      ap_fallback = true;
-      updateWifiState();
+      AllocScope scope(ALLOC_SSE);
+      eventsData.send(json, "alert", millis(), topic); //one pending message per alert, not per event name
     }
-    
+
+    if(actions & AlertRules::ACTION_POST) alertPost(src.index, json);
+  }
+}
+
+static uint32_t sbms_published[UART_MAX_SOURCES]; //millis of the last frame published of every source
+
+void handleSbmsVar(UartSource &src, uint8_t id, uint32_t dequeued)
+{
+  char sbmsString[JsvarStore::MAX_CONTENT_LEN + 1];
+  JsvarStore::Trace trace;
+  uint16_t seq;
+  src.store.getVar(id, sbmsString, sizeof(sbmsString), &seq, &trace);
+
+  if(!SbmsData::isValid(sbmsString)) //corrupted on the wire, don't publish garbage
+  {
+    uartCount(src, &UartStats::invalidFrames);
+    return;
+  }
+
+  bool listening = eventsData.listening(); //also kept for a while after the last client left, for its replay
+  bool toFlags = data_flags_enabled && (s_mq_enabled || listening || api_cache.wanted(api_flags[src.index]));
+  bool toApi = api_cache.wanted(api_sbms[src.index]); //not limited by sbms_interval, it only copies
+
+  //frames and pack values go out once per sbms_interval, everything else sees every frame
+  uint32_t now = millis();
+  bool due = data_sbms_interval == 0 || now - sbms_published[src.index] >= data_sbms_interval * 1000UL;
+
+  bool toMqtt = mq_online && data_sbms_enabled && due;
+  bool toEvents = listening && due;
+  bool pack = uartEnabledSources() > 1;
+
+  //with only the raw passthrough left, the frame is not decoded at all
+  if(!toMqtt && !toEvents && !toApi && !toFlags && !pack && !data_cells_enabled && !modbus_enabled && !influx_enabled && alert_rules[src.index].size() == 0) return;
+
+  AllocScope decodeScope(ALLOC_DECODE);
+  SbmsData sbms(sbmsString);
+
+  uint32_t decoded = ESP.getCycleCount();
+
+  if(toFlags) publishFlags(src, sbms, listening, seq, trace.firstByte);
+
+  latencyRecord(LAT_RECEIVE, trace.firstByte, trace.commit);
+  latencyRecord(LAT_QUEUE, trace.commit, dequeued);
+  latencyRecord(LAT_DECODE, dequeued, decoded);
+
+  if(pack) updatePack(src, sbms);
+
+  if(data_cells_enabled) updateCellStats(src, sbms, mq_online);
+
+  if(modbus_enabled) modbus_registers[src.index].update(sbms, millis());
+
+  if(influx_enabled) influxAdd(s_uart[src.index], src.index, sbms);
+
+  raiseAlerts(src, sbms);
+
+  if(!toMqtt && !toEvents && !toApi)
+  {
+    if(pack) publishPack(false, false); //still updates /api/pack
+    return;
+  }
+  if(toMqtt || toEvents) sbms_published[src.index] = now;
+
+  //serialize once for all outputs
+  size_t len;
+  {
+    AllocScope scope(ALLOC_JSON);
+    len = serializeJson(*toJsonSBMS(sbms, data_sbms_diff), jsonBuffer, JSON_BUFFER_SIZE);
   }
+  MemBudget::used(json_buffer_block, len + 1);
+
+  uint32_t serialized = ESP.getCycleCount();
+  latencyRecord(LAT_SERIALIZE, decoded, serialized);
+
+  if(toApi) api_cache.update(api_sbms[src.index], seq, jsonBuffer, len);
+
+  uint32_t delivered = serialized;
+
+  char topic[MQTT_TOPIC_MAX_LEN];
+  sourceTopic(src, "sbms", topic, sizeof(topic));
 
-  return WiFi.status() == WL_CONNECTED;
+  if(toMqtt)
+  {
+    AllocScope scope(ALLOC_MQTT);
+    uint32_t start = ESP.getCycleCount();
+    mqttPublish(topic, jsonBuffer, len);
+    delivered = ESP.getCycleCount();
+    latencyRecord(LAT_MQTT, start, delivered);
+  }
+
+  if(toEvents)
+  {
+    AllocScope scope(ALLOC_SSE);
+    uint32_t start = ESP.getCycleCount();
+    eventsData.send(jsonBuffer, topic, millis()); //a slow client only keeps the newest frame of each topic
+    delivered = ESP.getCycleCount();
+    latencyRecord(LAT_SSE, start, delivered);
+  }
+
+  latencyRecord(LAT_TOTAL, trace.firstByte, delivered);
+
+  if(pack) publishPack(toMqtt, toEvents);
 }
 
-char jsonBuffer[2000];
+//charge (eA) and energy (eW) counters, only used by the modbus table so far
+void handleCounterVar(UartSource &src, uint8_t id, uint32_t dequeued)
+{
+  if(!modbus_enabled) return;
 
-void loop()
+  char content[JsvarStore::MAX_CONTENT_LEN + 1];
+  src.store.getVar(id, content, sizeof(content));
+  if(!SbmsCounters::isValid(content))
+  {
+    uartCount(src, &UartStats::invalidFrames);
+    return;
+  }
+
+  SbmsCounters counters(content);
+  if(id == VAR_EA) modbus_registers[src.index].updateCharge(counters);
+  else modbus_registers[src.index].updateEnergy(counters);
+}
+
+void handleS2Var(UartSource &src, uint8_t id, uint32_t dequeued)
 {
-  // reboot if requested from any source after 1 second (allow time for cpu0 to process networking)
-  if(shouldReboot)
+  char s2array[JsvarStore::MAX_CONTENT_LEN + 1];
+  src.store.getVar(id, s2array, sizeof(s2array));
+
+  char topic[MQTT_TOPIC_MAX_LEN];
+  AllocScope scope(ALLOC_MQTT);
+  if(mq_online && data_s2_enabled) mqttPublish(sourceTopic(src, "s2", topic, sizeof(topic)), s2array, strlen(s2array));
+}
+
+//dispatch table, indexed by VarId. The order must match the enum.
+const VarInfo knownVars[VAR_NUM_KNOWN] = {
+  {"sbms", handleSbmsVar},
+  {"s1", nullptr},
+  {"s2", handleS2Var},
+  {"xsbms", nullptr},
+  {"gsbms", nullptr},
+  {"eA", handleCounterVar},
+  {"eW", handleCounterVar},
+  {"dmppt", nullptr},
+  {"PV1", nullptr},
+  {"PV2", nullptr},
+  {"Btp", nullptr},
+  {"Btn", nullptr},
+  {"Ld", nullptr},
+  {"ELd", nullptr}
+};
+
+//sbms, s1 and the daily arrays
+#define RAW_VARS_DEFAULT ((1UL << VAR_SBMS) | (1UL << VAR_S1) | (1UL << VAR_PV1) | (1UL << VAR_PV2) | (1UL << VAR_BTP) | (1UL << VAR_BTN) | (1UL << VAR_LD) | (1UL << VAR_ELD))
+
+uint32_t rawVarMask(JsonArrayConst names)
+{
+  uint32_t mask = 0;
+  for(JsonVariantConst name : names)
   {
-    delay(1000);
-    ESP.restart();
+    for(uint8_t id=0; id<VAR_NUM_KNOWN; id++)
+    {
+      if(strcmp(knownVars[id].name, name | "") == 0) mask |= 1UL << id;
+    }
   }
+  return mask;
+}
 
-  otaUpdate();
+//receive time of a line in ms since the epoch, or since boot while the clock is not set
+uint64_t rawTime(uint32_t commit)
+{
+  uint32_t ageMs = (ESP.getCycleCount() - commit) / (ESP.getCpuFreqMHz() * 1000);
 
-  bool connected = handleWiFi();
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  uint64_t now = tv.tv_sec >= 1600000000 ? (uint64_t)tv.tv_sec * 1000 + tv.tv_usec / 1000 : millis();
+  return now - ageMs;
+}
 
-  updateLed();
+//the content exactly as stored, with its sequence number and receive time: "<seq> <time> <content>", decoded by lib/sbmsDecode
+struct RawMessage {
+  size_t len;
+  char data[28 + JsvarStore::MAX_CONTENT_LEN + 1];
+};
+
+void publishRaw(const UartSource &src, uint8_t id)
+{
+  RawMessage msg = {0};
+
+  src.store.readVar(id, [](const JsvarStore::View &view, void *arg){
+    RawMessage &msg = *(RawMessage*)arg;
+    msg.len = sbmsFormatRaw(msg.data, sizeof(msg.data), view.seq, rawTime(view.trace.commit), view.data, view.length);
+  }, &msg);
+
+  if(msg.len == 0 || msg.len >= sizeof(msg.data)) return;
+
+  char var[5 + JsvarStore::MAX_NAME_LEN];
+  snprintf(var, sizeof(var), "raw/%s", src.store.getName(id));
+  char topic[MQTT_TOPIC_MAX_LEN];
+
+  AllocScope scope(ALLOC_MQTT);
+  mqttPublish(sourceTopic(src, var, topic, sizeof(topic)), msg.data, msg.len);
+}
 
-  if(connected)
+//content hash of every variable as last pushed to /eVars, a variable is only sent again when it changed.
+//Large arrays like the daily history are repeated by the sbms every few seconds but change rarely.
+static uint32_t var_push_hash[UART_MAX_SOURCES][JsvarStore::MAX_VARS];
+
+//FNV-1a
+uint32_t varHash(const char *data, size_t len)
+{
+  uint32_t hash = 2166136261u;
+  for(size_t i=0; i<len; i++)
   {
-    mqttUpdate();
+    hash ^= (uint8_t)data[i];
+    hash *= 16777619u;
   }
+  return hash;
+}
 
+//the original line, the page evaluates it like /rawData
+struct VarLine {
+  bool changed;
+  uint32_t *hash;
+  char line[4 + JsvarStore::MAX_NAME_LEN + 1 + JsvarStore::MAX_CONTENT_LEN + 2];
+};
 
-  //pop one event per loop
-  String uartEvent = uartPopEvent();
+void pushVar(const UartSource &src, uint8_t id)
+{
+  VarLine var = {false, &var_push_hash[src.index][id]};
+
+  //hash in place, copy only what changed
+  src.store.readVar(id, [](const JsvarStore::View &view, void *arg){
+    VarLine &var = *(VarLine*)arg;
+    uint32_t hash = varHash(view.data, view.length);
+    if(hash == *var.hash) return;
+    *var.hash = hash;
+    var.changed = true;
+    snprintf(var.line, sizeof(var.line), "var %s=%s;", view.name, view.data);
+  }, &var);
+
+  if(!var.changed) return;
+
+  AllocScope scope(ALLOC_SSE);
+  eventsVars.send(var.line, "var", 0, src.store.getName(id), src.index);
+}
 
-  if(!uartEvent.isEmpty())
+void handleVars(UartSource &src, uint32_t ids)
+{
+  uint32_t dequeued = ESP.getCycleCount();
+
+  for(uint8_t id = 0; ids != 0; id++, ids >>= 1)
   {
-    if(uartEvent == "sbms") //this guarantees the variable is stored in the varStore so we can get it
+    if(!(ids & 1)) continue;
+
+    uint16_t seq = src.store.getSeq(id);
+    uint16_t skipped = seq - src.lastHandledSeq[id] - 1;
+    src.lastHandledSeq[id] = seq;
+
+    if(skipped > 0 && skipped < 0x8000) //ignore the wrap on the first event
     {
-      auto sbms = SbmsData(varStore.getVar("sbms"));
+      portENTER_CRITICAL(&uart_event_mux);
+      src.stats.coalesced += skipped;
+      portEXIT_CRITICAL(&uart_event_mux);
+    }
 
-      if((s_mq_enabled && data_sbms_enabled) || eventsData.count())
-      {
-        JsonDocument *doc = toJsonSBMS(sbms);
+    if(id < VAR_NUM_KNOWN && knownVars[id].handler) //this guarantees the variable is stored in the store so we can get it
+    {
+      knownVars[id].handler(src, id, dequeued);
+    }
 
-        if(s_mq_enabled && data_sbms_enabled)
-        {
-          mqttPublishJson( doc, "sbms");
-        }
+    uint32_t rawVars = data_raw_vars == RAW_VARS_UNSET ? RAW_VARS_DEFAULT : data_raw_vars;
+    if(data_raw_enabled && mq_online && (rawVars & (1UL << id))) publishRaw(src, id);
 
-        if(eventsData.count())
-        {
-          //size_t sz = measureJson(*doc) + 1;
-          //char buf[sz];
-          serializeJson(*doc, jsonBuffer, 2000);
-          eventsData.send(jsonBuffer, "sbms", millis());
-        }
-      }
+    if(eventsVars.count() > 0) pushVar(src, id);
+  }
+}
+//publishes new data. Woken by the uart tasks for every committed variable, so the latency from a finished line
+//to publication does not depend on anything else going on. The mqtt task connects, see mqttBeginIteration().
+void publishTask(void *parameter)
+{
+  for(;;)
+  {
+    ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(MQTT_SERVICE_INTERVAL_MS));
+
+    AllocTrack::beginIteration();
 
-     
+    if(alertSettingsChanged) //recompile in the task that evaluates the rules
+    {
+      alertSettingsChanged = false;
+      readAlertSettings();
     }
-    else if(uartEvent == "s2") //this guarantees the variable is stored in the varStore so we can get it
+
     {
-      auto s2array = varStore.getVar("s2");
+      AllocScope scope(ALLOC_MQTT);
+      mqttBeginIteration();
+    }
 
-      if(s_mq_enabled && data_s2_enabled) mqtt.publish((s_mq_prefix + "s2").c_str(), s2array.c_str());
+    if(var_push_reset)
+    {
+      var_push_reset = false;
+      memset(var_push_hash, 0, sizeof(var_push_hash));
     }
+
+    //drain all events, each variable is handled once with its latest value
+    uint32_t ids[UART_MAX_SOURCES];
+    uartDrainEvents(ids);
+
+    for(uint8_t i=0; i<UART_MAX_SOURCES; i++)
+    {
+      if(ids[i]) handleVars(uart_sources[i], ids[i]);
+    }
+
+    mqttEndIteration();
+
+    AllocTrack::endIteration();
+  }
+}
+
+void setupPublishing()
+{
+  jsonBuffer = (char*)MemBudget::carve(ALLOC_JSON, "jsonBuffer", JSON_BUFFER_SIZE, &json_buffer_block);
+  MemBudget::reserve(ALLOC_JSON, "docSBMS", SBMS_JSON_CAPACITY);
+  MemBudget::reserve(ALLOC_OTHER, "cellStats", sizeof(cell_stats));
+  MemBudget::reserve(ALLOC_SSE, "varPushHash", sizeof(var_push_hash));
+
+  //the buffers of the api entries are allocated with their first request
+  for(uint8_t i=0; i<UART_MAX_SOURCES; i++)
+  {
+    api_sbms[i] = uart_sources[i].enabled ? api_cache.add("sbms", i, JSON_BUFFER_SIZE) : -1;
+    api_flags[i] = uart_sources[i].enabled ? api_cache.add("flags", i, FLAGS_JSON_SIZE) : -1;
+  }
+  api_pack = api_cache.add("pack", 0, PACK_JSON_SIZE);
+
+  mq_mutex = xSemaphoreCreateMutex();
+  xTaskCreatePinnedToCore(publishTask, "publish", PUBLISH_TASK_STACK, NULL, PUBLISH_TASK_PRIORITY, &publish_task, PIPELINE_CORE);
+  MemBudget::addTask(publish_task, PUBLISH_TASK_STACK);
+
+  xTaskCreatePinnedToCore(mqttTask, "mqtt", MQTT_TASK_STACK, NULL, 1, &mqtt_task, PIPELINE_CORE == 1 ? 0 : 1);
+  MemBudget::addTask(mqtt_task, MQTT_TASK_STACK);
+}
+
+#define HOUSEKEEPING_INTERVAL_MS 50 //resolution of the LED patterns
+#define LOOP_INTERVAL_MS 10
+
+//periodic housekeeping that does not block, run from the esp_timer task
+void housekeepingTimer(void *arg)
+{
+  updateLed();
+  AllocTrack::sampleHeap();
+  MemBudget::checkStacks();
+}
+
+void setupHousekeeping()
+{
+  const esp_timer_create_args_t args = {
+    .callback = housekeepingTimer,
+    .arg = NULL,
+    .dispatch_method = ESP_TIMER_TASK,
+    .name = "housekeeping"
+  };
+
+  esp_timer_handle_t timer;
+  esp_timer_create(&args, &timer);
+  esp_timer_start_periodic(timer, HOUSEKEEPING_INTERVAL_MS * 1000);
+}
+
+//the loop only handles what needs polling and may block: wifi state changes and ArduinoOTA
+void loop()
+{
+  // reboot if requested from any source after 1 second (allow time for cpu0 to process networking)
+  if(shouldReboot)
+  {
+    delay(1000);
+    ESP.restart();
+  }
+
+  {
+    AllocScope scope(ALLOC_WIFI);
+
+    otaUpdate();
+
+    handleWiFi();
   }
-  
-  
 
+  delay(LOOP_INTERVAL_MS);
 }
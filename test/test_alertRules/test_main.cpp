@@ -0,0 +1,114 @@
+//host tests of the alert rules, run with: pio test -e native
+#include <unity.h>
+
+#include "alertRules.hpp"
+
+//any valid frame, the tests set the fields they look at
+static const char *FRAME = "\"7)%/'0$+GnGmGwGsGtGvH#H1*o##-##7########################%N(\"";
+
+//compiles a single rule and evaluates it once, without a hold time an alert is raised right away
+static bool holds(const char *expr, uint16_t flags)
+{
+    AlertRules rules;
+    char error[64] = "";
+    if(!rules.add("test", expr, AlertRules::ACTION_MQTT, error, sizeof(error))) TEST_FAIL_MESSAGE(error);
+
+    SbmsData sbms(FRAME);
+    sbms.flags = flags;
+
+    AlertRules::Event events[1];
+    rules.evaluate(sbms, 0, events, 1);
+    return rules.active(0);
+}
+
+static const uint16_t DOC_ON = 1 << SbmsData::DOC;
+static const uint16_t DOC_OFF = 0;
+
+void test_flag(void)
+{
+    TEST_ASSERT_TRUE(holds("flags.DOC", DOC_ON));
+    TEST_ASSERT_FALSE(holds("flags.DOC", DOC_OFF));
+    TEST_ASSERT_FALSE(holds("flags.DOC", ~DOC_ON)); //only its own bit counts
+}
+
+void test_flag_ops(void)
+{
+    TEST_ASSERT_TRUE(holds("flags.DOC < 1", DOC_OFF));
+    TEST_ASSERT_FALSE(holds("flags.DOC < 1", DOC_ON));
+    TEST_ASSERT_TRUE(holds("flags.DOC <= 0", DOC_OFF));
+    TEST_ASSERT_FALSE(holds("flags.DOC <= 0", DOC_ON));
+    TEST_ASSERT_TRUE(holds("flags.DOC > 0", DOC_ON));
+    TEST_ASSERT_FALSE(holds("flags.DOC > 0", DOC_OFF));
+    TEST_ASSERT_TRUE(holds("flags.DOC >= 1", DOC_ON));
+    TEST_ASSERT_FALSE(holds("flags.DOC >= 1", DOC_OFF));
+    TEST_ASSERT_TRUE(holds("flags.DOC == 1", DOC_ON));
+    TEST_ASSERT_FALSE(holds("flags.DOC == 1", DOC_OFF));
+    TEST_ASSERT_TRUE(holds("flags.DOC != 1", DOC_OFF));
+    TEST_ASSERT_FALSE(holds("flags.DOC != 1", DOC_ON));
+}
+
+void test_negated_flag(void)
+{
+    TEST_ASSERT_TRUE(holds("!flags.DOC", DOC_OFF));
+    TEST_ASSERT_FALSE(holds("!flags.DOC", DOC_ON));
+}
+
+//! inverts the flag, the comparison applies to the inverted value
+void test_negated_flag_ops(void)
+{
+    TEST_ASSERT_TRUE(holds("!flags.DOC < 1", DOC_ON));
+    TEST_ASSERT_FALSE(holds("!flags.DOC < 1", DOC_OFF));
+    TEST_ASSERT_TRUE(holds("!flags.DOC <= 0", DOC_ON));
+    TEST_ASSERT_FALSE(holds("!flags.DOC <= 0", DOC_OFF));
+    TEST_ASSERT_TRUE(holds("!flags.DOC > 0", DOC_OFF));
+    TEST_ASSERT_FALSE(holds("!flags.DOC > 0", DOC_ON));
+    TEST_ASSERT_TRUE(holds("!flags.DOC >= 1", DOC_OFF));
+    TEST_ASSERT_FALSE(holds("!flags.DOC >= 1", DOC_ON));
+    TEST_ASSERT_TRUE(holds("!flags.DOC == 1", DOC_OFF));
+    TEST_ASSERT_FALSE(holds("!flags.DOC == 1", DOC_ON));
+    TEST_ASSERT_TRUE(holds("!flags.DOC != 1", DOC_ON));
+    TEST_ASSERT_FALSE(holds("!flags.DOC != 1", DOC_OFF));
+}
+
+//the event reports the flag as it is, not inverted
+void test_negated_flag_event(void)
+{
+    AlertRules rules;
+    TEST_ASSERT_TRUE(rules.add("test", "!flags.DOC", AlertRules::ACTION_MQTT));
+
+    SbmsData sbms(FRAME);
+    sbms.flags = DOC_OFF;
+
+    AlertRules::Event events[1];
+    TEST_ASSERT_EQUAL(1, rules.evaluate(sbms, 0, events, 1));
+    TEST_ASSERT_TRUE(events[0].active);
+    TEST_ASSERT_EQUAL(0, events[0].value);
+}
+
+//the name becomes a level of the mqtt topic
+void test_names(void)
+{
+    AlertRules rules;
+    TEST_ASSERT_TRUE(rules.add("cell_high-1", "flags.DOC", AlertRules::ACTION_MQTT));
+
+    const char *invalid[] = {"", "cell/high", "cell+", "#", "cell high", "\"cell\""};
+    for(const char *name : invalid)
+    {
+        char error[64] = "";
+        TEST_ASSERT_FALSE(rules.add(name, "flags.DOC", AlertRules::ACTION_MQTT, error, sizeof(error)));
+        TEST_ASSERT_TRUE(error[0] != 0);
+    }
+    TEST_ASSERT_EQUAL(1, rules.size());
+}
+
+int main(int argc, char **argv)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_flag);
+    RUN_TEST(test_flag_ops);
+    RUN_TEST(test_negated_flag);
+    RUN_TEST(test_negated_flag_ops);
+    RUN_TEST(test_negated_flag_event);
+    RUN_TEST(test_names);
+    return UNITY_END();
+}
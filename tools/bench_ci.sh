@@ -0,0 +1,48 @@
+#!/usr/bin/env bash
+# Benchmarks the host build of HEAD against the merge base with <branch>, both built and run on this machine.
+# Timings of the host build depend on the machine, so CI doesn't compare with a stored baseline. The two programs
+# run alternately and the lowest median of each benchmark counts, see tools/bench_compare.py. A regression has to
+# show up in a second batch of runs as well, a noisy neighbour rarely slows down the same build twice.
+#
+#   tools/bench_ci.sh <branch> [threshold in percent, default 15]
+#
+# On <branch> itself, HEAD is compared with its parent. Run from the repository root, BENCH_RUNS sets the runs per batch.
+set -eu
+
+branch="$1"
+threshold="${2:-15}"
+runs="${BENCH_RUNS:-9}"
+work="$(mktemp -d)"
+
+git fetch --quiet origin "$branch"
+base="$(git merge-base HEAD FETCH_HEAD)"
+if [ "$base" = "$(git rev-parse HEAD)" ]; then
+    base="$(git rev-parse HEAD^)"
+fi
+echo "benchmarking $(git rev-parse --short HEAD) against $(git rev-parse --short "$base")"
+
+git worktree add --quiet --detach "$work/base" "$base" > /dev/null
+trap 'git worktree remove --force "$work/base"; rm -rf "$work"' EXIT
+
+head_program=".pio/build/native/program"
+base_program="$work/base/.pio/build/native/program"
+
+platformio run -e native -s
+if ! platformio run -e native -s -d "$work/base" || ! "$base_program" -b | python -c "import json, sys; json.load(sys.stdin)" 2> /dev/null; then
+    echo "the base has no host build with benchmarks, nothing to compare"
+    exit 0
+fi
+
+batch() {
+    rm -f "$work"/base-*.json "$work"/head-*.json
+    for i in $(seq "$runs"); do
+        "$base_program" -b > "$work/base-$i.json"
+        "$head_program" -b > "$work/head-$i.json"
+    done
+    python tools/bench_compare.py "$work"/head-*.json --baseline "$work"/base-*.json --threshold "$threshold"
+}
+
+if ! batch; then
+    echo "confirming with another batch"
+    batch
+fi
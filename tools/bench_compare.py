@@ -0,0 +1,95 @@
+#!/usr/bin/env python3
+"""Compares a benchmark report with a baseline.
+
+The report is the JSON of /bench on the device or of the host build with -b. It is read from a file,
+from stdin ("-") or from a device ("http://<ip>/bench"). Benchmarks whose median cycles per operation
+grew by more than the threshold are regressions, and the exit code is 1.
+
+Baselines are stored per platform in tools/bench/baseline-<platform>.json. --update replaces the
+baseline with the report. Report and baseline may both be several runs, then the lowest median of
+each benchmark counts: the run least disturbed by the rest of the machine. tools/bench_ci.sh uses
+this to compare two builds on the same machine.
+
+Examples:
+    python tools/bench_compare.py http://192.168.4.1/bench --threshold 5
+    python tools/bench_compare.py head-*.json --baseline base-*.json
+"""
+
+import argparse
+import json
+import os
+import sys
+import urllib.request
+
+BASELINE_DIR = os.path.join(os.path.dirname(os.path.abspath(__file__)), "bench")
+
+
+def load_report(source):
+    if source == "-":
+        return json.load(sys.stdin)
+    if source.startswith("http://"):
+        with urllib.request.urlopen(source, timeout=10) as res:
+            return json.load(res)
+    with open(source) as f:
+        return json.load(f)
+
+
+def best_of(reports):
+    """one report with the lowest median of every benchmark over all reports"""
+    results = {}
+    for report in reports:
+        for r in report["results"]:
+            if r["name"] not in results or r["cyclesMedian"] < results[r["name"]]["cyclesMedian"]:
+                results[r["name"]] = r
+    merged = dict(reports[0])
+    merged["results"] = list(results.values())
+    return merged
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("report", nargs="+", help="report file(s), - for stdin, or the /bench URL of a device")
+    parser.add_argument("--baseline", nargs="+", help="baseline file(s) (default: tools/bench/baseline-<platform>.json)")
+    parser.add_argument("--threshold", type=float, default=10, help="allowed growth of the median in percent (default 10)")
+    parser.add_argument("--update", action="store_true", help="store the report as the new baseline")
+    args = parser.parse_args()
+
+    report = best_of([load_report(source) for source in args.report])
+    baseline_files = args.baseline or [os.path.join(BASELINE_DIR, "baseline-%s.json" % report["platform"])]
+
+    if args.update:
+        if len(baseline_files) > 1:
+            sys.exit("--update stores a single baseline")
+        baseline_file = baseline_files[0]
+        with open(baseline_file, "w") as f:
+            json.dump(report, f, indent=2)
+            f.write("\n")
+        print("baseline stored in " + baseline_file)
+        return 0
+
+    if not all(os.path.exists(f) for f in baseline_files):
+        sys.exit("no baseline for platform %s, store one with --update" % report["platform"])
+
+    baseline = {r["name"]: r for r in best_of([load_report(f) for f in baseline_files])["results"]}
+
+    regressions = 0
+    print("%-28s %12s %12s %8s" % ("benchmark", "baseline", "current", "change"))
+    for r in report["results"]:
+        base = baseline.get(r["name"])
+        if base is None:
+            print("%-28s %12s %12.2f %8s" % (r["name"], "-", r["cyclesMedian"], "new"))
+            continue
+
+        change = (r["cyclesMedian"] / base["cyclesMedian"] - 1) * 100 if base["cyclesMedian"] else 0
+        regressed = change > args.threshold
+        regressions += regressed
+        print("%-28s %12.2f %12.2f %+7.1f%%%s" % (r["name"], base["cyclesMedian"], r["cyclesMedian"], change, "  REGRESSION" if regressed else ""))
+
+    if regressions:
+        print("%d benchmark(s) regressed by more than %.0f%%" % (regressions, args.threshold))
+        return 1
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,99 @@
+#!/usr/bin/env python3
+"""Packs the web interface in data/dist into a C header for lib/assetBundle.
+
+Every file becomes a const array in flash plus an entry of the ASSET_BUNDLE table. A ".gz" suffix is
+removed from the url and the file is served with Content-Encoding gzip. Files named after their content
+hash (8 hex digits, like 43b77c50.js.gz) are marked immutable, all files get an ETag from their SHA-256.
+
+Runs as pre script of the esp32 environments and writes $BUILD_DIR/assets/assetBundleData.h. The header
+is only rewritten if its content changed, so unchanged assets don't cause a rebuild. Standalone:
+    python tools/bundle_assets.py data/dist assetBundleData.h
+"""
+
+import hashlib
+import os
+import re
+import sys
+
+CONTENT_TYPES = {
+    ".html": "text/html",
+    ".js": "application/javascript",
+    ".css": "text/css",
+    ".json": "application/json",
+    ".ico": "image/x-icon",
+    ".png": "image/png",
+    ".svg": "image/svg+xml",
+}
+
+HASHED_NAME = re.compile(r"^[0-9a-f]{8}\.")
+
+
+def bundle(source_dir):
+    lines = [
+        "//generated by tools/bundle_assets.py from %s, do not edit" % source_dir.replace("\\", "/"),
+        "#ifndef ASSETBUNDLEDATA_H",
+        "#define ASSETBUNDLEDATA_H",
+        "",
+        "#include \"assetBundle.hpp\"",
+        "",
+    ]
+    entries = []
+
+    for index, name in enumerate(sorted(os.listdir(source_dir))):
+        path = os.path.join(source_dir, name)
+        if not os.path.isfile(path):
+            continue
+        with open(path, "rb") as f:
+            data = f.read()
+
+        gzip = name.endswith(".gz")
+        url = name[:-3] if gzip else name
+        content_type = CONTENT_TYPES.get(os.path.splitext(url)[1], "application/octet-stream")
+        etag = hashlib.sha256(data).hexdigest()[:16]
+        immutable = HASHED_NAME.match(url) is not None
+
+        lines.append("static const uint8_t asset_%d[] = { //%s, %d bytes" % (index, name, len(data)))
+        for i in range(0, len(data), 24):
+            lines.append("    " + ",".join("0x%02x" % b for b in data[i:i + 24]) + ",")
+        lines.append("};")
+        lines.append("")
+
+        entries.append("    { \"/%s\", \"%s\", \"\\\"%s\\\"\", asset_%d, sizeof(asset_%d), %s, %s },"
+                       % (url, content_type, etag, index, index, str(gzip).lower(), str(immutable).lower()))
+
+    lines.append("static const AssetBundle::Asset ASSET_BUNDLE[] = {")
+    lines.extend(entries)
+    lines.append("};")
+    lines.append("")
+    lines.append("static const size_t ASSET_BUNDLE_COUNT = sizeof(ASSET_BUNDLE) / sizeof(ASSET_BUNDLE[0]);")
+    lines.append("")
+    lines.append("#endif")
+    return "\n".join(lines) + "\n"
+
+
+def write_if_changed(path, content):
+    if os.path.exists(path):
+        with open(path) as f:
+            if f.read() == content:
+                return False
+    os.makedirs(os.path.dirname(os.path.abspath(path)), exist_ok=True)
+    with open(path, "w") as f:
+        f.write(content)
+    return True
+
+
+try:
+    Import("env")  # noqa: F821, provided by PlatformIO
+except NameError:
+    env = None
+
+if env is not None:
+    out_dir = os.path.join(env.subst("$BUILD_DIR"), "assets")
+    source = os.path.join(env.subst("$PROJECT_DIR"), "data", "dist")
+    if write_if_changed(os.path.join(out_dir, "assetBundleData.h"), bundle(source)):
+        print("asset bundle: packed %s" % source)
+    env.Append(CPPPATH=[out_dir])
+elif __name__ == "__main__":
+    if len(sys.argv) != 3:
+        sys.exit(__doc__)
+    write_if_changed(sys.argv[2], bundle(sys.argv[1]))
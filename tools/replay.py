@@ -0,0 +1,123 @@
+#!/usr/bin/env python3
+"""Replays captured SBMS traffic to a serial port, as a load test for the firmware.
+
+Sends the given capture files (default: data/testdata and documentation/testdata) in a loop,
+paced to the baud rate, optionally corrupted, truncated and released in bursts. With --host,
+the parser statistics of the device are read from /stats before and after, and the difference
+is reported.
+
+Example:
+    python tools/replay.py /dev/ttyUSB0 --baud 921600 --seconds 30 --corrupt 100 --host 192.168.4.1
+"""
+
+import argparse
+import json
+import os
+import random
+import sys
+import time
+import urllib.request
+
+try:
+    import serial
+except ImportError:
+    sys.exit("pyserial is required: pip install pyserial")
+
+ROOT = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+DEFAULT_FILES = [os.path.join(ROOT, "data", "testdata"), os.path.join(ROOT, "documentation", "testdata")]
+
+
+def load_lines(files):
+    lines = []
+    for name in files:
+        with open(name, "rb") as f:
+            lines += [l.rstrip(b"\r\n") + b"\r\n" for l in f.read().splitlines() if l.strip()]
+    if not lines:
+        sys.exit("no data in " + ", ".join(files))
+    return lines
+
+
+def mangle(line, args, counters):
+    if args.truncate and random.random() * 100 < args.truncate:
+        line = line[:random.randint(1, max(1, len(line) - 3))] + b"\r\n"
+        counters["truncated"] += 1
+
+    if args.corrupt:
+        data = bytearray(line)
+        for i in range(len(data)):
+            if random.random() * 1000000 < args.corrupt:
+                data[i] = random.randint(0, 255)
+                counters["corrupted"] += 1
+        line = bytes(data)
+
+    return line
+
+
+def device_stats(host, source):
+    with urllib.request.urlopen("http://%s/stats" % host, timeout=5) as res:
+        stats = json.load(res)
+    for s in stats["sources"]:
+        if s["source"] == source:
+            return s
+    sys.exit("source %d is not enabled on the device" % source)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("port", help="serial port connected to the RX pin of a source")
+    parser.add_argument("files", nargs="*", default=DEFAULT_FILES, help="capture files with one variable per line")
+    parser.add_argument("--baud", type=int, default=921600, help="baud rate of the port (default 921600)")
+    parser.add_argument("--rate", type=int, default=0, help="payload rate in baud if lower than the port rate, 0 for line rate")
+    parser.add_argument("--seconds", type=float, default=10, help="duration of the replay")
+    parser.add_argument("--corrupt", type=int, default=0, help="probability of a byte to be replaced, per million bytes")
+    parser.add_argument("--truncate", type=float, default=0, help="probability of a line to be cut off, in percent")
+    parser.add_argument("--burst", type=float, default=0, help="release the data in bursts of this many ms")
+    parser.add_argument("--host", help="device address, to report parser statistics")
+    parser.add_argument("--source", type=int, default=0, help="source index the port is connected to (default 0)")
+    args = parser.parse_args()
+
+    lines = load_lines(args.files)
+    counters = {"bytes": 0, "lines": 0, "corrupted": 0, "truncated": 0}
+    rate = (args.rate or args.baud) / 10.0  # bytes per second, 8N1
+
+    before = device_stats(args.host, args.source) if args.host else None
+
+    with serial.Serial(args.port, args.baud) as port:
+        start = time.monotonic()
+        pending = b""
+        i = 0
+        while time.monotonic() - start < args.seconds:
+            if args.burst:
+                time.sleep(args.burst / 1000.0)
+            due = int((time.monotonic() - start) * rate) if (args.rate or args.burst) else counters["bytes"] + 4096
+
+            while counters["bytes"] + len(pending) < due:
+                pending += mangle(lines[i], args, counters)
+                counters["lines"] += 1
+                i = (i + 1) % len(lines)
+
+            port.write(pending)  # blocks at line rate
+            counters["bytes"] += len(pending)
+            pending = b""
+
+        port.flush()
+        elapsed = time.monotonic() - start
+
+    print("sent %d bytes, %d lines in %.1f s (%.0f baud), %d bytes corrupted, %d lines truncated" % (
+        counters["bytes"], counters["lines"], elapsed, counters["bytes"] * 10 / elapsed, counters["corrupted"], counters["truncated"]))
+
+    if args.host:
+        time.sleep(0.5)  # let the device drain its queues
+        after = device_stats(args.host, args.source)
+        committed = after["parser"]["committed"] - before["parser"]["committed"]
+        print("device: %d vars committed (%.0f/s), %d parse errors, %d gaps, %d dropped, %d coalesced, %d invalid frames" % (
+            committed, committed / elapsed,
+            after["parser"]["errors"] - before["parser"]["errors"],
+            after["parser"]["gaps"] - before["parser"]["gaps"],
+            after["uart"]["dropped"] - before["uart"]["dropped"],
+            after["uart"]["coalesced"] - before["uart"]["coalesced"],
+            after["uart"]["invalidFrames"] - before["uart"]["invalidFrames"]))
+
+
+if __name__ == "__main__":
+    main()
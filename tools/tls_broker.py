@@ -0,0 +1,103 @@
+#!/usr/bin/env python3
+"""Sets up a local TLS-enabled MQTT broker (mosquitto) for testing mq_tls.
+
+Creates a CA and a broker certificate for the given host name or IP with openssl, writes a mosquitto
+configuration listening on --port with TLS and prints the settings for /cfg/mqtt, including the
+fingerprint for mq_fingerprint (required for an IP, the device only checks names against the CA). With --device, the CA certificate is uploaded to /cfg/mqtt_ca of the
+device. With --run, mosquitto is started with the configuration (it has to be installed).
+
+Files are kept in --dir and reused on the next run, so the device keeps trusting the broker.
+
+After a reconnect (restart the broker or toggle the WiFi), /mqtt on the device shows the resumed
+handshakes and their time next to the full ones.
+
+Examples:
+    python tools/tls_broker.py --host 192.168.1.10 --device http://192.168.1.50 --run
+    python tools/tls_broker.py --host broker.local --port 8884
+"""
+
+import argparse
+import ipaddress
+import os
+import shutil
+import subprocess
+import sys
+import urllib.request
+
+
+def openssl(*args):
+    subprocess.run(["openssl"] + list(args), check=True, stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+
+
+def create_certificates(directory, host):
+    ca_key = os.path.join(directory, "ca.key")
+    ca_pem = os.path.join(directory, "ca.pem")
+    key = os.path.join(directory, "broker.key")
+    csr = os.path.join(directory, "broker.csr")
+    pem = os.path.join(directory, "broker.pem")
+    ext = os.path.join(directory, "broker.ext")
+
+    if not os.path.exists(ca_pem):
+        openssl("ecparam", "-name", "prime256v1", "-genkey", "-noout", "-out", ca_key)
+        openssl("req", "-x509", "-new", "-key", ca_key, "-sha256", "-days", "3650", "-subj", "/CN=electrodacus test CA", "-out", ca_pem)
+
+    if not os.path.exists(pem):
+        try:
+            ipaddress.ip_address(host)
+            san = "IP:" + host
+        except ValueError:
+            san = "DNS:" + host
+        with open(ext, "w") as f:
+            f.write("subjectAltName=%s\nextendedKeyUsage=serverAuth\n" % san)
+
+        openssl("ecparam", "-name", "prime256v1", "-genkey", "-noout", "-out", key)
+        openssl("req", "-new", "-key", key, "-subj", "/CN=" + host, "-out", csr)
+        openssl("x509", "-req", "-in", csr, "-CA", ca_pem, "-CAkey", ca_key, "-CAcreateserial", "-sha256", "-days", "3650",
+                "-extfile", ext, "-out", pem)
+
+    return ca_pem, pem, key
+
+
+def fingerprint(pem):
+    out = subprocess.run(["openssl", "x509", "-noout", "-fingerprint", "-sha256", "-in", pem], check=True, capture_output=True, text=True).stdout
+    return out.strip().split("=", 1)[1].replace(":", "").lower()
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--host", required=True, help="name or IP the device connects to, goes into the certificate")
+    parser.add_argument("--port", type=int, default=8883, help="TLS port of the broker (default 8883)")
+    parser.add_argument("--dir", default=".pio/tls-broker", help="directory for the certificates and the configuration")
+    parser.add_argument("--device", help="upload the CA certificate to this device, e.g. http://192.168.4.1")
+    parser.add_argument("--run", action="store_true", help="start mosquitto with the configuration")
+    args = parser.parse_args()
+
+    os.makedirs(args.dir, exist_ok=True)
+    ca_pem, pem, key = create_certificates(args.dir, args.host)
+
+    conf = os.path.join(args.dir, "mosquitto.conf")
+    with open(conf, "w") as f:
+        f.write("listener %d\nallow_anonymous true\ncafile %s\ncertfile %s\nkeyfile %s\ntls_version tlsv1.2\n"
+                % (args.port, os.path.abspath(ca_pem), os.path.abspath(pem), os.path.abspath(key)))
+
+    print("CA certificate: %s" % ca_pem)
+    print("settings for /cfg/mqtt: \"mq_host\": \"%s\", \"mq_port\": %d, \"mq_tls\": true, \"mq_fingerprint\": \"%s\""
+          % (args.host, args.port, fingerprint(pem)))
+
+    if args.device:
+        with open(ca_pem, "rb") as f:
+            req = urllib.request.Request(args.device.rstrip("/") + "/cfg/mqtt_ca", data=f.read(), method="POST",
+                                         headers={"Content-Type": "application/x-pem-file"})
+        with urllib.request.urlopen(req, timeout=10) as res:
+            print("upload: %s" % res.read().decode())
+
+    if args.run:
+        if not shutil.which("mosquitto"):
+            sys.exit("mosquitto not found")
+        os.execvp("mosquitto", ["mosquitto", "-v", "-c", conf])
+    else:
+        print("start the broker with: mosquitto -v -c %s" % conf)
+
+
+if __name__ == "__main__":
+    main()